@@ -0,0 +1,4 @@
+bench: all
+	$(PHP_EXECUTABLE) -n -d extension=$(phplibdir)/ircclient.so $(srcdir)/bench/bench.php $(BENCH_ARGS)
+
+.PHONY: bench
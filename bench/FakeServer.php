@@ -0,0 +1,340 @@
+<?php
+
+namespace irc\client\bench;
+
+use irc\client\Session;
+use irc\client\SessionPool;
+
+/**
+ * Loopback stand-in for an ircd, driven from the same select() as the Session
+ * through the fd arrays of Session::run().
+ */
+class FakeServer
+{
+	public $nick;
+	public $registered = false;
+	public $closed = false;
+	/**
+	 * @var array capabilities offered by CAP LS, name => value
+	 */
+	public $caps = array();
+	/**
+	 * @var array capabilities acknowledged to the client
+	 */
+	public $enabled = array();
+
+	protected $server;
+	protected $client;
+	protected $input = "";
+	protected $output = "";
+	protected $user = false;
+	protected $negotiating = false;
+	protected $name = "bench.server";
+	protected $script;
+	protected $due = 0.0;
+
+	/**
+	 * @var callable function(FakeServer $server) called when the output buffer runs low
+	 */
+	public $onDrain;
+	/**
+	 * @var callable function(FakeServer $server, string $line) for every line the client sent
+	 */
+	public $onLine;
+
+	function __construct($address = "tcp://127.0.0.1:0") {
+		if (!($this->server = stream_socket_server($address, $errno, $errstr))) {
+			throw new \RuntimeException($errstr, $errno);
+		}
+		stream_set_blocking($this->server, 0);
+		$this->script = new \SplQueue;
+	}
+
+	function getPort() {
+		$name = stream_socket_get_name($this->server, false);
+		return (int) substr($name, strrpos($name, ":") + 1);
+	}
+
+	function getName() {
+		return $this->name;
+	}
+
+	function send($line) {
+		$this->output .= $line . "\r\n";
+	}
+
+	function sendRaw($data) {
+		$this->output .= $data;
+	}
+
+	function pending() {
+		return strlen($this->output) + count($this->script);
+	}
+
+	/**
+	 * Queue lines to be released at $rate lines per second, or at once if $rate is 0
+	 */
+	function schedule(array $lines, $rate = 0) {
+		$now = microtime(true);
+
+		if ($this->due < $now) {
+			$this->due = $now;
+		}
+		foreach ($lines as $line) {
+			$this->script->enqueue(array($this->due, $line));
+			if ($rate > 0) {
+				$this->due += 1 / $rate;
+			}
+		}
+	}
+
+	/**
+	 * Replay recorded traffic; one line per line of the file, blank lines and
+	 * lines starting with # are skipped, $nick is replaced by the client's nick
+	 */
+	function replay($file, $rate = 0) {
+		if (false === ($lines = file($file, FILE_IGNORE_NEW_LINES|FILE_SKIP_EMPTY_LINES))) {
+			throw new \RuntimeException("could not read $file");
+		}
+		$lines = array_filter($lines, function($line) {
+			return $line[0] !== "#";
+		});
+		$this->schedule(str_replace('$nick', $this->nick, $lines), $rate);
+	}
+
+	/**
+	 * Inject $count lines of JOIN, PRIVMSG (to the client), CHANNEL (PRIVMSG to
+	 * $channel) or NAMES (353 replies of 20 nicks each, followed by a 366)
+	 */
+	function flood($type, $count, $rate = 0, $channel = "#bench") {
+		$lines = array();
+
+		for ($i = 0; $i < $count; ++$i) {
+			$from = "u$i!user@flood.host";
+
+			switch (strtoupper($type)) {
+			case "JOIN":
+				$lines[] = ":$from JOIN $channel";
+				break;
+			case "PRIVMSG":
+				$lines[] = ":$from PRIVMSG {$this->nick} :flood $i";
+				break;
+			case "CHANNEL":
+				$lines[] = ":$from PRIVMSG $channel :flood $i";
+				break;
+			case "NAMES":
+				$names = array();
+				for ($j = 0; $j < 20; ++$j) {
+					$names[] = ($j % 5 ? "" : "@") . "n{$i}_{$j}";
+				}
+				$lines[] = ":{$this->name} 353 {$this->nick} = $channel :" . implode(" ", $names);
+				break;
+			default:
+				throw new \InvalidArgumentException("unknown flood type: $type");
+			}
+		}
+		if (!strcasecmp($type, "NAMES")) {
+			$lines[] = ":{$this->name} 366 {$this->nick} $channel :End of /NAMES list.";
+		}
+		$this->schedule($lines, $rate);
+	}
+
+	function close() {
+		if ($this->client) {
+			fclose($this->client);
+			$this->client = null;
+		}
+		$this->closed = true;
+	}
+
+	/**
+	 * One iteration of the common loop; returns false if Session::run() failed
+	 *
+	 * @param Session|SessionPool $session
+	 */
+	function tick($session, $timeout = 1.0) {
+		list($r, $w, $timeout) = $this->prepare($timeout);
+
+		if (false === ($fds = $session->run($r, $w, $timeout))) {
+			return false;
+		}
+		if (count($fds) < 2) {
+			/* interrupted */
+			return true;
+		}
+		$this->ready($fds[0], $fds[1]);
+		return true;
+	}
+
+	/**
+	 * One iteration of a loop of its own, for a client running in another
+	 * process; returns false once the client is gone
+	 */
+	function serve($timeout = 1.0) {
+		list($r, $w, $timeout) = $this->prepare($timeout);
+		$e = null;
+		$sec = (int) $timeout;
+
+		if (false === stream_select($r, $w, $e, $sec, (int) (($timeout - $sec) * 1000000))) {
+			return false;
+		}
+		$this->ready($r, $w);
+		return !$this->closed;
+	}
+
+	/**
+	 * The streams to select and the timeout clamped to the next scripted line
+	 */
+	protected function prepare($timeout) {
+		$r = array($this->server);
+		$w = array();
+
+		if ($this->client) {
+			$r[] = $this->client;
+			if ($this->registered) {
+				$timeout = $this->release($timeout);
+			}
+			if ($this->registered && $this->onDrain && strlen($this->output) < 65536) {
+				call_user_func($this->onDrain, $this);
+			}
+			if (strlen($this->output)) {
+				$w[] = $this->client;
+			}
+		}
+		return array($r, $w, $timeout);
+	}
+
+	protected function ready(array $r, array $w) {
+		foreach ($r as $fd) {
+			if ($fd === $this->server) {
+				$this->accept();
+			} elseif ($fd === $this->client) {
+				$this->read();
+			}
+		}
+		if ($w && $this->client) {
+			$this->write();
+		}
+	}
+
+	/**
+	 * Move due scripted lines to the output, returns the timeout clamped to the next one
+	 */
+	protected function release($timeout) {
+		$now = microtime(true);
+
+		while (!$this->script->isEmpty()) {
+			list($due, $line) = $this->script->bottom();
+			if ($due > $now) {
+				if ($due - $now < $timeout) {
+					$timeout = $due - $now;
+				}
+				break;
+			}
+			$this->script->dequeue();
+			$this->send($line);
+		}
+		return $timeout;
+	}
+
+	/**
+	 * IRCv3 capability negotiation; registration waits for CAP END if CAP LS came first
+	 */
+	protected function cap(array $args) {
+		$nick = $this->nick ?: "*";
+
+		switch (strtoupper($args[0])) {
+		case "LS":
+			$list = array();
+			foreach ($this->caps as $name => $value) {
+				$list[] = strlen($value) ? "$name=$value" : $name;
+			}
+			$this->negotiating = !$this->registered;
+			$this->send(":{$this->name} CAP $nick LS :" . implode(" ", $list));
+			break;
+		case "REQ":
+			$req = isset($args[1]) ? array_filter(explode(" ", ltrim($args[1], ":")), "strlen") : array();
+			if (array_diff($req, array_keys($this->caps))) {
+				$this->send(":{$this->name} CAP $nick NAK :" . implode(" ", $req));
+			} else {
+				$this->enabled = array_unique(array_merge($this->enabled, $req));
+				$this->send(":{$this->name} CAP $nick ACK :" . implode(" ", $req));
+			}
+			break;
+		case "END":
+			$this->negotiating = false;
+			break;
+		}
+	}
+
+	protected function accept() {
+		if (($client = @stream_socket_accept($this->server, 0))) {
+			stream_set_blocking($client, 0);
+			stream_set_write_buffer($client, 0);
+			if ($this->client) {
+				fclose($this->client);
+			}
+			/* a client connecting again starts over */
+			$this->client = $client;
+			$this->closed = false;
+			$this->registered = false;
+			$this->negotiating = false;
+			$this->user = false;
+			$this->nick = null;
+			$this->input = $this->output = "";
+			$this->enabled = array();
+		}
+	}
+
+	protected function read() {
+		$data = fread($this->client, 65536);
+
+		if (!strlen($data)) {
+			if (feof($this->client)) {
+				$this->close();
+			}
+			return;
+		}
+
+		$this->input .= $data;
+		while (false !== ($eol = strpos($this->input, "\n"))) {
+			$line = rtrim(substr($this->input, 0, $eol), "\r");
+			$this->input = substr($this->input, $eol + 1);
+			$this->handle($line);
+		}
+	}
+
+	protected function write() {
+		if (($n = fwrite($this->client, $this->output))) {
+			$this->output = (string) substr($this->output, $n);
+		}
+	}
+
+	protected function handle($line) {
+		$argv = explode(" ", $line, 2);
+
+		switch (strtoupper($argv[0])) {
+		case "NICK":
+			$this->nick = ltrim($argv[1], ":");
+			break;
+		case "USER":
+			$this->user = true;
+			break;
+		case "PING":
+			$this->send(":{$this->name} PONG {$this->name} {$argv[1]}");
+			break;
+		case "CAP":
+			$this->cap(explode(" ", $argv[1], 2));
+			break;
+		}
+
+		if (!$this->registered && !$this->negotiating && $this->nick && $this->user) {
+			$this->registered = true;
+			$this->send(":{$this->name} 001 {$this->nick} :Welcome to the bench");
+			$this->send(":{$this->name} 005 {$this->nick} PREFIX=(ov)@+ CHANMODES=beI,k,l,imnpst CASEMAPPING=rfc1459 TARGMAX=PRIVMSG:4,NOTICE:4 :are supported by this server");
+		}
+		if ($this->onLine) {
+			call_user_func($this->onLine, $this, $line);
+		}
+	}
+}
@@ -0,0 +1,189 @@
+<?php
+
+/*
+ * Event dispatch micro-benchmark
+ *
+ * Feeds synthetic traffic from a loopback FakeServer through Session::run()
+ * and reports events/sec, memory per event and p50/p99 latency per handler,
+ * i.e. the time from the line being written by the server until the handler
+ * is entered.
+ *
+ * Usage: php -d extension=ircclient.so bench/bench.php [events [type [handlers]]]
+ *   events    number of lines to send, default 100000
+ *   type      privmsg, channel, notice, join, part, quit, nick, numeric or mixed
+ *   handlers  method, closure or none (no latency figures)
+ *
+ * `make bench` runs it with BENCH_ARGS.
+ */
+
+namespace irc\client\bench;
+
+use irc\client\Session;
+
+require_once __DIR__ . "/FakeServer.php";
+
+class Traffic
+{
+	static $types = array("privmsg", "channel", "notice", "join", "part", "quit", "nick", "numeric");
+
+	static function line($type, $i, $nick) {
+		/* the sender's user name, or the trailing param, carries the time stamp */
+		$ts = sprintf("%.6F", microtime(true));
+		$from = "u" . ($i % 500) . "!{$ts}@bench.host";
+
+		switch ($type) {
+		case "privmsg":
+			return ":$from PRIVMSG $nick :hello $i";
+		case "channel":
+			return ":$from PRIVMSG #bench :hello $i";
+		case "notice":
+			return ":$from NOTICE $nick :hello $i";
+		case "join":
+			return ":$from JOIN #bench";
+		case "part":
+			return ":$from PART #bench :bye";
+		case "quit":
+			return ":$from QUIT :bye";
+		case "nick":
+			return ":$from NICK n$i";
+		case "numeric":
+			return ":bench.server 372 $nick :- $ts";
+		}
+	}
+}
+
+class Recorder
+{
+	public $count = 0;
+	public $latency = array();
+
+	function hit($event, $origin, array $args) {
+		$now = microtime(true);
+
+		if (false !== ($bang = strpos($origin, "!"))) {
+			$ts = (float) substr($origin, $bang + 1);
+		} else {
+			$ts = (float) substr(end($args), 2);
+		}
+		$this->latency[$event][] = $now - $ts;
+		++$this->count;
+	}
+}
+
+class MethodSession extends Session
+{
+	public $recorder;
+
+	function onPrivmsg($origin, array $args) { $this->recorder->hit("onPrivmsg", $origin, $args); }
+	function onChannel($origin, array $args) { $this->recorder->hit("onChannel", $origin, $args); }
+	function onNotice($origin, array $args) { $this->recorder->hit("onNotice", $origin, $args); }
+	function onJoin($origin, array $args) { $this->recorder->hit("onJoin", $origin, $args); }
+	function onPart($origin, array $args) { $this->recorder->hit("onPart", $origin, $args); }
+	function onQuit($origin, array $args) { $this->recorder->hit("onQuit", $origin, $args); }
+	function onNick($origin, array $args) { $this->recorder->hit("onNick", $origin, $args); }
+	function onNumeric($origin, $event, array $args) {
+		if ($event == 372) {
+			$this->recorder->hit("onNumeric", $origin, $args);
+		}
+	}
+}
+
+function percentile(array $sorted, $p) {
+	return $sorted[(int) min(count($sorted) - 1, floor(count($sorted) * $p))];
+}
+
+$events = isset($argv[1]) ? (int) $argv[1] : 100000;
+$type = isset($argv[2]) ? $argv[2] : "privmsg";
+$handlers = isset($argv[3]) ? $argv[3] : "method";
+
+if ($type !== "mixed" && !in_array($type, Traffic::$types, true)) {
+	fprintf(STDERR, "unknown traffic type: %s\n", $type);
+	exit(1);
+}
+
+$recorder = new Recorder;
+
+switch ($handlers) {
+case "method":
+	$session = new MethodSession("bench", "bench", "bench");
+	$session->recorder = $recorder;
+	break;
+case "closure":
+	$session = new Session("bench", "bench", "bench");
+	foreach (array("onPrivmsg", "onChannel", "onNotice", "onJoin", "onPart", "onQuit", "onNick") as $event) {
+		$session->$event = function($origin, array $args) use ($recorder, $event) {
+			$recorder->hit($event, $origin, $args);
+		};
+	}
+	$session->onNumeric = function($origin, $event, array $args) use ($recorder) {
+		if ($event == 372) {
+			$recorder->hit("onNumeric", $origin, $args);
+		}
+	};
+	break;
+case "none":
+	$session = new Session("bench", "bench", "bench");
+	break;
+default:
+	fprintf(STDERR, "unknown handler type: %s\n", $handlers);
+	exit(1);
+}
+
+$server = new FakeServer;
+$sent = 0;
+$start = $stop = null;
+$mem = 0;
+
+$server->onDrain = function(FakeServer $server) use (&$sent, &$start, &$mem, $events, $type) {
+	if ($sent >= $events) {
+		return;
+	}
+	if (!isset($start)) {
+		$mem = memory_get_usage();
+		$start = microtime(true);
+	}
+	for ($i = 0; $i < 256 && $sent < $events; ++$i, ++$sent) {
+		$t = $type === "mixed" ? Traffic::$types[$sent % count(Traffic::$types)] : $type;
+		$server->send(Traffic::line($t, $sent, $server->nick));
+	}
+	if ($sent >= $events) {
+		/* libircclient answers this one only after everything before was dispatched */
+		$server->send("PING :bench-done");
+	}
+};
+$server->onLine = function(FakeServer $server, $line) use (&$stop) {
+	if (!isset($stop) && false !== strpos($line, "bench-done")) {
+		$stop = microtime(true);
+	}
+};
+
+if (!$session->doConnect(false, "127.0.0.1", $server->getPort())) {
+	exit(1);
+}
+while (!isset($stop) && !$server->closed) {
+	if (!$server->tick($session, 1)) {
+		break;
+	}
+}
+$session->disconnect();
+
+if (!isset($stop)) {
+	fprintf(STDERR, "benchmark did not complete\n");
+	exit(1);
+}
+
+$elapsed = $stop - $start;
+
+printf("ircclient %s dispatch benchmark: %d %s lines, %s handlers\n", phpversion("ircclient"), $events, $type, $handlers);
+printf("  %-12s %12.0f\n", "events/sec", $events / $elapsed);
+printf("  %-12s %12.3f s\n", "elapsed", $elapsed);
+/* allocation counts are not visible from userland; this is what stays allocated */
+printf("  %-12s %12.2f bytes/event (peak %.1f MiB)\n", "memory", (memory_get_usage() - $mem) / $events, memory_get_peak_usage() / 1048576);
+
+if ($recorder->count) {
+	printf("\n  %-12s %10s %10s %10s\n", "latency", "count", "p50 ms", "p99 ms");
+	foreach ($recorder->latency as $event => $latency) {
+		sort($latency);
+		printf("  %-12s %10d %10.3f %10.3f\n", $event, count($latency), percentile($latency, .5) * 1000, percentile($latency, .99) * 1000);
+	}
+}
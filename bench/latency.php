@@ -0,0 +1,65 @@
+<?php
+
+/*
+ * doMsg() round trip benchmark
+ *
+ * Measures the time from Session::doMsg() until the FakeServer has read the
+ * PRIVMSG off the socket, optionally while the server floods the client.
+ *
+ * Usage: php -d extension=ircclient.so bench/latency.php [messages [flood [rate]]]
+ *   messages  number of PRIVMSGs to send, default 10000
+ *   flood     join, privmsg, channel or names traffic to inject meanwhile
+ *   rate      flood lines per second, default 10000
+ */
+
+namespace irc\client\bench;
+
+use irc\client\Session;
+
+require_once __DIR__ . "/FakeServer.php";
+
+$messages = isset($argv[1]) ? (int) $argv[1] : 10000;
+$flood = isset($argv[2]) ? $argv[2] : null;
+$rate = isset($argv[3]) ? (float) $argv[3] : 10000;
+
+$session = new Session("bench", "bench", "bench");
+$server = new FakeServer;
+$latency = array();
+$sent = 0;
+
+$server->onLine = function(FakeServer $server, $line) use (&$latency) {
+	if (sscanf($line, "PRIVMSG peer :%d %f", $seq, $ts) == 2) {
+		$latency[$seq] = microtime(true) - $ts;
+	}
+};
+$session->onConnect = function() use ($server, $flood, $messages, $rate) {
+	if ($flood) {
+		/* keep it going for about as long as the messages take */
+		$server->flood($flood, $messages, $rate);
+	}
+};
+
+if (!$session->doConnect(false, "127.0.0.1", $server->getPort())) {
+	exit(1);
+}
+while (count($latency) < $messages && !$server->closed) {
+	if ($server->registered && $sent < $messages && $sent == count($latency)) {
+		$session->doMsg("peer", sprintf("%d %.6F", $sent++, microtime(true)));
+	}
+	if (!$server->tick($session, 1)) {
+		break;
+	}
+}
+$session->disconnect();
+
+if (count($latency) < $messages) {
+	fprintf(STDERR, "benchmark did not complete\n");
+	exit(1);
+}
+
+sort($latency);
+printf("ircclient %s doMsg round trip: %d messages%s\n", phpversion("ircclient"), $messages,
+	$flood ? sprintf(", %s flood at %.0f lines/sec", $flood, $rate) : "");
+foreach (array("min" => 0, "p50" => .5, "p90" => .9, "p99" => .99, "max" => 1) as $label => $p) {
+	printf("  %-4s %10.3f ms\n", $label, $latency[(int) min($messages - 1, floor($messages * $p))] * 1000);
+}
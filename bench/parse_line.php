@@ -0,0 +1,75 @@
+<?php
+
+/*
+ * irc\client\parse_line() compared with a userland equivalent
+ *
+ * Usage: php -d extension=ircclient.so bench/parse_line.php [iterations]
+ */
+
+namespace irc\client\bench;
+
+use irc\client;
+
+function parse_line($line) {
+	$tags = array();
+	$prefix = $nick = $user = $host = null;
+
+	$line = rtrim($line, "\r\n");
+	if ($line[0] === "@") {
+		list($raw, $line) = explode(" ", substr($line, 1), 2);
+		foreach (explode(";", $raw) as $tag) {
+			$kv = explode("=", $tag, 2);
+			$tags[$kv[0]] = isset($kv[1]) ? strtr($kv[1], array(
+				"\\:" => ";", "\\s" => " ", "\\\\" => "\\", "\\r" => "\r", "\\n" => "\n"
+			)) : "";
+		}
+	}
+	if ($line[0] === ":") {
+		list($prefix, $line) = explode(" ", substr($line, 1), 2);
+		if (preg_match('/^([^!@]*)(?:!([^@]*))?(?:@(.*))?$/', $prefix, $m) && (isset($m[2]) || isset($m[3]))) {
+			$nick = $m[1];
+			$user = isset($m[2]) && strlen($m[2]) ? $m[2] : null;
+			$host = isset($m[3]) ? $m[3] : null;
+		} elseif (false !== strpos($prefix, ".")) {
+			$host = $prefix;
+		} else {
+			$nick = $prefix;
+		}
+	}
+	if (false !== ($pos = strpos($line, " :"))) {
+		$params = explode(" ", substr($line, 0, $pos));
+		$params[] = substr($line, $pos + 2);
+	} else {
+		$params = explode(" ", $line);
+	}
+	$command = array_shift($params);
+
+	return compact("tags", "prefix", "nick", "user", "host", "command", "params");
+}
+
+$iterations = isset($argv[1]) ? (int) $argv[1] : 200000;
+$lines = array(
+	":nick!user@host.example.org PRIVMSG #channel :hello there, how are you?",
+	"@time=2012-06-30T23:59:60.419Z;msgid=abc\\sdef :nick!user@host PRIVMSG #channel :tagged",
+	":irc.example.org 353 me = #channel :@op +voice alice bob carol dave",
+	":irc.example.org 005 me PREFIX=(ov)@+ CHANTYPES=#& NETWORK=Example :are supported by this server",
+	"PING :irc.example.org",
+);
+
+foreach ($lines as $line) {
+	if (client\parse_line($line) != parse_line($line)) {
+		fprintf(STDERR, "results differ for: %s\n", $line);
+		var_dump(client\parse_line($line), parse_line($line));
+		exit(1);
+	}
+}
+
+printf("ircclient %s parse_line(): %d lines\n", phpversion("ircclient"), $iterations);
+foreach (array("native" => "irc\\client\\parse_line", "userland" => "irc\\client\\bench\\parse_line") as $label => $func) {
+	$start = microtime(true);
+	for ($i = 0; $i < $iterations; ++$i) {
+		$func($lines[$i % count($lines)]);
+	}
+	$elapsed = microtime(true) - $start;
+	printf("  %-10s %10.0f lines/sec\n", $label, $iterations / $elapsed);
+}
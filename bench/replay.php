@@ -0,0 +1,84 @@
+<?php
+
+/*
+ * Replays recorded server traffic against a Session
+ *
+ * Every line of the recording is sent to the client as-is, with $nick
+ * replaced by the client's nick; the handlers just count what was dispatched.
+ *
+ * Usage: php -d extension=ircclient.so bench/replay.php recording [rate [repeat]]
+ *   rate      lines per second, 0 (default) sends as fast as the client reads
+ *   repeat    how many times to replay the recording, default 1
+ */
+
+namespace irc\client\bench;
+
+use irc\client\Session;
+
+require_once __DIR__ . "/FakeServer.php";
+
+if (!isset($argv[1])) {
+	fprintf(STDERR, "usage: %s recording [rate [repeat]]\n", $argv[0]);
+	exit(1);
+}
+$file = $argv[1];
+$rate = isset($argv[2]) ? (float) $argv[2] : 0;
+$repeat = isset($argv[3]) ? (int) $argv[3] : 1;
+
+class CountingSession extends Session
+{
+	public $events = array();
+
+	function onJoin($origin, array $args) { @++$this->events["onJoin"]; }
+	function onPart($origin, array $args) { @++$this->events["onPart"]; }
+	function onQuit($origin, array $args) { @++$this->events["onQuit"]; }
+	function onNick($origin, array $args) { @++$this->events["onNick"]; }
+	function onMode($origin, array $args) { @++$this->events["onMode"]; }
+	function onTopic($origin, array $args) { @++$this->events["onTopic"]; }
+	function onKick($origin, array $args) { @++$this->events["onKick"]; }
+	function onChannel($origin, array $args) { @++$this->events["onChannel"]; }
+	function onPrivmsg($origin, array $args) { @++$this->events["onPrivmsg"]; }
+	function onNotice($origin, array $args) { @++$this->events["onNotice"]; }
+	function onNumeric($origin, $event, array $args) { @++$this->events["onNumeric"]; }
+	function onUnknown($origin, $event, array $args) { @++$this->events["onUnknown"]; }
+}
+
+$session = new CountingSession("bench", "bench", "bench");
+$server = new FakeServer;
+$start = $stop = null;
+
+$session->onConnect = function() use ($server, $file, $rate, $repeat, &$start) {
+	$start = microtime(true);
+	for ($i = 0; $i < $repeat; ++$i) {
+		$server->replay($file, $rate);
+	}
+	$server->schedule(array("PING :bench-done"), $rate);
+};
+$server->onLine = function(FakeServer $server, $line) use (&$stop) {
+	if (!isset($stop) && false !== strpos($line, "bench-done")) {
+		$stop = microtime(true);
+	}
+};
+
+if (!$session->doConnect(false, "127.0.0.1", $server->getPort())) {
+	exit(1);
+}
+while (!isset($stop) && !$server->closed) {
+	if (!$server->tick($session, 1)) {
+		break;
+	}
+}
+$session->disconnect();
+
+if (!isset($stop)) {
+	fprintf(STDERR, "replay did not complete\n");
+	exit(1);
+}
+
+$total = array_sum($session->events);
+printf("ircclient %s replay of %s x%d: %d events in %.3f s, %.0f events/sec\n",
+	phpversion("ircclient"), basename($file), $repeat, $total, $stop - $start, $total / ($stop - $start));
+ksort($session->events);
+foreach ($session->events as $event => $count) {
+	printf("  %-12s %10d\n", $event, $count);
+}
@@ -21,6 +21,9 @@ class Robot extends Session
 	}
 	
 	function run($watch_stdin = false) {
+		if (!empty($this->config->reconnect)) {
+			$this->setReconnect((int) $this->config->reconnect);
+		}
 		printf("Connecting to %s...\n", $this->config->host);
 		$this->doConnect($this->config->ipv6, $this->config->host, $this->config->port ?: 6667);
 		
@@ -37,6 +37,8 @@ if test "$PHP_IRCCLIENT" != "no"; then
 	AC_DEFINE_UNQUOTED([PHP_IRCCLIENT_LIBIRCCLIENT_VERSION_LOW], [$PHP_IRCCLIENT_LIBIRCCLIENT_VERSION_LOW], [ ])
 	
 	PHP_ADD_INCLUDE($IRCCLIENT_INCDIR)
+	AC_CHECK_HEADERS([sys/epoll.h])
+	PHP_CHECK_FUNC(clock_gettime, rt)
 	AC_CHECK_MEMBER([irc_callbacks_t.event_channel_notice], [
 		AC_DEFINE(HAVE_LIBIRCCLIENT_EVENT_CHANNEL_NOTICE, 1, [ ])
 	], [], [
@@ -53,4 +55,7 @@ if test "$PHP_IRCCLIENT" != "no"; then
 	])
 	PHP_SUBST([IRCCLIENT_SHARED_LIBADD])
 	PHP_NEW_EXTENSION([ircclient], [php_ircclient.c], [$ext_shared])
+	PHP_ADD_EXTENSION_DEP([ircclient], [spl])
+	PHP_ADD_EXTENSION_DEP([ircclient], [pcre])
+	PHP_ADD_MAKEFILE_FRAGMENT
 fi
@@ -18,8 +18,12 @@
 #include <main/php_ini.h>
 #include <main/php_network.h>
 #include <ext/standard/php_string.h>
+#include <ext/standard/php_smart_str.h>
 #include <ext/standard/info.h>
 #include <ext/standard/basic_functions.h>
+#include <ext/standard/php_lcg.h>
+#include <ext/spl/spl_iterators.h>
+#include <ext/pcre/php_pcre.h>
 
 #include <Zend/zend.h>
 #include <Zend/zend_constants.h>
@@ -33,8 +37,36 @@
 
 #include <errno.h>
 #include <ctype.h>
+#include <time.h>
 #include <libircclient.h>
 
+#if HAVE_SYS_EPOLL_H
+#	include <sys/epoll.h>
+#endif
+
+/* extension options, not passed on to libircclient */
+#define PHP_IRCCLIENT_OPTION_EPOLL			0x10000
+#define PHP_IRCCLIENT_OPTION_TRACK_STATE	0x20000
+#define PHP_IRCCLIENT_OPTION_AGGREGATE		0x40000
+#define PHP_IRCCLIENT_OPTION_LAZY_PARAMS	0x80000
+/* tagged lines bypass libircclient, so that CTCP DCC requests arrive as
+ * onCtcpReq instead of onDccChatReq or onDccSendReq once tags are enabled */
+#define PHP_IRCCLIENT_OPTION_MESSAGE_TAGS	0x100000
+#define PHP_IRCCLIENT_OPTION_BATCH			0x200000
+#define PHP_IRCCLIENT_OPTIONS				(PHP_IRCCLIENT_OPTION_EPOLL|PHP_IRCCLIENT_OPTION_TRACK_STATE|PHP_IRCCLIENT_OPTION_AGGREGATE|PHP_IRCCLIENT_OPTION_LAZY_PARAMS|PHP_IRCCLIENT_OPTION_MESSAGE_TAGS|PHP_IRCCLIENT_OPTION_BATCH)
+
+#define PHP_IRCCLIENT_WATCH_READ	0x01
+#define PHP_IRCCLIENT_WATCH_WRITE	0x02
+
+/* send queue lanes, drained in this order */
+#define PHP_IRCCLIENT_PRIORITY_HIGH		0
+#define PHP_IRCCLIENT_PRIORITY_NORMAL	1
+#define PHP_IRCCLIENT_PRIORITY_LOW		2
+#define PHP_IRCCLIENT_PRIORITIES		3
+/* for php_ircclient_session_send(), bypassing the send queue */
+#define PHP_IRCCLIENT_SEND_NOW			-1
+#define PHP_IRCCLIENT_SEND_QUIET		-2
+
 PHP_FUNCTION(parse_origin)
 {
 	char *origin_str;
@@ -75,9 +107,234 @@ done:
 	}
 }
 
+/* max params of a line; the last one takes the rest, like a trailing one */
+#define PHP_IRCCLIENT_LINE_PARAMS 32
+
+typedef struct php_ircclient_chunk {
+	const char *str;
+	size_t len;
+} php_ircclient_chunk_t;
+
+/* a message line split in place, see php_ircclient_line_parse() */
+typedef struct php_ircclient_line {
+	php_ircclient_chunk_t tags;
+	php_ircclient_chunk_t prefix;
+	php_ircclient_chunk_t nick;
+	php_ircclient_chunk_t user;
+	php_ircclient_chunk_t host;
+	php_ircclient_chunk_t command;
+	unsigned int count;
+	php_ircclient_chunk_t params[PHP_IRCCLIENT_LINE_PARAMS];
+} php_ircclient_line_t;
+
+static inline const char *php_ircclient_line_token(php_ircclient_chunk_t *c, const char *p, const char *end)
+{
+	for (c->str = p; p < end && *p != ' '; ++p);
+	c->len = p - c->str;
+	while (p < end && *p == ' ') {
+		++p;
+	}
+	return p;
+}
+
+/* single pass over [@tags] [:prefix] command [params...] [:trailing], no copies */
+static int php_ircclient_line_parse(php_ircclient_line_t *l, const char *str, size_t len)
+{
+	const char *p = str, *end = str + len;
+
+	memset(l, 0, sizeof(*l));
+
+	while (end > p && (end[-1] == '\r' || end[-1] == '\n')) {
+		--end;
+	}
+	while (p < end && *p == ' ') {
+		++p;
+	}
+	if (p < end && *p == '@') {
+		p = php_ircclient_line_token(&l->tags, p + 1, end);
+	}
+	if (p < end && *p == ':') {
+		const char *b = NULL, *a = NULL, *q;
+
+		p = php_ircclient_line_token(&l->prefix, p + 1, end);
+		for (q = l->prefix.str; q < l->prefix.str + l->prefix.len; ++q) {
+			if (*q == '!' && !b && !a) {
+				b = q;
+			} else if (*q == '@' && !a) {
+				a = q;
+			}
+		}
+		if (b || a) {
+			l->nick.str = l->prefix.str;
+			l->nick.len = (b ? b : a) - l->prefix.str;
+			if (b) {
+				l->user.str = b + 1;
+				l->user.len = (a ? a : l->prefix.str + l->prefix.len) - l->user.str;
+			}
+			if (a) {
+				l->host.str = a + 1;
+				l->host.len = l->prefix.str + l->prefix.len - l->host.str;
+			}
+		} else if (memchr(l->prefix.str, '.', l->prefix.len)) {
+			/* a server */
+			l->host = l->prefix;
+		} else {
+			l->nick = l->prefix;
+		}
+	}
+
+	p = php_ircclient_line_token(&l->command, p, end);
+	if (!l->command.len) {
+		return FAILURE;
+	}
+
+	while (p < end) {
+		php_ircclient_chunk_t *c = &l->params[l->count++];
+
+		if (*p == ':' || l->count == PHP_IRCCLIENT_LINE_PARAMS) {
+			if (*p == ':') {
+				++p;
+			}
+			c->str = p;
+			c->len = end - p;
+			break;
+		}
+		p = php_ircclient_line_token(c, p, end);
+	}
+	return SUCCESS;
+}
+
+/* IRCv3 tag value escapes */
+static char *php_ircclient_tag_unescape(const char *str, size_t len, size_t *new_len)
+{
+	char *buf = emalloc(len + 1), *ptr = buf;
+	const char *end = str + len;
+
+	while (str < end) {
+		if (*str != '\\') {
+			*ptr++ = *str++;
+		} else if (++str < end) {
+			switch (*str) {
+			case ':': *ptr++ = ';'; break;
+			case 's': *ptr++ = ' '; break;
+			case 'r': *ptr++ = '\r'; break;
+			case 'n': *ptr++ = '\n'; break;
+			default: *ptr++ = *str; break;
+			}
+			++str;
+		}
+	}
+	*ptr = '\0';
+	*new_len = ptr - buf;
+	return buf;
+}
+
+/* next key[=value] of a raw tags string */
+static int php_ircclient_tags_next(const char **str, const char *end, php_ircclient_chunk_t *key, php_ircclient_chunk_t *val)
+{
+	while (*str < end) {
+		const char *tag = *str, *eq;
+
+		for (; *str < end && **str != ';'; ++*str);
+		key->str = tag;
+		key->len = *str - tag;
+		if (*str < end) {
+			++*str;
+		}
+		if (!key->len) {
+			continue;
+		}
+		if ((eq = memchr(tag, '=', key->len))) {
+			val->str = eq + 1;
+			val->len = tag + key->len - val->str;
+			key->len = eq - tag;
+		} else {
+			val->str = tag + key->len;
+			val->len = 0;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+static int php_ircclient_tags_find(const char *str, size_t len, const char *key_str, size_t key_len, php_ircclient_chunk_t *val)
+{
+	const char *end = str + len;
+	php_ircclient_chunk_t key;
+
+	while (php_ircclient_tags_next(&str, end, &key, val)) {
+		if (key.len == key_len && !memcmp(key.str, key_str, key_len)) {
+			return SUCCESS;
+		}
+	}
+	return FAILURE;
+}
+
+static void php_ircclient_tags_array(zval *array, const char *str, size_t len)
+{
+	const char *end = str + len;
+	php_ircclient_chunk_t key, val;
+
+	array_init(array);
+	while (php_ircclient_tags_next(&str, end, &key, &val)) {
+		size_t val_len;
+		char *val_str = php_ircclient_tag_unescape(val.str, val.len, &val_len);
+		char *key_str = estrndup(key.str, key.len);
+
+		add_assoc_stringl_ex(array, key_str, key.len + 1, val_str, val_len, 0);
+		efree(key_str);
+	}
+}
+
+static inline void php_ircclient_add_chunk(zval *array, const char *key, size_t key_len, php_ircclient_chunk_t *c)
+{
+	if (c->str) {
+		add_assoc_stringl_ex(array, key, key_len, estrndup(c->str, c->len), c->len, 0);
+	} else {
+		add_assoc_null_ex(array, key, key_len);
+	}
+}
+
+/* {{{ proto array irc\client\parse_line(string line)
+	Splits a raw message line into its tags, prefix (and its nick, user and
+	host parts), command and params. Returns false if there's no command. */
+PHP_FUNCTION(parse_line)
+{
+	char *line_str;
+	int line_len;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &line_str, &line_len)) {
+		php_ircclient_line_t line;
+		zval *ztags, *zparams;
+		unsigned int i;
+
+		if (SUCCESS != php_ircclient_line_parse(&line, line_str, line_len)) {
+			RETURN_FALSE;
+		}
+
+		MAKE_STD_ZVAL(ztags);
+		php_ircclient_tags_array(ztags, line.tags.str, line.tags.len);
+		MAKE_STD_ZVAL(zparams);
+		array_init_size(zparams, line.count);
+		for (i = 0; i < line.count; ++i) {
+			add_next_index_stringl(zparams, estrndup(line.params[i].str, line.params[i].len), line.params[i].len, 0);
+		}
+
+		array_init_size(return_value, 8);
+		add_assoc_zval_ex(return_value, ZEND_STRS("tags"), ztags);
+		php_ircclient_add_chunk(return_value, ZEND_STRS("prefix"), &line.prefix);
+		php_ircclient_add_chunk(return_value, ZEND_STRS("nick"), &line.nick);
+		php_ircclient_add_chunk(return_value, ZEND_STRS("user"), &line.user);
+		php_ircclient_add_chunk(return_value, ZEND_STRS("host"), &line.host);
+		php_ircclient_add_chunk(return_value, ZEND_STRS("command"), &line.command);
+		add_assoc_zval_ex(return_value, ZEND_STRS("params"), zparams);
+	}
+}
+/* }}} */
 
 const zend_function_entry php_ircclient_function_entry[] = {
 	ZEND_NS_FENTRY("irc\\client", parse_origin, ZEND_FN(parse_origin), NULL, 0)
+	ZEND_NS_FENTRY("irc\\client", parse_line, ZEND_FN(parse_line), NULL, 0)
 	{0}
 };
 
@@ -102,579 +359,5704 @@ zend_module_entry ircclient_module_entry = {
 ZEND_GET_MODULE(ircclient)
 #endif
 
-static void php_ircclient_event_callback(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count);
-static void php_ircclient_event_code_callback(irc_session_t *session, unsigned int event, const char *origin, const char **params, unsigned int count);
-static void php_ircclient_event_dcc_chat_callback(irc_session_t *session, const char *nick, const char *addr, irc_dcc_t dccid);
-static void php_ircclient_event_dcc_send_callback(irc_session_t *session, const char *nick, const char *addr, const char *filename, unsigned long size, irc_dcc_t dccid);
-
-static irc_callbacks_t php_ircclient_callbacks = {
-	.event_connect = php_ircclient_event_callback,
-	.event_nick = php_ircclient_event_callback,
-	.event_quit = php_ircclient_event_callback,
-	.event_join = php_ircclient_event_callback,
-	.event_part = php_ircclient_event_callback,
-	.event_mode = php_ircclient_event_callback,
-	.event_umode = php_ircclient_event_callback,
-	.event_topic = php_ircclient_event_callback,
-	.event_kick = php_ircclient_event_callback,
-	.event_channel = php_ircclient_event_callback,
-	.event_privmsg = php_ircclient_event_callback,
-	.event_notice = php_ircclient_event_callback,
-#if PHP_IRCCLIENT_HAVE_EVENT_CHANNEL_NOTICE
-	.event_channel_notice = php_ircclient_event_callback,
-#endif
-	.event_invite = php_ircclient_event_callback,
-	.event_ctcp_req = php_ircclient_event_callback,
-	.event_ctcp_rep = php_ircclient_event_callback,
-	.event_ctcp_action = php_ircclient_event_callback,
-	.event_unknown = php_ircclient_event_callback,
-	.event_numeric = php_ircclient_event_code_callback,
-	.event_dcc_chat_req = php_ircclient_event_dcc_chat_callback,
-	.event_dcc_send_req = php_ircclient_event_dcc_send_callback
+typedef enum php_ircclient_event {
+	PHP_IRCCLIENT_EVENT_CONNECT,
+	PHP_IRCCLIENT_EVENT_NICK,
+	PHP_IRCCLIENT_EVENT_QUIT,
+	PHP_IRCCLIENT_EVENT_JOIN,
+	PHP_IRCCLIENT_EVENT_PART,
+	PHP_IRCCLIENT_EVENT_MODE,
+	PHP_IRCCLIENT_EVENT_UMODE,
+	PHP_IRCCLIENT_EVENT_TOPIC,
+	PHP_IRCCLIENT_EVENT_KICK,
+	PHP_IRCCLIENT_EVENT_CHANNEL,
+	PHP_IRCCLIENT_EVENT_PRIVMSG,
+	PHP_IRCCLIENT_EVENT_NOTICE,
+	PHP_IRCCLIENT_EVENT_CHANNEL_NOTICE,
+	PHP_IRCCLIENT_EVENT_INVITE,
+	PHP_IRCCLIENT_EVENT_CTCP_REQ,
+	PHP_IRCCLIENT_EVENT_CTCP_REP,
+	PHP_IRCCLIENT_EVENT_ACTION,
+	PHP_IRCCLIENT_EVENT_UNKNOWN,
+	PHP_IRCCLIENT_EVENT_NUMERIC,
+	PHP_IRCCLIENT_EVENT_DCC_CHAT_REQ,
+	PHP_IRCCLIENT_EVENT_DCC_SEND_REQ,
+	PHP_IRCCLIENT_EVENT_ERROR,
+	/* aggregated numerics, see irc\client\OPTION_AGGREGATE */
+	PHP_IRCCLIENT_EVENT_NAMES,
+	PHP_IRCCLIENT_EVENT_WHOIS,
+	PHP_IRCCLIENT_EVENT_LIST,
+	PHP_IRCCLIENT_EVENT_BANLIST,
+	/* see irc\client\OPTION_BATCH */
+	PHP_IRCCLIENT_EVENT_BATCH,
+	/* see Session::setWatchdog() */
+	PHP_IRCCLIENT_EVENT_SLOW_HANDLER,
+	PHP_IRCCLIENT_EVENT_COUNT
+} php_ircclient_event_t;
+
+/* handler method names, indexed by php_ircclient_event_t */
+static const struct {
+	const char *str;
+	size_t len;
+} php_ircclient_events[PHP_IRCCLIENT_EVENT_COUNT] = {
+	{ZEND_STRL("onConnect")},
+	{ZEND_STRL("onNick")},
+	{ZEND_STRL("onQuit")},
+	{ZEND_STRL("onJoin")},
+	{ZEND_STRL("onPart")},
+	{ZEND_STRL("onMode")},
+	{ZEND_STRL("onUmode")},
+	{ZEND_STRL("onTopic")},
+	{ZEND_STRL("onKick")},
+	{ZEND_STRL("onChannel")},
+	{ZEND_STRL("onPrivmsg")},
+	{ZEND_STRL("onNotice")},
+	{ZEND_STRL("onChannelNotice")},
+	{ZEND_STRL("onInvite")},
+	{ZEND_STRL("onCtcpReq")},
+	{ZEND_STRL("onCtcpRep")},
+	{ZEND_STRL("onAction")},
+	{ZEND_STRL("onUnknown")},
+	{ZEND_STRL("onNumeric")},
+	{ZEND_STRL("onDccChatReq")},
+	{ZEND_STRL("onDccSendReq")},
+	{ZEND_STRL("onError")},
+	{ZEND_STRL("onNames")},
+	{ZEND_STRL("onWhois")},
+	{ZEND_STRL("onList")},
+	{ZEND_STRL("onBanList")},
+	{ZEND_STRL("onBatch")},
+	{ZEND_STRL("onSlowHandler")}
 };
 
+#define PHP_IRCCLIENT_EVENT_MASK(ev) (1UL << (ev))
+
+/* the onXxx property, see php_ircclient_session_property() */
+#define PHP_IRCCLIENT_PROPERTY_UNKNOWN	0
+#define PHP_IRCCLIENT_PROPERTY_CACHED	1
+#define PHP_IRCCLIENT_PROPERTY_NULL		2
+#define PHP_IRCCLIENT_PROPERTY_METHOD	3
+
 typedef struct php_ircclient_session_callback {
 	zval *zfn;
 	zend_fcall_info fci;
 	zend_fcall_info_cache fcc;
+	/* the closure of the property, while PHP_IRCCLIENT_PROPERTY_CACHED */
+	unsigned prop:2;
+	zval *zprop;
+	zend_fcall_info pfci;
+	zend_fcall_info_cache pfcc;
 } php_ircclient_session_callback_t;
 
+/* see Session::on() */
+typedef struct php_ircclient_listener {
+	long id;
+	long priority;
+	zval *zcb;
+	zend_fcall_info fci;
+	zend_fcall_info_cache fcc;
+} php_ircclient_listener_t;
+
+/* never changed once built; Session::on() and off() build a new list, so
+ * that a running event keeps going through the one it started with */
+typedef struct php_ircclient_listeners {
+	unsigned refcount;
+	unsigned count;
+	php_ircclient_listener_t entries[1];
+} php_ircclient_listeners_t;
+
+#if HAVE_SYS_EPOLL_H
+typedef struct php_ircclient_epoll_fd {
+	int fd;
+	/* the resource id of the stream, or -1 - epoll.gen for libircclient's
+	 * sockets; another owner means the fd was closed and reused */
+	long owner;
+	/* registered with epoll_ctl() */
+	unsigned events;
+	/* wanted in the current tick */
+	unsigned wanted;
+	unsigned tick;
+	/* reported by epoll_wait() */
+	unsigned revents;
+} php_ircclient_epoll_fd_t;
+#endif
+
+typedef struct php_ircclient_watch {
+	zval *zstream;
+	int fd;
+	int mode;
+} php_ircclient_watch_t;
+
+typedef struct php_ircclient_queue_line {
+	struct php_ircclient_queue_line *next;
+	size_t len;
+	char str[1];
+} php_ircclient_queue_line_t;
+
+typedef struct php_ircclient_queue {
+	/* token bucket; lines per second, 0 disables pacing */
+	double rate;
+	double burst;
+	double tokens;
+	double stamp;
+	size_t count;
+	/* lines held at most, 0 for no limit */
+	size_t max;
+	struct {
+		php_ircclient_queue_line_t *head, **tail;
+	} lane[PHP_IRCCLIENT_PRIORITIES];
+} php_ircclient_queue_t;
+
+#define PHP_IRCCLIENT_CASEMAPPING_RFC1459			0
+#define PHP_IRCCLIENT_CASEMAPPING_STRICT_RFC1459	1
+#define PHP_IRCCLIENT_CASEMAPPING_ASCII				2
+
+typedef struct php_ircclient_member {
+	/* bits of isupport.prefix_modes */
+	unsigned modes;
+	char nick[1];
+} php_ircclient_member_t;
+
+typedef struct php_ircclient_filter {
+	unsigned long events;
+	/* casefolded channel names, or NULL */
+	HashTable *channels;
+	/* casefolded */
+	char *target;
+	size_t target_len;
+	char *prefix;
+	size_t prefix_len;
+	char *pattern;
+	int pattern_len;
+	unsigned mention:1;
+} php_ircclient_filter_t;
+
+/* what a rule applies to without "events" */
+#define PHP_IRCCLIENT_FILTER_EVENTS ( \
+	PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_CHANNEL) | \
+	PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_PRIVMSG) | \
+	PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_NOTICE) | \
+	PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_CHANNEL_NOTICE) | \
+	PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_ACTION) \
+)
+/* DCC requests have no params a rule could look at */
+#define PHP_IRCCLIENT_FILTER_NONE ( \
+	PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_DCC_CHAT_REQ) | \
+	PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_DCC_SEND_REQ) \
+)
+
+typedef struct php_ircclient_channel {
+	/* casefolded nick => php_ircclient_member_t */
+	HashTable members;
+	/* RPL_ENDOFNAMES seen */
+	unsigned synced:1;
+	char name[1];
+} php_ircclient_channel_t;
+
+/* upper bounds of the handler time histogram in seconds, the last one is open */
+static const struct {
+	double bound;
+	const char *name;
+	size_t name_len;
+} php_ircclient_stats_buckets[] = {
+	{0.00001,	ZEND_STRL("10us")},
+	{0.0001,	ZEND_STRL("100us")},
+	{0.001,		ZEND_STRL("1ms")},
+	{0.01,		ZEND_STRL("10ms")},
+	{0.1,		ZEND_STRL("100ms")},
+	{1.0,		ZEND_STRL("1s")},
+	{0.0,		ZEND_STRL("inf")}
+};
+
+#define PHP_IRCCLIENT_STATS_BUCKETS (sizeof(php_ircclient_stats_buckets)/sizeof(php_ircclient_stats_buckets[0]))
+
+typedef struct php_ircclient_stats {
+	/* start of the measuring period */
+	double since;
+	/* received, by event; before any filtering */
+	unsigned long events[PHP_IRCCLIENT_EVENT_COUNT];
+	/* handler calls, their total time and its distribution */
+	unsigned long calls[PHP_IRCCLIENT_EVENT_COUNT];
+	double time[PHP_IRCCLIENT_EVENT_COUNT];
+	unsigned long histogram[PHP_IRCCLIENT_EVENT_COUNT][PHP_IRCCLIENT_STATS_BUCKETS];
+	/* lines and bytes received; reassembled from what libircclient parsed */
+	unsigned long lines_in;
+	unsigned long bytes_in;
+	/* lines and bytes handed to libircclient */
+	unsigned long commands;
+	unsigned long bytes_out;
+	/* seconds spent in select() or epoll_wait() */
+	double wait;
+} php_ircclient_stats_t;
+
+/* what Session::dumpTrace() knows about an event */
+#define PHP_IRCCLIENT_TRACE_PARAMS 8
+#define PHP_IRCCLIENT_TRACE_ORIGIN 48
+/* records kept with LIBIRC_OPTION_DEBUG, unless set by Session::setTrace() */
+#define PHP_IRCCLIENT_TRACE_SIZE 1024
+/* about 5M */
+#define PHP_IRCCLIENT_TRACE_MAX 65536
+
+typedef struct php_ircclient_trace {
+	double time;
+	unsigned short ev;
+	/* of numeric replies */
+	unsigned short code;
+	unsigned short count;
+	/* of the first PHP_IRCCLIENT_TRACE_PARAMS params */
+	unsigned short lens[PHP_IRCCLIENT_TRACE_PARAMS];
+	/* truncated, empty if none */
+	char origin[PHP_IRCCLIENT_TRACE_ORIGIN];
+} php_ircclient_trace_t;
+
+/* a DCC request, or an accepted or initiated DCC, see Session::dccAccept() */
+typedef struct php_ircclient_dcc {
+	/* or NULL, see Session::dccReceive() */
+	zval *zcb;
+	zend_fcall_info fci;
+	zend_fcall_info_cache fcc;
+	/* a DCC CHAT only ends with an error status */
+	unsigned chat:1;
+	/* a request not answered yet */
+	unsigned pending:1;
+	/* see Session::dccReceive() */
+	zval *zstream;
+	php_stream *stream;
+	/* ring buffer of what the stream did not take yet */
+	char *ring;
+	size_t size;
+	size_t head;
+	size_t len;
+	unsigned long received;
+	unsigned long written;
+} php_ircclient_dcc_t;
+
+/* room kept free in a receive buffer; libircclient reads DCC data in
+ * chunks of up to 1k, this takes a few of them */
+#define PHP_IRCCLIENT_DCC_CHUNK 4096
+/* unanswered requests kept, see php_ircclient_dcc_request() */
+#define PHP_IRCCLIENT_DCC_REQUESTS 16
+
+/* a channel to join again after reconnecting */
+typedef struct php_ircclient_rejoin {
+	/* from Session::doJoin(), or NULL */
+	char *key;
+	char name[1];
+} php_ircclient_rejoin_t;
+
+/* libircclient opens sockets behind our back, see php_ircclient_epoll_fd_t */
+#if HAVE_SYS_EPOLL_H
+#	define PHP_IRCCLIENT_EPOLL_RENEW(obj) (++(obj)->epoll.gen)
+#else
+#	define PHP_IRCCLIENT_EPOLL_RENEW(obj)
+#endif
+
+/* keep the order of commands while anything is still queued */
+#define PHP_IRCCLIENT_QUEUED(obj) ((obj)->queue.rate > 0 || (obj)->queue.count)
+
 typedef struct php_ircclient_session_object {
 	zend_object zo;
 	zend_object_value ov;
 	irc_session_t *sess;
 	unsigned opts;
-	HashTable cbc;
+	/* $this while libircclient may call back into us, see Session::run() */
+	zval *zthis;
+	php_ircclient_session_callback_t cbc[PHP_IRCCLIENT_EVENT_COUNT];
+	/* see Session::on(), NULL if none */
+	php_ircclient_listeners_t *listeners[PHP_IRCCLIENT_EVENT_COUNT];
+	long listener_id;
+	/* see php_ircclient_session_get_gc() */
+	zval **gc;
+	int gc_size;
+	/* events handled by overridden methods */
+	unsigned long methods;
+	/* events anybody listens to; recomputed when mask_dirty */
+	unsigned long mask;
+	unsigned mask_dirty:1;
+	/* resource id => php_ircclient_watch_t */
+	HashTable watches;
+	php_ircclient_queue_t queue;
+	/* from RPL_ISUPPORT; -1 if not announced, 0 if unlimited */
+	struct {
+		long targmax;
+		long maxtargets;
+		char prefix_modes[17];
+		char prefix_chars[17];
+		char chanmodes[64];
+		int casemapping;
+	} isupport;
+	/* see irc\client\OPTION_TRACK_STATE */
+	struct {
+		/* our own nick */
+		char *self;
+		/* casefolded channel name => php_ircclient_channel_t * */
+		HashTable channels;
+	} track;
+	/* see irc\client\OPTION_AGGREGATE; replies in progress by casefolded name */
+	struct {
+		HashTable names;
+		HashTable whois;
+		HashTable bans;
+		zval *list;
+	} aggregate;
+	/* idle irc\client\Params, see irc\client\OPTION_LAZY_PARAMS */
+	zval *params;
+	/* string => shared zval, see php_ircclient_intern() */
+	HashTable intern;
+	/* IRCv3 capabilities */
+	struct {
+		/* CAP LS still to be sent */
+		unsigned pending:1;
+		/* CAP END still to be sent */
+		unsigned negotiating:1;
+		/* name => value, from CAP LS and NEW */
+		HashTable available;
+		/* name => value, acknowledged */
+		HashTable enabled;
+	} cap;
+	/* open batches by reference, see irc\client\OPTION_BATCH */
+	HashTable batches;
+	/* id => php_ircclient_filter_t, see Session::addFilter() */
+	HashTable filters;
+	/* events any filter applies to */
+	unsigned long filtered;
+	/* raw message tags of the line being dispatched */
+	const char *tags;
+	/* onConnect was dispatched for this connection */
+	unsigned motd:1;
+	/* see Session::getStats() */
+	php_ircclient_stats_t stats;
+	/* see Session::setReconnect() */
+	struct {
+		/* 0 disables, negative for no limit */
+		long max;
+		/* since the connection was lost */
+		long attempts;
+		double delay;
+		double max_delay;
+		double jitter;
+		/* of the next attempt, 0 if none is scheduled */
+		double due;
+		/* rotation after the server of Session::doConnect(), or NULL */
+		zval *servers;
+		long server;
+		/* as given to Session::doConnect() */
+		char *host;
+		long port;
+		char *passwd;
+		zend_bool ip6;
+		/* disconnected on purpose */
+		unsigned quit:1;
+		/* casefolded name => php_ircclient_rejoin_t *, channels we are on */
+		HashTable channels;
+		/* the same, still to join after reconnecting */
+		HashTable rejoin;
+	} reconnect;
+	/* the server connection, -1 if unknown, see php_ircclient_session_sock() */
+	int sock;
+	/* DCC id => php_ircclient_dcc_t */
+	HashTable dcc;
+	/* see Session::setTrace() */
+	struct {
+		/* size records, allocated once */
+		php_ircclient_trace_t *ring;
+		size_t size;
+		/* total number of records, the next goes to count % size */
+		unsigned long count;
+	} trace;
+	/* see Session::capture() */
+	struct {
+		zval *zstream;
+		/* records not yet written */
+		smart_str buf;
+		/* of the previous record */
+		double stamp;
+		/* Session::replay() is running */
+		unsigned replay:1;
+	} capture;
+	/* see Session::setWatchdog() */
+	struct {
+		double threshold;
+		unsigned pong:1;
+		/* last PING answered early */
+		char token[64];
+		double stamp;
+	} watchdog;
+#if HAVE_SYS_EPOLL_H
+	struct {
+		int fd;
+		unsigned tick;
+		/* bumped whenever libircclient may have opened a socket */
+		long gen;
+		int nevents;
+		struct epoll_event *events;
+		/* fd => php_ircclient_epoll_fd_t */
+		HashTable fds;
+	} epoll;
+#endif
 #ifdef ZTS
 	void ***ts;
 #endif
 } php_ircclient_session_object_t;
 
 zend_class_entry *php_ircclient_session_class_entry;
+static zend_object_handlers php_ircclient_session_object_handlers;
 
-void php_ircclient_session_object_free(void *object TSRMLS_DC)
+/* passed to handlers instead of the params array with irc\client\OPTION_LAZY_PARAMS,
+ * so those must not type hint array */
+typedef struct php_ircclient_params_object {
+	zend_object zo;
+	zend_object_value ov;
+	/* borrowed from libircclient while a handler runs, NULL afterwards */
+	const char **params;
+	unsigned int count;
+	/* materialized on access; size slots, all NULL while idle */
+	zval **entries;
+	unsigned int size;
+} php_ircclient_params_object_t;
+
+zend_class_entry *php_ircclient_params_class_entry;
+static zend_object_handlers php_ircclient_params_object_handlers;
+
+/* message tags as received; values are unescaped when read */
+typedef struct php_ircclient_tags_object {
+	zend_object zo;
+	zend_object_value ov;
+	char *str;
+	size_t len;
+} php_ircclient_tags_object_t;
+
+zend_class_entry *php_ircclient_tags_class_entry;
+static zend_object_handlers php_ircclient_tags_object_handlers;
+
+static void php_ircclient_session_callbacks_init(php_ircclient_session_object_t *obj)
 {
-	php_ircclient_session_object_t *o = (php_ircclient_session_object_t *) object;
+	int i;
 
-	if (o->sess) {
-		irc_destroy_session(o->sess);
-		o->sess = NULL;
+	for (i = 0; i < PHP_IRCCLIENT_EVENT_COUNT; ++i) {
+		php_ircclient_session_callback_t *cb = &obj->cbc[i];
+		char fn_str[32];
+		size_t fn_len = php_ircclient_events[i].len;
+
+		zend_str_tolower_copy(fn_str, php_ircclient_events[i].str, fn_len);
+
+		if (SUCCESS == zend_hash_find(&obj->zo.ce->function_table, fn_str, fn_len + 1, (void *) &cb->fcc.function_handler)) {
+			MAKE_STD_ZVAL(cb->zfn);
+			ZVAL_STRINGL(cb->zfn, php_ircclient_events[i].str, fn_len, 1);
+
+			cb->fci.size = sizeof(cb->fci);
+			cb->fci.function_table = &obj->zo.ce->function_table;
+			cb->fci.function_name = cb->zfn;
+			/* interned strings are shared, see php_ircclient_intern() */
+			cb->fci.no_separation = 0;
+
+			cb->fcc.initialized = 1;
+			cb->fcc.calling_scope = obj->zo.ce;
+			cb->fcc.called_scope = obj->zo.ce;
+
+			if (cb->fcc.function_handler->common.scope != php_ircclient_session_class_entry) {
+				obj->methods |= PHP_IRCCLIENT_EVENT_MASK(i);
+			}
+		}
 	}
-	zend_hash_destroy(&o->cbc);
-	zend_object_std_dtor((zend_object *) o TSRMLS_CC);
-	efree(o);
 }
 
-static void php_ircclient_session_callback_dtor(void *ptr)
+static void php_ircclient_listeners_release(php_ircclient_listeners_t *ls)
 {
-	php_ircclient_session_callback_t *cb = (php_ircclient_session_callback_t *) ptr;
+	unsigned i;
 
-	zend_fcall_info_args_clear(&cb->fci, 1);
-	zval_ptr_dtor(&cb->zfn);
+	if (ls && !--ls->refcount) {
+		for (i = 0; i < ls->count; ++i) {
+			zval_ptr_dtor(&ls->entries[i].zcb);
+		}
+		efree(ls);
+	}
 }
 
-zend_object_value php_ircclient_session_object_create(zend_class_entry *ce TSRMLS_DC)
+/* a copy of ls with room for one more, but without the listener skip */
+static php_ircclient_listeners_t *php_ircclient_listeners_copy(php_ircclient_listeners_t *ls, long skip)
 {
-	php_ircclient_session_object_t *obj;
-
-	obj = ecalloc(1, sizeof(*obj));
-#if PHP_VERSION_ID >= 50399
-	zend_object_std_init((zend_object *) obj, ce TSRMLS_CC);
-	object_properties_init((zend_object *) obj, ce);
-#else
-	obj->zo.ce = ce;
-	ALLOC_HASHTABLE(obj->zo.properties);
-	zend_hash_init(obj->zo.properties, zend_hash_num_elements(&ce->default_properties), NULL, ZVAL_PTR_DTOR, 0);
-	zend_hash_copy(obj->zo.properties, &ce->default_properties, (copy_ctor_func_t) zval_add_ref, NULL, sizeof(zval *));
-#endif
+	php_ircclient_listeners_t *copy;
+	unsigned i, count = ls ? ls->count : 0;
+
+	copy = emalloc(sizeof(*copy) + count * sizeof(copy->entries[0]));
+	copy->refcount = 1;
+	copy->count = 0;
+	for (i = 0; i < count; ++i) {
+		if (ls->entries[i].id != skip) {
+			copy->entries[copy->count] = ls->entries[i];
+			Z_ADDREF_P(copy->entries[copy->count].zcb);
+			++copy->count;
+		}
+	}
+	return copy;
+}
 
-	obj->sess = irc_create_session(&php_ircclient_callbacks);
-	irc_set_ctx(obj->sess, obj);
-	zend_hash_init(&obj->cbc, 10, NULL, php_ircclient_session_callback_dtor, 0);
-	TSRMLS_SET_CTX(obj->ts);
+/* forget the cached onXxx properties, because one of them changed */
+static void php_ircclient_session_properties_reset(php_ircclient_session_object_t *obj)
+{
+	int i;
 
-	obj->ov.handle = zend_objects_store_put(obj, NULL, php_ircclient_session_object_free, NULL TSRMLS_CC);
-	obj->ov.handlers = zend_get_std_object_handlers();
+	for (i = 0; i < PHP_IRCCLIENT_EVENT_COUNT; ++i) {
+		php_ircclient_session_callback_t *cb = &obj->cbc[i];
 
-	return obj->ov;
+		if (cb->zprop) {
+			zval_ptr_dtor(&cb->zprop);
+			cb->zprop = NULL;
+		}
+		cb->prop = PHP_IRCCLIENT_PROPERTY_UNKNOWN;
+	}
 }
 
-static php_ircclient_session_callback_t *php_ircclient_session_get_callback(php_ircclient_session_object_t *obj, const char *fn_str, size_t fn_len)
+static void php_ircclient_session_callbacks_dtor(php_ircclient_session_object_t *obj)
 {
-	zval *zo, *zm;
-	php_ircclient_session_callback_t cb, *cbp = NULL;
-	TSRMLS_FETCH_FROM_CTX(obj->ts);
+	int i;
 
-	if (SUCCESS == zend_hash_find(&obj->cbc, fn_str, fn_len + 1, (void *) &cbp)) {
-		return cbp;
+	php_ircclient_session_properties_reset(obj);
+	for (i = 0; i < PHP_IRCCLIENT_EVENT_COUNT; ++i) {
+		if (obj->cbc[i].zfn) {
+			zval_ptr_dtor(&obj->cbc[i].zfn);
+		}
+		php_ircclient_listeners_release(obj->listeners[i]);
+		obj->listeners[i] = NULL;
 	}
+}
 
-	MAKE_STD_ZVAL(zo);
-	Z_TYPE_P(zo) = IS_OBJECT;
-	zo->value.obj = obj->ov;
-	zend_objects_store_add_ref(zo TSRMLS_CC);
+static void php_ircclient_session_mask_update(php_ircclient_session_object_t *obj TSRMLS_DC)
+{
+	int i;
 
-	MAKE_STD_ZVAL(zm);
-	ZVAL_STRINGL(zm, estrndup(fn_str, fn_len), fn_len, 0);
+	obj->mask = obj->methods;
 
-	MAKE_STD_ZVAL(cb.zfn);
-	array_init_size(cb.zfn, 2);
-	add_next_index_zval(cb.zfn, zo);
-	add_next_index_zval(cb.zfn, zm);
+	for (i = 0; i < PHP_IRCCLIENT_EVENT_COUNT; ++i) {
+		if (obj->listeners[i]) {
+			obj->mask |= PHP_IRCCLIENT_EVENT_MASK(i);
+		}
+		if (obj->cbc[i].fcc.initialized && !(obj->mask & PHP_IRCCLIENT_EVENT_MASK(i))) {
+			zval *prop = zend_read_property(php_ircclient_session_class_entry, obj->zthis, php_ircclient_events[i].str, php_ircclient_events[i].len, 1 TSRMLS_CC);
 
-	if (SUCCESS != zend_fcall_info_init(cb.zfn, IS_CALLABLE_STRICT, &cb.fci, &cb.fcc, NULL, NULL TSRMLS_CC)) {
-		zval_ptr_dtor(&cb.zfn);
-		return NULL;
+			/* a referenced property may change behind our back */
+			if (Z_TYPE_P(prop) != IS_NULL || PZVAL_IS_REF(prop)) {
+				obj->mask |= PHP_IRCCLIENT_EVENT_MASK(i);
+			}
+		}
 	}
 
-	if (SUCCESS != zend_hash_add(&obj->cbc, fn_str, fn_len + 1, &cb, sizeof(cb), (void *) &cbp)) {
-		zval_ptr_dtor(&cb.zfn);
-		return NULL;
+	obj->mask_dirty = 0;
+}
+
+static inline int php_ircclient_session_listens(php_ircclient_session_object_t *obj, php_ircclient_event_t ev TSRMLS_DC)
+{
+	if (!obj->zthis) {
+		return 0;
+	}
+	if (obj->mask_dirty) {
+		php_ircclient_session_mask_update(obj TSRMLS_CC);
 	}
+	return (obj->mask & PHP_IRCCLIENT_EVENT_MASK(ev)) != 0;
+}
+
+#if PHP_VERSION_ID >= 50400
+#	define PHP_IRCCLIENT_LITERAL_DC , const zend_literal *key
+#	define PHP_IRCCLIENT_LITERAL_CC , key
+#else
+#	define PHP_IRCCLIENT_LITERAL_DC
+#	define PHP_IRCCLIENT_LITERAL_CC
+#endif
 
-	return cbp;
+static inline void php_ircclient_session_property_changed(zval *object, zval *member TSRMLS_DC)
+{
+	if (Z_TYPE_P(member) != IS_STRING || (Z_STRLEN_P(member) > 2 && !strncmp(Z_STRVAL_P(member), "on", 2))) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(object TSRMLS_CC);
+
+		obj->mask_dirty = 1;
+		php_ircclient_session_properties_reset(obj);
+	}
 }
 
-static void php_ircclient_event_callback(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count)
+static void php_ircclient_session_write_property(zval *object, zval *member, zval *value PHP_IRCCLIENT_LITERAL_DC TSRMLS_DC)
 {
-	char *fn_str;
-	int fn_len;
-	php_ircclient_session_callback_t *cb;
-	php_ircclient_session_object_t *obj = irc_get_ctx(session);
-	TSRMLS_FETCH_FROM_CTX(obj->ts);
+	php_ircclient_session_property_changed(object, member TSRMLS_CC);
+	zend_get_std_object_handlers()->write_property(object, member, value PHP_IRCCLIENT_LITERAL_CC TSRMLS_CC);
+}
 
-	fn_str = emalloc(strlen(event) + 2 + 1);
-	fn_str[0] = 'o';
-	fn_str[1] = 'n';
-	fn_len = 2;
-	do {
-		if (*event != '_') {
-			fn_str[fn_len++] = tolower(*event);
-		}
-	} while (*event++);
+static void php_ircclient_session_unset_property(zval *object, zval *member PHP_IRCCLIENT_LITERAL_DC TSRMLS_DC)
+{
+	php_ircclient_session_property_changed(object, member TSRMLS_CC);
+	zend_get_std_object_handlers()->unset_property(object, member PHP_IRCCLIENT_LITERAL_CC TSRMLS_CC);
+}
 
-	if ((cb = php_ircclient_session_get_callback(obj, fn_str, fn_len -1))) {
-		int i;
-		zval *zo, *zp;
+#if PHP_VERSION_ID >= 50500
+static zval **php_ircclient_session_get_property_ptr_ptr(zval *object, zval *member, int type PHP_IRCCLIENT_LITERAL_DC TSRMLS_DC)
+{
+	php_ircclient_session_property_changed(object, member TSRMLS_CC);
+	return zend_get_std_object_handlers()->get_property_ptr_ptr(object, member, type PHP_IRCCLIENT_LITERAL_CC TSRMLS_CC);
+}
+#else
+static zval **php_ircclient_session_get_property_ptr_ptr(zval *object, zval *member PHP_IRCCLIENT_LITERAL_DC TSRMLS_DC)
+{
+	php_ircclient_session_property_changed(object, member TSRMLS_CC);
+	return zend_get_std_object_handlers()->get_property_ptr_ptr(object, member PHP_IRCCLIENT_LITERAL_CC TSRMLS_CC);
+}
+#endif
 
-		MAKE_STD_ZVAL(zo);
-		if (origin) {
-			ZVAL_STRING(zo, estrdup(origin), 0);
-		} else {
-			ZVAL_NULL(zo);
+/* the cached onXxx closures and the listeners are held outside of the
+ * property table, and may well reference $this */
+static HashTable *php_ircclient_session_get_gc(zval *object, zval ***table, int *n TSRMLS_DC)
+{
+	php_ircclient_session_object_t *obj = zend_object_store_get_object(object TSRMLS_CC);
+	php_ircclient_dcc_t *dcc;
+	HashPosition pos;
+	int i, count = zend_hash_num_elements(&obj->dcc);
+	unsigned j;
+
+	for (i = 0; i < PHP_IRCCLIENT_EVENT_COUNT; ++i) {
+		if (obj->cbc[i].zprop) {
+			++count;
 		}
-
-		MAKE_STD_ZVAL(zp);
-		array_init(zp);
-		for (i = 0; i < count; ++i) {
-			add_next_index_string(zp, estrdup(params[i]), 0);
+		if (obj->listeners[i]) {
+			count += obj->listeners[i]->count;
 		}
+	}
+	if (count > obj->gc_size) {
+		obj->gc = erealloc(obj->gc, count * sizeof(zval *));
+		obj->gc_size = count;
+	}
 
-		if (SUCCESS == zend_fcall_info_argn(&cb->fci TSRMLS_CC, 2, &zo, &zp)) {
-			zend_fcall_info_call(&cb->fci, &cb->fcc, NULL, NULL TSRMLS_CC);
+	count = 0;
+	for (i = 0; i < PHP_IRCCLIENT_EVENT_COUNT; ++i) {
+		if (obj->cbc[i].zprop) {
+			obj->gc[count++] = obj->cbc[i].zprop;
+		}
+		if (obj->listeners[i]) {
+			for (j = 0; j < obj->listeners[i]->count; ++j) {
+				obj->gc[count++] = obj->listeners[i]->entries[j].zcb;
+			}
+		}
+	}
+	for (	zend_hash_internal_pointer_reset_ex(&obj->dcc, &pos);
+			SUCCESS == zend_hash_get_current_data_ex(&obj->dcc, (void *) &dcc, &pos);
+			zend_hash_move_forward_ex(&obj->dcc, &pos)
+	) {
+		if (dcc->zcb) {
+			obj->gc[count++] = dcc->zcb;
 		}
-
-		zval_ptr_dtor(&zo);
-		zval_ptr_dtor(&zp);
 	}
 
-	efree(fn_str);
+	*table = obj->gc;
+	*n = count;
+	return zend_std_get_properties(object TSRMLS_CC);
 }
 
-static void php_ircclient_event_code_callback(irc_session_t *session, unsigned int event, const char *origin, const char **params, unsigned int count)
+static void php_ircclient_watch_dtor(void *ptr)
 {
-	php_ircclient_session_callback_t *cb;
-	php_ircclient_session_object_t *obj = irc_get_ctx(session);
-	TSRMLS_FETCH_FROM_CTX(obj->ts);
+	php_ircclient_watch_t *w = ptr;
 
+	zval_ptr_dtor(&w->zstream);
+}
 
-	if ((cb = php_ircclient_session_get_callback(obj, ZEND_STRL("onNumeric")))) {
-		int i;
-		zval *zo, *ze, *zp;
+static inline double php_ircclient_now(void)
+{
+	struct timeval tv;
+#if HAVE_CLOCK_GETTIME && defined(CLOCK_MONOTONIC)
+	struct timespec ts;
 
-		MAKE_STD_ZVAL(zo);
-		if (origin) {
-			ZVAL_STRING(zo, estrdup(origin), 0);
-		} else {
-			ZVAL_NULL(zo);
-		}
+	/* not affected by the wall clock being set */
+	if (0 == clock_gettime(CLOCK_MONOTONIC, &ts)) {
+		return (double) ts.tv_sec + (double) ts.tv_nsec / 1000000000.0;
+	}
+#endif
+	gettimeofday(&tv, NULL);
+	return (double) tv.tv_sec + (double) tv.tv_usec / 1000000.0;
+}
 
-		MAKE_STD_ZVAL(ze);
-		ZVAL_LONG(ze, event);
+/* the stream might have been fclose()d in the meantime */
+static inline php_stream *php_ircclient_stream(zval *zstream TSRMLS_DC)
+{
+	int type;
+	php_stream *s = zend_list_find(Z_RESVAL_P(zstream), &type);
 
-		MAKE_STD_ZVAL(zp);
-		array_init(zp);
-		for (i = 0; i < count; ++i) {
-			add_next_index_string(zp, estrdup(params[i]), 0);
-		}
+	return s && (type == php_file_le_stream() || type == php_file_le_pstream()) ? s : NULL;
+}
 
-		if (SUCCESS == zend_fcall_info_argn(&cb->fci TSRMLS_CC, 3, &zo, &ze, &zp)) {
-			zend_fcall_info_call(&cb->fci, &cb->fcc, NULL, NULL TSRMLS_CC);
-		}
+static void php_ircclient_stats_reset(php_ircclient_stats_t *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->since = php_ircclient_now();
+}
 
-		zval_ptr_dtor(&zp);
-		zval_ptr_dtor(&ze);
-		zval_ptr_dtor(&zo);
+/* a line received, as the parts libircclient passes to the callbacks */
+static void php_ircclient_stats_in(php_ircclient_stats_t *st, const char *origin, size_t event_len, const char **params, unsigned int count)
+{
+	/* command and CRLF */
+	size_t len = event_len + 2;
+	unsigned int i;
+
+	if (origin) {
+		len += 2 + strlen(origin);
 	}
+	for (i = 0; i < count; ++i) {
+		len += 1 + strlen(params[i]);
+	}
+	if (count) {
+		/* trailing param */
+		++len;
+	}
+	++st->lines_in;
+	st->bytes_in += len;
 }
 
-static void php_ircclient_event_dcc_chat_callback(irc_session_t *session, const char *nick, const char *addr, irc_dcc_t dccid)
+/* lines handed to libircclient; len without the final CRLF */
+static inline void php_ircclient_stats_out(php_ircclient_stats_t *st, size_t lines, size_t len)
 {
-	php_ircclient_session_callback_t *cb;
-	php_ircclient_session_object_t *obj = irc_get_ctx(session);
-	TSRMLS_FETCH_FROM_CTX(obj->ts);
-
-	if ((cb = php_ircclient_session_get_callback(obj, ZEND_STRL("onDccChatReq")))) {
-		zval *zn, *za, *zd;
+	st->commands += lines;
+	st->bytes_out += len + 2;
+}
 
-		MAKE_STD_ZVAL(zn);
-		ZVAL_STRING(zn, estrdup(nick), 0);
-		MAKE_STD_ZVAL(za);
-		ZVAL_STRING(za, estrdup(addr), 0);
-		MAKE_STD_ZVAL(zd);
-		ZVAL_LONG(zd, dccid);
+static void php_ircclient_stats_call(php_ircclient_stats_t *st, php_ircclient_event_t ev, double t)
+{
+	size_t b;
 
-		if (SUCCESS == zend_fcall_info_argn(&cb->fci TSRMLS_CC, 3, &zn, &za, &zd)) {
-			zend_fcall_info_call(&cb->fci, &cb->fcc, NULL, NULL TSRMLS_CC);
+	for (b = 0; b < PHP_IRCCLIENT_STATS_BUCKETS - 1; ++b) {
+		if (t < php_ircclient_stats_buckets[b].bound) {
+			break;
 		}
-
-		zval_ptr_dtor(&zd);
-		zval_ptr_dtor(&za);
-		zval_ptr_dtor(&zn);
 	}
+	++st->calls[ev];
+	st->time[ev] += t;
+	++st->histogram[ev][b];
 }
 
-static void php_ircclient_event_dcc_send_callback(irc_session_t *session, const char *nick, const char *addr, const char *filename, unsigned long size, irc_dcc_t dccid)
+static void php_ircclient_queue_init(php_ircclient_queue_t *q)
 {
-	php_ircclient_session_callback_t *cb;
-	php_ircclient_session_object_t *obj = irc_get_ctx(session);
-	TSRMLS_FETCH_FROM_CTX(obj->ts);
+	int i;
 
-	if ((cb = php_ircclient_session_get_callback(obj, ZEND_STRL("onDccChatReq")))) {
-		zval *zn, *za, *zf, *zs, *zd;
+	memset(q, 0, sizeof(*q));
+	for (i = 0; i < PHP_IRCCLIENT_PRIORITIES; ++i) {
+		q->lane[i].tail = &q->lane[i].head;
+	}
+}
 
-		MAKE_STD_ZVAL(zn);
-		ZVAL_STRING(zn, estrdup(nick), 0);
-		MAKE_STD_ZVAL(za);
-		ZVAL_STRING(za, estrdup(addr), 0);
-		MAKE_STD_ZVAL(zf);
-		ZVAL_STRING(zf, estrdup(filename), 0);
-		MAKE_STD_ZVAL(zs);
-		ZVAL_LONG(zs, size);
-		MAKE_STD_ZVAL(zd);
-		ZVAL_LONG(zd, dccid);
+static void php_ircclient_queue_dtor(php_ircclient_queue_t *q)
+{
+	int i;
 
-		if (SUCCESS == zend_fcall_info_argn(&cb->fci TSRMLS_CC, 5, &zn, &za, &zf, &zs, &zd)) {
-			zend_fcall_info_call(&cb->fci, &cb->fcc, NULL, NULL TSRMLS_CC);
+	for (i = 0; i < PHP_IRCCLIENT_PRIORITIES; ++i) {
+		php_ircclient_queue_line_t *line, *next;
+
+		for (line = q->lane[i].head; line; line = next) {
+			next = line->next;
+			efree(line);
 		}
+		q->lane[i].head = NULL;
+		q->lane[i].tail = &q->lane[i].head;
+	}
+	q->count = 0;
+}
 
-		zval_ptr_dtor(&zd);
-		zval_ptr_dtor(&zs);
-		zval_ptr_dtor(&zf);
+/* libircclient formats a line into a buffer of this size, silently
+ * truncating it, and appends CRLF */
+#define PHP_IRCCLIENT_LINE_SIZE 1024
+
+/* rather than having libircclient cut the line short */
+static int php_ircclient_line_check(php_ircclient_session_object_t *obj, size_t len)
+{
+	if (len >= PHP_IRCCLIENT_LINE_SIZE) {
+		TSRMLS_FETCH_FROM_CTX(obj->ts);
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "line too long: %lu bytes, at most %d allowed", (unsigned long) len, PHP_IRCCLIENT_LINE_SIZE - 1);
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+
+static int php_ircclient_queue_append(php_ircclient_session_object_t *obj, int prio, const char *str, size_t len)
+{
+	php_ircclient_queue_t *q = &obj->queue;
+	php_ircclient_queue_line_t *line;
+
+	if (SUCCESS != php_ircclient_line_check(obj, len)) {
+		return FAILURE;
+	}
+	if (q->max && q->count >= q->max) {
+		TSRMLS_FETCH_FROM_CTX(obj->ts);
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "send queue full: %lu lines waiting", (unsigned long) q->count);
+		return FAILURE;
+	}
+
+	line = emalloc(sizeof(*line) + len);
+	line->next = NULL;
+	line->len = len;
+	memcpy(line->str, str, len + 1);
+
+	*q->lane[prio].tail = line;
+	q->lane[prio].tail = &line->next;
+	++q->count;
+	return SUCCESS;
+}
+
+static int php_ircclient_queue_push(php_ircclient_session_object_t *obj, int prio, const char *fmt, ...)
+{
+	va_list argv;
+	char *str;
+	int len, rv;
+
+	va_start(argv, fmt);
+	len = vspprintf(&str, 0, fmt, argv);
+	va_end(argv);
+
+	rv = php_ircclient_queue_append(obj, prio, str, len);
+	efree(str);
+	return rv;
+}
+
+/* send a line formatted like libircclient's irc_cmd_*() would, or queue it
+ * at prio while the send queue is in use; the line is counted in the stats
+ * as it went out; warns on failure, unless PHP_IRCCLIENT_SEND_QUIET */
+static int php_ircclient_session_send(php_ircclient_session_object_t *obj, int prio, const char *fmt, ...)
+{
+	va_list argv;
+	char *str;
+	int len, rv = SUCCESS;
+	TSRMLS_FETCH_FROM_CTX(obj->ts);
+
+	va_start(argv, fmt);
+	len = vspprintf(&str, 0, fmt, argv);
+	va_end(argv);
+
+	if (prio >= 0 && PHP_IRCCLIENT_QUEUED(obj)) {
+		rv = php_ircclient_queue_append(obj, prio, str, len);
+	} else if (SUCCESS != php_ircclient_line_check(obj, len)) {
+		rv = FAILURE;
+	} else if (0 != irc_send_raw(obj->sess, "%s", str)) {
+		if (prio != PHP_IRCCLIENT_SEND_QUIET) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
+		}
+		rv = FAILURE;
+	} else {
+		php_ircclient_stats_out(&obj->stats, 1, len);
+	}
+	efree(str);
+	return rv;
+}
+
+/* hand as many lines to libircclient as the bucket and its buffer allow */
+static void php_ircclient_queue_drain(php_ircclient_session_object_t *obj)
+{
+	php_ircclient_queue_t *q = &obj->queue;
+	size_t avail;
+	int i;
+
+	if (!q->count) {
+		return;
+	}
+
+	if (q->rate > 0) {
+		double now = php_ircclient_now();
+
+		q->tokens += (now - q->stamp) * q->rate;
+		if (q->tokens > q->burst) {
+			q->tokens = q->burst;
+		}
+		q->stamp = now;
+		avail = (size_t) q->tokens;
+	} else {
+		avail = q->count;
+	}
+
+	for (i = 0; i < PHP_IRCCLIENT_PRIORITIES && avail; ++i) {
+		php_ircclient_queue_line_t *line;
+
+		while (avail && (line = q->lane[i].head)) {
+			/* not yet connected, or the output buffer is full */
+			if (0 != irc_send_raw(obj->sess, "%s", line->str)) {
+				return;
+			}
+			php_ircclient_stats_out(&obj->stats, 1, line->len);
+			if (q->rate > 0) {
+				q->tokens -= 1;
+			}
+			--q->count;
+			--avail;
+
+			if (!(q->lane[i].head = line->next)) {
+				q->lane[i].tail = &q->lane[i].head;
+			}
+			efree(line);
+		}
+	}
+}
+
+/* seconds until the next queued line may be sent */
+static inline double php_ircclient_queue_delay(php_ircclient_queue_t *q)
+{
+	if (!q->count || q->rate <= 0 || q->tokens >= 1.0) {
+		/* nothing to do, or waiting for the socket anyway */
+		return php_get_inf();
+	}
+	return (1.0 - q->tokens) / q->rate;
+}
+
+static void php_ircclient_isupport_reset(php_ircclient_session_object_t *obj)
+{
+	obj->isupport.targmax = obj->isupport.maxtargets = -1;
+	/* RFC 1459 */
+	strcpy(obj->isupport.prefix_modes, "ov");
+	strcpy(obj->isupport.prefix_chars, "@+");
+	strcpy(obj->isupport.chanmodes, "beI,k,l,imnpst");
+	obj->isupport.casemapping = PHP_IRCCLIENT_CASEMAPPING_RFC1459;
+}
+
+/* e.g. TARGMAX=NAMES:1,PRIVMSG:4,NOTICE:4,MONITOR: */
+static long php_ircclient_isupport_targmax(const char *list, const char *cmd)
+{
+	size_t cmd_len = strlen(cmd);
+
+	while (*list) {
+		size_t len = strcspn(list, ",");
+
+		if (len > cmd_len && list[cmd_len] == ':' && !strncasecmp(list, cmd, cmd_len)) {
+			/* empty means no limit */
+			return strtol(&list[cmd_len + 1], NULL, 10);
+		}
+		list += len;
+		if (*list) {
+			++list;
+		}
+	}
+	return -1;
+}
+
+/* e.g. PREFIX=(qaohv)~&@%+ */
+static void php_ircclient_isupport_prefix(php_ircclient_session_object_t *obj, const char *prefix)
+{
+	size_t len;
+
+	if (*prefix++ != '(' || !(len = strcspn(prefix, ")")) || prefix[len] != ')' || strlen(&prefix[len + 1]) != len) {
+		return;
+	}
+	/* modes are kept as bits */
+	if (len >= sizeof(obj->isupport.prefix_modes)) {
+		len = sizeof(obj->isupport.prefix_modes) - 1;
+	}
+	memcpy(obj->isupport.prefix_modes, prefix, len);
+	obj->isupport.prefix_modes[len] = '\0';
+	memcpy(obj->isupport.prefix_chars, strchr(prefix, ')') + 1, len);
+	obj->isupport.prefix_chars[len] = '\0';
+}
+
+static void php_ircclient_session_isupport(php_ircclient_session_object_t *obj, const char **params, unsigned int count)
+{
+	unsigned int i;
+
+	/* the first param is our nick, the last one says "are supported by this server" */
+	for (i = 1; i + 1 < count; ++i) {
+		const char *p = params[i];
+
+		if (!strncmp(p, "TARGMAX=", sizeof("TARGMAX=") - 1)) {
+			obj->isupport.targmax = php_ircclient_isupport_targmax(p + sizeof("TARGMAX=") - 1, "PRIVMSG");
+		} else if (!strncmp(p, "MAXTARGETS=", sizeof("MAXTARGETS=") - 1)) {
+			obj->isupport.maxtargets = strtol(p + sizeof("MAXTARGETS=") - 1, NULL, 10);
+		} else if (!strncmp(p, "PREFIX=", sizeof("PREFIX=") - 1)) {
+			php_ircclient_isupport_prefix(obj, p + sizeof("PREFIX=") - 1);
+		} else if (!strncmp(p, "CHANMODES=", sizeof("CHANMODES=") - 1)) {
+			strlcpy(obj->isupport.chanmodes, p + sizeof("CHANMODES=") - 1, sizeof(obj->isupport.chanmodes));
+		} else if (!strncmp(p, "CASEMAPPING=", sizeof("CASEMAPPING=") - 1)) {
+			p += sizeof("CASEMAPPING=") - 1;
+			if (!strcmp(p, "ascii")) {
+				obj->isupport.casemapping = PHP_IRCCLIENT_CASEMAPPING_ASCII;
+			} else if (!strcmp(p, "strict-rfc1459")) {
+				obj->isupport.casemapping = PHP_IRCCLIENT_CASEMAPPING_STRICT_RFC1459;
+			} else {
+				obj->isupport.casemapping = PHP_IRCCLIENT_CASEMAPPING_RFC1459;
+			}
+		}
+	}
+}
+
+/* how many targets a single PRIVMSG may carry, 0 for no limit */
+static inline long php_ircclient_session_targmax(php_ircclient_session_object_t *obj)
+{
+	if (obj->isupport.targmax >= 0) {
+		return obj->isupport.targmax;
+	}
+	if (obj->isupport.maxtargets >= 0) {
+		return obj->isupport.maxtargets;
+	}
+	return 1;
+}
+
+/* 0 to 3 for CHANMODES type A to D */
+static inline int php_ircclient_isupport_chanmode(php_ircclient_session_object_t *obj, char mode)
+{
+	const char *p;
+	int type = 0;
+
+	for (p = obj->isupport.chanmodes; *p; ++p) {
+		if (*p == ',') {
+			++type;
+		} else if (*p == mode) {
+			return type;
+		}
+	}
+	return 3;
+}
+
+/* a line is at most 512 bytes, so are nicks and channel names */
+#define PHP_IRCCLIENT_KEY_SIZE 512
+
+static size_t php_ircclient_casefold(php_ircclient_session_object_t *obj, const char *str, size_t len, char *key)
+{
+	size_t i;
+
+	if (len >= PHP_IRCCLIENT_KEY_SIZE) {
+		len = PHP_IRCCLIENT_KEY_SIZE - 1;
+	}
+	for (i = 0; i < len; ++i) {
+		char c = str[i];
+
+		if (c >= 'A' && c <= 'Z') {
+			c += 'a' - 'A';
+		} else if (obj->isupport.casemapping != PHP_IRCCLIENT_CASEMAPPING_ASCII) {
+			/* []\ are the upper case of {}| */
+			if (c >= '[' && c <= ']') {
+				c += '{' - '[';
+			} else if (c == '^' && obj->isupport.casemapping == PHP_IRCCLIENT_CASEMAPPING_RFC1459) {
+				c = '~';
+			}
+		}
+		key[i] = c;
+	}
+	key[len] = '\0';
+	return len;
+}
+
+static void php_ircclient_channel_dtor(void *ptr)
+{
+	php_ircclient_channel_t *ch = *(php_ircclient_channel_t **) ptr;
+
+	zend_hash_destroy(&ch->members);
+	efree(ch);
+}
+
+static php_ircclient_channel_t *php_ircclient_track_channel(php_ircclient_session_object_t *obj, const char *name)
+{
+	php_ircclient_channel_t **ch;
+	char key[PHP_IRCCLIENT_KEY_SIZE];
+	size_t len = php_ircclient_casefold(obj, name, strlen(name), key);
+
+	if (SUCCESS == zend_hash_find(&obj->track.channels, key, len + 1, (void *) &ch)) {
+		return *ch;
+	}
+	return NULL;
+}
+
+static inline int php_ircclient_track_is_self(php_ircclient_session_object_t *obj, const char *nick, size_t nick_len)
+{
+	char key[PHP_IRCCLIENT_KEY_SIZE], self[PHP_IRCCLIENT_KEY_SIZE];
+
+	if (!obj->track.self) {
+		return 0;
+	}
+	/* CASEMAPPING is only known after RPL_WELCOME */
+	php_ircclient_casefold(obj, nick, nick_len, key);
+	php_ircclient_casefold(obj, obj->track.self, strlen(obj->track.self), self);
+	return !strcmp(self, key);
+}
+
+static php_ircclient_member_t *php_ircclient_member_find(php_ircclient_session_object_t *obj, php_ircclient_channel_t *ch, const char *nick, size_t nick_len)
+{
+	php_ircclient_member_t *m;
+	char key[PHP_IRCCLIENT_KEY_SIZE];
+	size_t len = php_ircclient_casefold(obj, nick, nick_len, key);
+
+	if (SUCCESS == zend_hash_find(&ch->members, key, len + 1, (void *) &m)) {
+		return m;
+	}
+	return NULL;
+}
+
+static void php_ircclient_member_add(php_ircclient_session_object_t *obj, php_ircclient_channel_t *ch, const char *nick, size_t nick_len, unsigned modes)
+{
+	php_ircclient_member_t *m;
+	char key[PHP_IRCCLIENT_KEY_SIZE];
+	size_t len = php_ircclient_casefold(obj, nick, nick_len, key);
+
+	m = emalloc(sizeof(*m) + len);
+	m->modes = modes;
+	memcpy(m->nick, nick, len);
+	m->nick[len] = '\0';
+	/* the nick lives in the bucket */
+	zend_hash_update(&ch->members, key, len + 1, m, sizeof(*m) + len, NULL);
+	efree(m);
+}
+
+static int php_ircclient_member_del(php_ircclient_session_object_t *obj, php_ircclient_channel_t *ch, const char *nick, size_t nick_len)
+{
+	char key[PHP_IRCCLIENT_KEY_SIZE];
+	size_t len = php_ircclient_casefold(obj, nick, nick_len, key);
+
+	return zend_hash_del(&ch->members, key, len + 1);
+}
+
+static void php_ircclient_track_clear(php_ircclient_session_object_t *obj)
+{
+	zend_hash_clean(&obj->track.channels);
+	if (obj->track.self) {
+		efree(obj->track.self);
+		obj->track.self = NULL;
+	}
+}
+
+static void php_ircclient_aggregate_clear(php_ircclient_session_object_t *obj)
+{
+	zend_hash_clean(&obj->aggregate.names);
+	zend_hash_clean(&obj->aggregate.whois);
+	zend_hash_clean(&obj->aggregate.bans);
+	if (obj->aggregate.list) {
+		zval_ptr_dtor(&obj->aggregate.list);
+		obj->aggregate.list = NULL;
+	}
+}
+
+static void php_ircclient_track_join(php_ircclient_session_object_t *obj, const char *chan, const char *nick, size_t nick_len)
+{
+	php_ircclient_channel_t *ch;
+
+	if (php_ircclient_track_is_self(obj, nick, nick_len)) {
+		char key[PHP_IRCCLIENT_KEY_SIZE];
+		size_t len = php_ircclient_casefold(obj, chan, strlen(chan), key);
+
+		ch = emalloc(sizeof(*ch) + len);
+		memcpy(ch->name, chan, len);
+		ch->name[len] = '\0';
+		ch->synced = 0;
+		zend_hash_init(&ch->members, 8, NULL, NULL, 0);
+		zend_hash_update(&obj->track.channels, key, len + 1, &ch, sizeof(ch), NULL);
+	} else if (!(ch = php_ircclient_track_channel(obj, chan))) {
+		return;
+	}
+	php_ircclient_member_add(obj, ch, nick, nick_len, 0);
+}
+
+static void php_ircclient_track_part(php_ircclient_session_object_t *obj, const char *chan, const char *nick, size_t nick_len)
+{
+	if (php_ircclient_track_is_self(obj, nick, nick_len)) {
+		char key[PHP_IRCCLIENT_KEY_SIZE];
+		size_t len = php_ircclient_casefold(obj, chan, strlen(chan), key);
+
+		zend_hash_del(&obj->track.channels, key, len + 1);
+	} else {
+		php_ircclient_channel_t *ch = php_ircclient_track_channel(obj, chan);
+
+		if (ch) {
+			php_ircclient_member_del(obj, ch, nick, nick_len);
+		}
+	}
+}
+
+static void php_ircclient_track_nick(php_ircclient_session_object_t *obj, const char *nick, size_t nick_len, const char *new_nick)
+{
+	HashPosition pos;
+	php_ircclient_channel_t **ch;
+	size_t new_len = new_nick ? strlen(new_nick) : 0;
+
+	for (	zend_hash_internal_pointer_reset_ex(&obj->track.channels, &pos);
+			SUCCESS == zend_hash_get_current_data_ex(&obj->track.channels, (void *) &ch, &pos);
+			zend_hash_move_forward_ex(&obj->track.channels, &pos)
+	) {
+		if (new_nick) {
+			php_ircclient_member_t *m = php_ircclient_member_find(obj, *ch, nick, nick_len);
+
+			if (m) {
+				unsigned modes = m->modes;
+
+				php_ircclient_member_del(obj, *ch, nick, nick_len);
+				php_ircclient_member_add(obj, *ch, new_nick, new_len, modes);
+			}
+		} else {
+			php_ircclient_member_del(obj, *ch, nick, nick_len);
+		}
+	}
+}
+
+static void php_ircclient_track_mode(php_ircclient_session_object_t *obj, const char **params, unsigned int count)
+{
+	php_ircclient_channel_t *ch;
+	const char *mode;
+	unsigned int arg = 2;
+	int set = 1;
+
+	if (count < 2 || !(ch = php_ircclient_track_channel(obj, params[0]))) {
+		return;
+	}
+
+	for (mode = params[1]; *mode; ++mode) {
+		const char *prefix;
+
+		switch (*mode) {
+		case '+':
+			set = 1;
+			break;
+		case '-':
+			set = 0;
+			break;
+		default:
+			if ((prefix = strchr(obj->isupport.prefix_modes, *mode))) {
+				if (arg < count) {
+					php_ircclient_member_t *m = php_ircclient_member_find(obj, ch, params[arg], strlen(params[arg]));
+
+					if (m) {
+						unsigned bit = 1U << (prefix - obj->isupport.prefix_modes);
+
+						m->modes = set ? (m->modes | bit) : (m->modes & ~bit);
+					}
+					++arg;
+				}
+			} else {
+				switch (php_ircclient_isupport_chanmode(obj, *mode)) {
+				case 0:
+				case 1:
+					++arg;
+					break;
+				case 2:
+					if (set) {
+						++arg;
+					}
+					break;
+				}
+			}
+			break;
+		}
+	}
+}
+
+/* RPL_NAMREPLY: nick [=*@] channel :[@+]nick[!user@host] ... */
+static void php_ircclient_track_names(php_ircclient_session_object_t *obj, const char **params, unsigned int count)
+{
+	php_ircclient_channel_t *ch;
+	const char *names;
+
+	if (count < 3 || !(ch = php_ircclient_track_channel(obj, params[count - 2]))) {
+		return;
+	}
+	if (ch->synced) {
+		/* a fresh NAMES reply */
+		zend_hash_clean(&ch->members);
+		ch->synced = 0;
+	}
+
+	for (names = params[count - 1]; *names; ) {
+		size_t len = strcspn(names, " ");
+
+		if (len) {
+			unsigned modes = 0;
+			const char *prefix, *nick = names;
+
+			/* multi-prefix sends all of them */
+			while (nick < names + len && *nick && (prefix = strchr(obj->isupport.prefix_chars, *nick))) {
+				modes |= 1U << (prefix - obj->isupport.prefix_chars);
+				++nick;
+			}
+			if (nick < names + len) {
+				php_ircclient_member_add(obj, ch, nick, MIN(strcspn(nick, "!"), len - (nick - names)), modes);
+			}
+		}
+		names += len;
+		while (*names == ' ') {
+			++names;
+		}
+	}
+}
+
+static void php_ircclient_track(php_ircclient_session_object_t *obj, php_ircclient_event_t ev, const char *origin, const char **params, unsigned int count)
+{
+	size_t nick_len = origin ? strcspn(origin, "!@") : 0;
+
+	/* our own nick is always kept track of */
+	if (ev != PHP_IRCCLIENT_EVENT_CONNECT && ev != PHP_IRCCLIENT_EVENT_NICK && !(obj->opts & PHP_IRCCLIENT_OPTION_TRACK_STATE)) {
+		return;
+	}
+
+	switch (ev) {
+	case PHP_IRCCLIENT_EVENT_CONNECT:
+		php_ircclient_track_clear(obj);
+		if (count) {
+			obj->track.self = estrdup(params[0]);
+		}
+		break;
+	case PHP_IRCCLIENT_EVENT_JOIN:
+		if (count && nick_len) {
+			php_ircclient_track_join(obj, params[0], origin, nick_len);
+		}
+		break;
+	case PHP_IRCCLIENT_EVENT_PART:
+		if (count && nick_len) {
+			php_ircclient_track_part(obj, params[0], origin, nick_len);
+		}
+		break;
+	case PHP_IRCCLIENT_EVENT_KICK:
+		if (count > 1) {
+			php_ircclient_track_part(obj, params[0], params[1], strlen(params[1]));
+		}
+		break;
+	case PHP_IRCCLIENT_EVENT_QUIT:
+		if (nick_len) {
+			php_ircclient_track_nick(obj, origin, nick_len, NULL);
+		}
+		break;
+	case PHP_IRCCLIENT_EVENT_NICK:
+		if (count && nick_len) {
+			if (php_ircclient_track_is_self(obj, origin, nick_len)) {
+				efree(obj->track.self);
+				obj->track.self = estrdup(params[0]);
+			}
+			if (obj->opts & PHP_IRCCLIENT_OPTION_TRACK_STATE) {
+				php_ircclient_track_nick(obj, origin, nick_len, params[0]);
+			}
+		}
+		break;
+	case PHP_IRCCLIENT_EVENT_MODE:
+		php_ircclient_track_mode(obj, params, count);
+		break;
+	default:
+		break;
+	}
+}
+
+static void php_ircclient_track_numeric(php_ircclient_session_object_t *obj, unsigned int event, const char **params, unsigned int count)
+{
+	php_ircclient_channel_t *ch;
+
+	switch (event) {
+	case 353:
+		php_ircclient_track_names(obj, params, count);
+		break;
+	case 366:
+		if (count > 1 && (ch = php_ircclient_track_channel(obj, params[1]))) {
+			ch->synced = 1;
+		}
+		break;
+	}
+}
+
+static void php_ircclient_rejoin_dtor(void *ptr)
+{
+	php_ircclient_rejoin_t *r = *(php_ircclient_rejoin_t **) ptr;
+
+	STR_FREE(r->key);
+	efree(r);
+}
+
+/* remember a channel to join again after reconnecting; key NULL keeps a known one */
+static void php_ircclient_rejoin_add(php_ircclient_session_object_t *obj, const char *name, const char *key)
+{
+	php_ircclient_rejoin_t *r, **rp;
+	char fold[PHP_IRCCLIENT_KEY_SIZE];
+	size_t name_len = strlen(name), len = php_ircclient_casefold(obj, name, name_len, fold);
+
+	/* joined again by now, e.g. from onConnect */
+	zend_hash_del(&obj->reconnect.rejoin, fold, len + 1);
+
+	if (SUCCESS == zend_hash_find(&obj->reconnect.channels, fold, len + 1, (void *) &rp)) {
+		if (key) {
+			STR_FREE((*rp)->key);
+			(*rp)->key = estrdup(key);
+		}
+		return;
+	}
+	r = emalloc(sizeof(*r) + name_len);
+	memcpy(r->name, name, name_len + 1);
+	r->key = key ? estrdup(key) : NULL;
+	zend_hash_add(&obj->reconnect.channels, fold, len + 1, (void *) &r, sizeof(r), NULL);
+}
+
+static void php_ircclient_rejoin_del(php_ircclient_session_object_t *obj, const char *name)
+{
+	char fold[PHP_IRCCLIENT_KEY_SIZE];
+	size_t len = php_ircclient_casefold(obj, name, strlen(name), fold);
+
+	zend_hash_del(&obj->reconnect.channels, fold, len + 1);
+}
+
+/* comma separated channels, and their keys, of Session::doJoin() or doPart() */
+static void php_ircclient_rejoin_list(php_ircclient_session_object_t *obj, const char *chans, const char *keys, int join)
+{
+	char *clist, *klist = NULL, *c, *k = NULL, *cs = NULL, *ks = NULL;
+
+	if (!obj->reconnect.max) {
+		return;
+	}
+
+	clist = estrdup(chans);
+	if (keys) {
+		klist = estrdup(keys);
+		k = php_strtok_r(klist, ",", &ks);
+	}
+	for (c = php_strtok_r(clist, ",", &cs); c; c = php_strtok_r(NULL, ",", &cs)) {
+		if (join) {
+			php_ircclient_rejoin_add(obj, c, k);
+		} else {
+			php_ircclient_rejoin_del(obj, c);
+		}
+		if (k) {
+			k = php_strtok_r(NULL, ",", &ks);
+		}
+	}
+	efree(clist);
+	STR_FREE(klist);
+}
+
+/* our own channels, whether or not irc\client\OPTION_TRACK_STATE is set */
+static void php_ircclient_reconnect_track(php_ircclient_session_object_t *obj, php_ircclient_event_t ev, const char *origin, const char **params, unsigned int count)
+{
+	size_t nick_len = origin ? strcspn(origin, "!@") : 0;
+
+	if (!obj->reconnect.max) {
+		return;
+	}
+
+	switch (ev) {
+	case PHP_IRCCLIENT_EVENT_JOIN:
+		if (count && php_ircclient_track_is_self(obj, origin, nick_len)) {
+			php_ircclient_rejoin_add(obj, params[0], NULL);
+		}
+		break;
+	case PHP_IRCCLIENT_EVENT_PART:
+		if (count && php_ircclient_track_is_self(obj, origin, nick_len)) {
+			php_ircclient_rejoin_del(obj, params[0]);
+		}
+		break;
+	case PHP_IRCCLIENT_EVENT_KICK:
+		if (count > 1 && php_ircclient_track_is_self(obj, params[1], strlen(params[1]))) {
+			php_ircclient_rejoin_del(obj, params[0]);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static void php_ircclient_rejoin_move(HashTable *from, HashTable *to)
+{
+	php_ircclient_rejoin_t **rp;
+	HashPosition pos;
+	char *key;
+	uint len;
+	ulong idx;
+
+	for (	zend_hash_internal_pointer_reset_ex(from, &pos);
+			SUCCESS == zend_hash_get_current_data_ex(from, (void *) &rp, &pos)
+		&&	HASH_KEY_IS_STRING == zend_hash_get_current_key_ex(from, &key, &len, &idx, 0, &pos);
+			zend_hash_move_forward_ex(from, &pos)
+	) {
+		zend_hash_update(to, key, len, (void *) rp, sizeof(*rp), NULL);
+	}
+	/* owned by the other table now */
+	from->pDestructor = NULL;
+	zend_hash_clean(from);
+	from->pDestructor = php_ircclient_rejoin_dtor;
+}
+
+static void php_ircclient_rejoin_flush(php_ircclient_session_object_t *obj, smart_str *chans, smart_str *keys)
+{
+	if (chans->len) {
+		smart_str_0(chans);
+		smart_str_0(keys);
+		php_ircclient_queue_push(obj, PHP_IRCCLIENT_PRIORITY_NORMAL, "JOIN %s%s%s", chans->c, keys->len ? " " : "", keys->len ? keys->c : "");
+		chans->len = keys->len = 0;
+	}
+}
+
+/* queue the channels not joined again from onConnect, as few JOIN lines as
+ * possible, those with keys first; paced by Session::setFloodControl() */
+static void php_ircclient_session_rejoin(php_ircclient_session_object_t *obj)
+{
+	smart_str chans = {0}, keys = {0};
+	php_ircclient_rejoin_t **rp;
+	HashPosition pos;
+	int keyed;
+
+	for (keyed = 1; keyed >= 0; --keyed) {
+		for (	zend_hash_internal_pointer_reset_ex(&obj->reconnect.rejoin, &pos);
+				SUCCESS == zend_hash_get_current_data_ex(&obj->reconnect.rejoin, (void *) &rp, &pos);
+				zend_hash_move_forward_ex(&obj->reconnect.rejoin, &pos)
+		) {
+			php_ircclient_rejoin_t *r = *rp;
+			size_t name_len = strlen(r->name), key_len = r->key ? strlen(r->key) : 0;
+
+			if (keyed != !!r->key) {
+				continue;
+			}
+			/* 512 bytes minus CRLF, "JOIN ", a space and commas */
+			if (chans.len && chans.len + keys.len + name_len + key_len + 3 > 510 - 6) {
+				php_ircclient_rejoin_flush(obj, &chans, &keys);
+			}
+			if (chans.len) {
+				smart_str_appendc(&chans, ',');
+			}
+			smart_str_appendl(&chans, r->name, name_len);
+			if (r->key) {
+				if (keys.len) {
+					smart_str_appendc(&keys, ',');
+				}
+				smart_str_appendl(&keys, r->key, key_len);
+			}
+		}
+	}
+	php_ircclient_rejoin_flush(obj, &chans, &keys);
+	smart_str_free(&chans);
+	smart_str_free(&keys);
+
+	/* keep them, with their keys, for the next time */
+	php_ircclient_rejoin_move(&obj->reconnect.rejoin, &obj->reconnect.channels);
+}
+
+static void php_ircclient_dcc_dtor(void *ptr)
+{
+	php_ircclient_dcc_t *dcc = ptr;
+
+	if (dcc->zcb) {
+		zval_ptr_dtor(&dcc->zcb);
+	}
+	if (dcc->zstream) {
+		zval_ptr_dtor(&dcc->zstream);
+	}
+	if (dcc->ring) {
+		efree(dcc->ring);
+	}
+}
+
+static void php_ircclient_filter_dtor(void *ptr)
+{
+	php_ircclient_filter_t *f = ptr;
+
+	if (f->channels) {
+		zend_hash_destroy(f->channels);
+		FREE_HASHTABLE(f->channels);
+	}
+	STR_FREE(f->target);
+	STR_FREE(f->prefix);
+	STR_FREE(f->pattern);
+}
+
+static int php_ircclient_filter_match(php_ircclient_session_object_t *obj, php_ircclient_filter_t *f, const char **params, unsigned int count TSRMLS_DC)
+{
+	const char *target = count ? params[0] : NULL, *text = count ? params[count - 1] : NULL;
+	char key[PHP_IRCCLIENT_KEY_SIZE];
+	size_t len;
+
+	if (f->channels || f->target) {
+		if (!target) {
+			return 0;
+		}
+		len = php_ircclient_casefold(obj, target, strlen(target), key);
+		if (f->channels && !zend_hash_exists(f->channels, key, len + 1)) {
+			return 0;
+		}
+		if (f->target && (len != f->target_len || memcmp(key, f->target, len))) {
+			return 0;
+		}
+	}
+	if (f->prefix && (!text || strncmp(text, f->prefix, f->prefix_len))) {
+		return 0;
+	}
+	if (f->mention) {
+		char nick[PHP_IRCCLIENT_KEY_SIZE];
+
+		if (!text || !obj->track.self) {
+			return 0;
+		}
+		php_ircclient_casefold(obj, obj->track.self, strlen(obj->track.self), nick);
+		php_ircclient_casefold(obj, text, strlen(text), key);
+		if (!strstr(key, nick)) {
+			return 0;
+		}
+	}
+	if (f->pattern) {
+		/* looked up each time, the cache might drop it */
+		pcre_cache_entry *pce;
+
+		if (!text || !(pce = pcre_get_compiled_regex_cache(f->pattern, f->pattern_len TSRMLS_CC))) {
+			return 0;
+		}
+		if (0 > pcre_exec(pce->re, pce->extra, text, strlen(text), 0, 0, NULL, 0)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* whether an event passes the filters, checked before any zval is built */
+static int php_ircclient_session_filter(php_ircclient_session_object_t *obj, php_ircclient_event_t ev, const char **params, unsigned int count TSRMLS_DC)
+{
+	php_ircclient_filter_t *f;
+	HashPosition pos;
+
+	if (!(obj->filtered & PHP_IRCCLIENT_EVENT_MASK(ev))) {
+		return 1;
+	}
+	for (	zend_hash_internal_pointer_reset_ex(&obj->filters, &pos);
+			SUCCESS == zend_hash_get_current_data_ex(&obj->filters, (void *) &f, &pos);
+			zend_hash_move_forward_ex(&obj->filters, &pos)
+	) {
+		if ((f->events & PHP_IRCCLIENT_EVENT_MASK(ev)) && php_ircclient_filter_match(obj, f, params, count TSRMLS_CC)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void php_ircclient_session_filtered(php_ircclient_session_object_t *obj)
+{
+	php_ircclient_filter_t *f;
+	HashPosition pos;
+
+	obj->filtered = 0;
+	for (	zend_hash_internal_pointer_reset_ex(&obj->filters, &pos);
+			SUCCESS == zend_hash_get_current_data_ex(&obj->filters, (void *) &f, &pos);
+			zend_hash_move_forward_ex(&obj->filters, &pos)
+	) {
+		obj->filtered |= f->events;
+	}
+}
+
+/* A capture starts with PHP_IRCCLIENT_CAPTURE_MAGIC, again whenever another
+ * capture was appended, and otherwise consists of records of what libircclient
+ * passed to our callbacks, all numbers in network byte order:
+ *	uint32 microseconds since the previous record
+ *	uint16 numeric reply code, or PHP_IRCCLIENT_CAPTURE_EVENT + event
+ *	uint8  param count
+ *	uint8  reserved
+ * followed by the event name, origin and params, each as a uint16 length and
+ * that many bytes, where PHP_IRCCLIENT_CAPTURE_NULL stands for NULL. */
+#define PHP_IRCCLIENT_CAPTURE_MAGIC "IRCCAP\0\1"
+#define PHP_IRCCLIENT_CAPTURE_HEAD 8
+#define PHP_IRCCLIENT_CAPTURE_EVENT 1000
+#define PHP_IRCCLIENT_CAPTURE_NULL 0xffff
+#define PHP_IRCCLIENT_CAPTURE_FLUSH 0x10000
+
+static inline void php_ircclient_capture_u16(smart_str *buf, unsigned int u)
+{
+	smart_str_appendc(buf, (u >> 8) & 0xff);
+	smart_str_appendc(buf, u & 0xff);
+}
+
+static inline void php_ircclient_capture_str(smart_str *buf, const char *str)
+{
+	size_t len;
+
+	if (!str) {
+		php_ircclient_capture_u16(buf, PHP_IRCCLIENT_CAPTURE_NULL);
+		return;
+	}
+	len = MIN(strlen(str), PHP_IRCCLIENT_CAPTURE_NULL - 1);
+	php_ircclient_capture_u16(buf, len);
+	smart_str_appendl(buf, str, len);
+}
+
+static void php_ircclient_capture_flush(php_ircclient_session_object_t *obj TSRMLS_DC)
+{
+	php_stream *s;
+
+	if (!obj->capture.buf.len) {
+		return;
+	}
+	if (!(s = php_ircclient_stream(obj->capture.zstream TSRMLS_CC))) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "capture stream was closed");
+	} else if (obj->capture.buf.len != php_stream_write(s, obj->capture.buf.c, obj->capture.buf.len)) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "could not write capture");
+	}
+	obj->capture.buf.len = 0;
+}
+
+static void php_ircclient_capture_stop(php_ircclient_session_object_t *obj TSRMLS_DC)
+{
+	if (obj->capture.zstream) {
+		php_ircclient_capture_flush(obj TSRMLS_CC);
+		zval_ptr_dtor(&obj->capture.zstream);
+		obj->capture.zstream = NULL;
+	}
+	smart_str_free(&obj->capture.buf);
+}
+
+static void php_ircclient_capture(php_ircclient_session_object_t *obj, unsigned int type, const char *event, const char *origin, const char **params, unsigned int count)
+{
+	smart_str *buf = &obj->capture.buf;
+	double now, delta;
+	unsigned long usec;
+	unsigned int i;
+
+	if (!obj->capture.zstream || obj->capture.replay) {
+		return;
+	}
+
+	now = php_ircclient_now();
+	delta = (now - obj->capture.stamp) * 1000000.0;
+	usec = delta > 0xffffffffUL ? 0xffffffffUL : (unsigned long) delta;
+	obj->capture.stamp = now;
+	if (count > 0xff) {
+		count = 0xff;
+	}
+
+	php_ircclient_capture_u16(buf, usec >> 16);
+	php_ircclient_capture_u16(buf, usec & 0xffff);
+	php_ircclient_capture_u16(buf, type);
+	smart_str_appendc(buf, count);
+	smart_str_appendc(buf, 0);
+	php_ircclient_capture_str(buf, event);
+	php_ircclient_capture_str(buf, origin);
+	for (i = 0; i < count; ++i) {
+		php_ircclient_capture_str(buf, params[i]);
+	}
+
+	if (buf->len >= PHP_IRCCLIENT_CAPTURE_FLUSH) {
+		TSRMLS_FETCH_FROM_CTX(obj->ts);
+		php_ircclient_capture_flush(obj TSRMLS_CC);
+	}
+}
+
+static void php_ircclient_trace_alloc(php_ircclient_session_object_t *obj, size_t size)
+{
+	if (obj->trace.ring) {
+		efree(obj->trace.ring);
+		obj->trace.ring = NULL;
+	}
+	obj->trace.size = size;
+	obj->trace.count = 0;
+	if (size) {
+		obj->trace.ring = safe_emalloc(size, sizeof(*obj->trace.ring), 0);
+	}
+}
+
+/* overwrites the oldest record; no allocation, no PHP values */
+static void php_ircclient_trace(php_ircclient_session_object_t *obj, php_ircclient_event_t ev, unsigned int code, const char *origin, const char **params, unsigned int count)
+{
+	php_ircclient_trace_t *t;
+	unsigned int i;
+
+	if (!obj->trace.ring) {
+		return;
+	}
+
+	t = &obj->trace.ring[obj->trace.count++ % obj->trace.size];
+	t->time = php_ircclient_now();
+	t->ev = ev;
+	t->code = code;
+	t->count = MIN(count, 0xffff);
+	for (i = 0; i < PHP_IRCCLIENT_TRACE_PARAMS; ++i) {
+		t->lens[i] = i < count && params[i] ? MIN(strlen(params[i]), 0xffff) : 0;
+	}
+	if (origin) {
+		strlcpy(t->origin, origin, sizeof(t->origin));
+	} else {
+		*t->origin = '\0';
+	}
+}
+
+void php_ircclient_session_object_free(void *object TSRMLS_DC)
+{
+	php_ircclient_session_object_t *o = (php_ircclient_session_object_t *) object;
+
+	if (o->sess) {
+		irc_destroy_session(o->sess);
+		o->sess = NULL;
+	}
+	zend_hash_destroy(&o->dcc);
+	php_ircclient_capture_stop(o TSRMLS_CC);
+	php_ircclient_trace_alloc(o, 0);
+	php_ircclient_session_callbacks_dtor(o);
+	zend_hash_destroy(&o->watches);
+	php_ircclient_queue_dtor(&o->queue);
+	php_ircclient_track_clear(o);
+	zend_hash_destroy(&o->track.channels);
+	if (o->params) {
+		zval_ptr_dtor(&o->params);
+	}
+	zend_hash_destroy(&o->intern);
+	zend_hash_destroy(&o->cap.available);
+	zend_hash_destroy(&o->cap.enabled);
+	zend_hash_destroy(&o->batches);
+	zend_hash_destroy(&o->filters);
+	zend_hash_destroy(&o->reconnect.channels);
+	zend_hash_destroy(&o->reconnect.rejoin);
+	if (o->reconnect.servers) {
+		zval_ptr_dtor(&o->reconnect.servers);
+	}
+	STR_FREE(o->reconnect.host);
+	STR_FREE(o->reconnect.passwd);
+	php_ircclient_aggregate_clear(o);
+	zend_hash_destroy(&o->aggregate.names);
+	zend_hash_destroy(&o->aggregate.whois);
+	zend_hash_destroy(&o->aggregate.bans);
+	if (o->gc) {
+		efree(o->gc);
+	}
+#if HAVE_SYS_EPOLL_H
+	if (o->epoll.fd != -1) {
+		close(o->epoll.fd);
+		zend_hash_destroy(&o->epoll.fds);
+		if (o->epoll.events) {
+			efree(o->epoll.events);
+		}
+	}
+#endif
+	zend_object_std_dtor((zend_object *) o TSRMLS_CC);
+	efree(o);
+}
+
+static void php_ircclient_event_callback_connect(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count);
+static void php_ircclient_event_callback_nick(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count);
+static void php_ircclient_event_callback_quit(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count);
+static void php_ircclient_event_callback_join(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count);
+static void php_ircclient_event_callback_part(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count);
+static void php_ircclient_event_callback_mode(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count);
+static void php_ircclient_event_callback_umode(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count);
+static void php_ircclient_event_callback_topic(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count);
+static void php_ircclient_event_callback_kick(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count);
+static void php_ircclient_event_callback_channel(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count);
+static void php_ircclient_event_callback_privmsg(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count);
+static void php_ircclient_event_callback_notice(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count);
+#if PHP_IRCCLIENT_HAVE_EVENT_CHANNEL_NOTICE
+static void php_ircclient_event_callback_channel_notice(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count);
+#endif
+static void php_ircclient_event_callback_invite(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count);
+static void php_ircclient_event_callback_ctcp_req(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count);
+static void php_ircclient_event_callback_ctcp_rep(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count);
+static void php_ircclient_event_callback_action(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count);
+static void php_ircclient_event_callback_unknown(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count);
+static void php_ircclient_event_code_callback(irc_session_t *session, unsigned int event, const char *origin, const char **params, unsigned int count);
+static void php_ircclient_event_dcc_chat_callback(irc_session_t *session, const char *nick, const char *addr, irc_dcc_t dccid);
+static void php_ircclient_event_dcc_send_callback(irc_session_t *session, const char *nick, const char *addr, const char *filename, unsigned long size, irc_dcc_t dccid);
+
+static irc_callbacks_t php_ircclient_callbacks = {
+	.event_connect = php_ircclient_event_callback_connect,
+	.event_nick = php_ircclient_event_callback_nick,
+	.event_quit = php_ircclient_event_callback_quit,
+	.event_join = php_ircclient_event_callback_join,
+	.event_part = php_ircclient_event_callback_part,
+	.event_mode = php_ircclient_event_callback_mode,
+	.event_umode = php_ircclient_event_callback_umode,
+	.event_topic = php_ircclient_event_callback_topic,
+	.event_kick = php_ircclient_event_callback_kick,
+	.event_channel = php_ircclient_event_callback_channel,
+	.event_privmsg = php_ircclient_event_callback_privmsg,
+	.event_notice = php_ircclient_event_callback_notice,
+#if PHP_IRCCLIENT_HAVE_EVENT_CHANNEL_NOTICE
+	.event_channel_notice = php_ircclient_event_callback_channel_notice,
+#endif
+	.event_invite = php_ircclient_event_callback_invite,
+	.event_ctcp_req = php_ircclient_event_callback_ctcp_req,
+	.event_ctcp_rep = php_ircclient_event_callback_ctcp_rep,
+	.event_ctcp_action = php_ircclient_event_callback_action,
+	.event_unknown = php_ircclient_event_callback_unknown,
+	.event_numeric = php_ircclient_event_code_callback,
+	.event_dcc_chat_req = php_ircclient_event_dcc_chat_callback,
+	.event_dcc_send_req = php_ircclient_event_dcc_send_callback
+};
+
+zend_object_value php_ircclient_session_object_create(zend_class_entry *ce TSRMLS_DC)
+{
+	php_ircclient_session_object_t *obj;
+
+	obj = ecalloc(1, sizeof(*obj));
+#if PHP_VERSION_ID >= 50399
+	zend_object_std_init((zend_object *) obj, ce TSRMLS_CC);
+	object_properties_init((zend_object *) obj, ce);
+#else
+	obj->zo.ce = ce;
+	ALLOC_HASHTABLE(obj->zo.properties);
+	zend_hash_init(obj->zo.properties, zend_hash_num_elements(&ce->default_properties), NULL, ZVAL_PTR_DTOR, 0);
+	zend_hash_copy(obj->zo.properties, &ce->default_properties, (copy_ctor_func_t) zval_add_ref, NULL, sizeof(zval *));
+#endif
+
+	obj->sess = irc_create_session(&php_ircclient_callbacks);
+	irc_set_ctx(obj->sess, obj);
+	php_ircclient_session_callbacks_init(obj);
+	obj->mask_dirty = 1;
+	zend_hash_init(&obj->watches, 0, NULL, php_ircclient_watch_dtor, 0);
+	php_ircclient_queue_init(&obj->queue);
+	php_ircclient_stats_reset(&obj->stats);
+	obj->sock = -1;
+	php_ircclient_isupport_reset(obj);
+	zend_hash_init(&obj->track.channels, 0, NULL, php_ircclient_channel_dtor, 0);
+	zend_hash_init(&obj->aggregate.names, 0, NULL, ZVAL_PTR_DTOR, 0);
+	zend_hash_init(&obj->aggregate.whois, 0, NULL, ZVAL_PTR_DTOR, 0);
+	zend_hash_init(&obj->aggregate.bans, 0, NULL, ZVAL_PTR_DTOR, 0);
+	zend_hash_init(&obj->intern, 64, NULL, ZVAL_PTR_DTOR, 0);
+	zend_hash_init(&obj->cap.available, 0, NULL, ZVAL_PTR_DTOR, 0);
+	zend_hash_init(&obj->cap.enabled, 0, NULL, ZVAL_PTR_DTOR, 0);
+	zend_hash_init(&obj->batches, 0, NULL, ZVAL_PTR_DTOR, 0);
+	zend_hash_init(&obj->filters, 0, NULL, php_ircclient_filter_dtor, 0);
+	zend_hash_init(&obj->dcc, 0, NULL, php_ircclient_dcc_dtor, 0);
+	zend_hash_init(&obj->reconnect.channels, 0, NULL, php_ircclient_rejoin_dtor, 0);
+	zend_hash_init(&obj->reconnect.rejoin, 0, NULL, php_ircclient_rejoin_dtor, 0);
+#if HAVE_SYS_EPOLL_H
+	obj->epoll.fd = -1;
+#endif
+	TSRMLS_SET_CTX(obj->ts);
+
+	obj->ov.handle = zend_objects_store_put(obj, NULL, php_ircclient_session_object_free, NULL TSRMLS_CC);
+	obj->ov.handlers = &php_ircclient_session_object_handlers;
+
+	return obj->ov;
+}
+
+static void php_ircclient_session_slow(php_ircclient_session_object_t *obj, php_ircclient_event_t ev, double took TSRMLS_DC);
+
+static void php_ircclient_session_invoke(zend_fcall_info *fci_ptr, zend_fcall_info_cache *fcc_ptr, int argc, zval ***argv TSRMLS_DC)
+{
+	zend_fcall_info fci = *fci_ptr;
+	zend_fcall_info_cache fcc = *fcc_ptr;
+	zval *retval = NULL;
+
+	fci.retval_ptr_ptr = &retval;
+	fci.param_count = argc;
+	fci.params = argv;
+
+	zend_call_function(&fci, &fcc TSRMLS_CC);
+
+	if (retval) {
+		zval_ptr_dtor(&retval);
+	}
+}
+
+/* the closure assigned to the onXxx property, looked up again only after
+ * any of those properties changed; referenced properties may change behind
+ * our back and are read by name each time */
+static int php_ircclient_session_property(php_ircclient_session_object_t *obj, zval *zobject, php_ircclient_event_t ev TSRMLS_DC)
+{
+	php_ircclient_session_callback_t *cb = &obj->cbc[ev];
+
+	if (cb->prop == PHP_IRCCLIENT_PROPERTY_UNKNOWN) {
+		zval *prop = zend_read_property(php_ircclient_session_class_entry, zobject, php_ircclient_events[ev].str, php_ircclient_events[ev].len, 1 TSRMLS_CC);
+
+		if (PZVAL_IS_REF(prop)) {
+			cb->prop = PHP_IRCCLIENT_PROPERTY_METHOD;
+		} else if (Z_TYPE_P(prop) == IS_NULL) {
+			cb->prop = PHP_IRCCLIENT_PROPERTY_NULL;
+		} else if (SUCCESS == zend_fcall_info_init(prop, 0, &cb->pfci, &cb->pfcc, NULL, NULL TSRMLS_CC)) {
+			cb->zprop = prop;
+			Z_ADDREF_P(prop);
+			cb->prop = PHP_IRCCLIENT_PROPERTY_CACHED;
+		} else {
+			/* let call_closure() complain */
+			cb->prop = PHP_IRCCLIENT_PROPERTY_METHOD;
+		}
+	}
+	return cb->prop;
+}
+
+/* the overridden method, or the closure of the onXxx property */
+static void php_ircclient_session_handler(php_ircclient_session_object_t *obj, php_ircclient_event_t ev, int argc, zval ***argv TSRMLS_DC)
+{
+	php_ircclient_session_callback_t *cb = &obj->cbc[ev];
+	zval *zcb;
+
+	if (!cb->fcc.initialized) {
+		return;
+	}
+
+	if (!(obj->methods & PHP_IRCCLIENT_EVENT_MASK(ev))) {
+		switch (php_ircclient_session_property(obj, obj->zthis, ev TSRMLS_CC)) {
+		case PHP_IRCCLIENT_PROPERTY_NULL:
+			return;
+		case PHP_IRCCLIENT_PROPERTY_CACHED:
+			/* the handler might replace itself */
+			zcb = cb->zprop;
+			Z_ADDREF_P(zcb);
+			php_ircclient_session_invoke(&cb->pfci, &cb->pfcc, argc, argv TSRMLS_CC);
+			zval_ptr_dtor(&zcb);
+			return;
+		}
+	}
+
+	cb->fci.object_ptr = cb->fcc.object_ptr = obj->zthis;
+	php_ircclient_session_invoke(&cb->fci, &cb->fcc, argc, argv TSRMLS_CC);
+	cb->fci.object_ptr = cb->fcc.object_ptr = NULL;
+}
+
+static void php_ircclient_session_call(php_ircclient_session_object_t *obj, php_ircclient_event_t ev, int argc, zval ***argv TSRMLS_DC)
+{
+	php_ircclient_listeners_t *ls = obj->listeners[ev];
+	unsigned i = 0;
+	double start, took;
+
+	if (!obj->zthis) {
+		return;
+	}
+
+	start = php_ircclient_now();
+	if (ls) {
+		++ls->refcount;
+		/* the handler counts as PRIORITY_NORMAL, before other listeners of it */
+		for (; i < ls->count && ls->entries[i].priority < PHP_IRCCLIENT_PRIORITY_NORMAL && !EG(exception); ++i) {
+			php_ircclient_session_invoke(&ls->entries[i].fci, &ls->entries[i].fcc, argc, argv TSRMLS_CC);
+		}
+	}
+	if (!EG(exception)) {
+		php_ircclient_session_handler(obj, ev, argc, argv TSRMLS_CC);
+	}
+	if (ls) {
+		for (; i < ls->count && !EG(exception); ++i) {
+			php_ircclient_session_invoke(&ls->entries[i].fci, &ls->entries[i].fcc, argc, argv TSRMLS_CC);
+		}
+		php_ircclient_listeners_release(ls);
+	}
+	took = php_ircclient_now() - start;
+	php_ircclient_stats_call(&obj->stats, ev, took);
+
+	if (obj->watchdog.threshold > 0 && took >= obj->watchdog.threshold && ev != PHP_IRCCLIENT_EVENT_SLOW_HANDLER) {
+		php_ircclient_session_slow(obj, ev, took TSRMLS_CC);
+	}
+}
+
+/* servers ping far less often than this */
+#define PHP_IRCCLIENT_WATCHDOG_REPEAT 15.0
+
+/* answer a PING still waiting in the socket buffer, before libircclient gets
+ * to it behind everything else received until then; irc_send_raw() only
+ * appends the answer to libircclient's output buffer, which is written to
+ * the socket on the next tick, once the slow handler has returned */
+static void php_ircclient_watchdog_pong(php_ircclient_session_object_t *obj)
+{
+	char buf[4096];
+	ssize_t len;
+	const char *line, *end, *eol;
+
+	if (obj->sock < 0 || !irc_is_connected(obj->sess)) {
+		return;
+	}
+	if (0 >= (len = recv(obj->sock, buf, sizeof(buf), MSG_PEEK|MSG_DONTWAIT))) {
+		return;
+	}
+
+	for (line = buf, end = buf + len; line < end && (eol = memchr(line, '\n', end - line)); line = eol + 1) {
+		const char *token;
+		size_t token_len;
+
+		if (eol - line < 5 || strncmp(line, "PING ", 5)) {
+			continue;
+		}
+		token = line + 5;
+		if (*token == ':') {
+			++token;
+		}
+		token_len = eol - token;
+		if (token_len && token[token_len - 1] == '\r') {
+			--token_len;
+		}
+		if (token_len >= sizeof(obj->watchdog.token)) {
+			continue;
+		}
+
+		/* libircclient will answer again when it gets there, which does no harm */
+		if (token_len == strlen(obj->watchdog.token) && !memcmp(token, obj->watchdog.token, token_len)
+		&&	php_ircclient_now() - obj->watchdog.stamp < PHP_IRCCLIENT_WATCHDOG_REPEAT
+		) {
+			continue;
+		}
+		if (SUCCESS == php_ircclient_session_send(obj, PHP_IRCCLIENT_SEND_QUIET, "PONG :%.*s", (int) token_len, token)) {
+			memcpy(obj->watchdog.token, token, token_len);
+			obj->watchdog.token[token_len] = '\0';
+			obj->watchdog.stamp = php_ircclient_now();
+		}
+	}
+}
+
+static void php_ircclient_session_slow(php_ircclient_session_object_t *obj, php_ircclient_event_t ev, double took TSRMLS_DC)
+{
+	if (obj->watchdog.pong) {
+		php_ircclient_watchdog_pong(obj);
+	}
+
+	if (php_ircclient_session_listens(obj, PHP_IRCCLIENT_EVENT_SLOW_HANDLER TSRMLS_CC)) {
+		zval *zh, *zt, **argv[2];
+
+		MAKE_STD_ZVAL(zh);
+		ZVAL_STRINGL(zh, php_ircclient_events[ev].str, php_ircclient_events[ev].len, 1);
+		MAKE_STD_ZVAL(zt);
+		ZVAL_DOUBLE(zt, took);
+
+		argv[0] = &zh;
+		argv[1] = &zt;
+		php_ircclient_session_call(obj, PHP_IRCCLIENT_EVENT_SLOW_HANDLER, 2, argv TSRMLS_CC);
+
+		zval_ptr_dtor(&zt);
+		zval_ptr_dtor(&zh);
+	} else {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s took %.3f seconds", php_ircclient_events[ev].str, took);
+	}
+}
+
+#define PHP_IRCCLIENT_INTERN_SIZE 1024
+
+/* a shared string for origins, targets and commands, which repeat a lot;
+ * the table starts over when it is full */
+static zval *php_ircclient_intern(php_ircclient_session_object_t *obj, const char *str)
+{
+	size_t len = strlen(str);
+	zval **zpp, *z;
+
+	if (SUCCESS == zend_hash_find(&obj->intern, str, len + 1, (void *) &zpp)) {
+		Z_ADDREF_PP(zpp);
+		return *zpp;
+	}
+	if (zend_hash_num_elements(&obj->intern) >= PHP_IRCCLIENT_INTERN_SIZE) {
+		zend_hash_clean(&obj->intern);
+	}
+
+	MAKE_STD_ZVAL(z);
+	ZVAL_STRINGL(z, estrndup(str, len), len, 0);
+	Z_ADDREF_P(z);
+	zend_hash_add(&obj->intern, str, len + 1, (void *) &z, sizeof(zval *), NULL);
+
+	return z;
+}
+
+static inline zval *php_ircclient_zval_origin(php_ircclient_session_object_t *obj, const char *origin)
+{
+	zval *zo;
+
+	if (origin) {
+		return php_ircclient_intern(obj, origin);
+	}
+	MAKE_STD_ZVAL(zo);
+	ZVAL_NULL(zo);
+	return zo;
+}
+
+static inline zval *php_ircclient_zval_params(php_ircclient_session_object_t *obj, const char **params, unsigned int count)
+{
+	unsigned int i;
+	zval *zp;
+
+	MAKE_STD_ZVAL(zp);
+	array_init_size(zp, count);
+	for (i = 0; i < count; ++i) {
+		if (i) {
+			add_next_index_string(zp, estrdup(params[i]), 0);
+		} else {
+			/* the channel or our nick */
+			add_next_index_zval(zp, php_ircclient_intern(obj, params[i]));
+		}
+	}
+	return zp;
+}
+
+void php_ircclient_params_object_free(void *object TSRMLS_DC)
+{
+	php_ircclient_params_object_t *o = (php_ircclient_params_object_t *) object;
+
+	if (o->entries) {
+		while (o->size--) {
+			if (o->entries[o->size]) {
+				zval_ptr_dtor(&o->entries[o->size]);
+			}
+		}
+		efree(o->entries);
+	}
+	zend_object_std_dtor((zend_object *) o TSRMLS_CC);
+	efree(o);
+}
+
+zend_object_value php_ircclient_params_object_create(zend_class_entry *ce TSRMLS_DC)
+{
+	php_ircclient_params_object_t *obj;
+
+	obj = ecalloc(1, sizeof(*obj));
+#if PHP_VERSION_ID >= 50399
+	zend_object_std_init((zend_object *) obj, ce TSRMLS_CC);
+	object_properties_init((zend_object *) obj, ce);
+#else
+	obj->zo.ce = ce;
+	ALLOC_HASHTABLE(obj->zo.properties);
+	zend_hash_init(obj->zo.properties, zend_hash_num_elements(&ce->default_properties), NULL, ZVAL_PTR_DTOR, 0);
+	zend_hash_copy(obj->zo.properties, &ce->default_properties, (copy_ctor_func_t) zval_add_ref, NULL, sizeof(zval *));
+#endif
+
+	obj->ov.handle = zend_objects_store_put(obj, NULL, php_ircclient_params_object_free, NULL TSRMLS_CC);
+	obj->ov.handlers = &php_ircclient_params_object_handlers;
+
+	return obj->ov;
+}
+
+static zval *php_ircclient_params_entry(php_ircclient_params_object_t *p, unsigned int i)
+{
+	if (p->size < p->count) {
+		p->entries = erealloc(p->entries, p->count * sizeof(zval *));
+		memset(&p->entries[p->size], 0, (p->count - p->size) * sizeof(zval *));
+		p->size = p->count;
+	}
+	if (!p->entries[i]) {
+		MAKE_STD_ZVAL(p->entries[i]);
+		ZVAL_STRING(p->entries[i], estrdup(p->params[i]), 0);
+	}
+	return p->entries[i];
+}
+
+static int php_ircclient_params_offset(php_ircclient_params_object_t *p, zval *offset, unsigned int *i)
+{
+	long l;
+
+	switch (Z_TYPE_P(offset)) {
+	case IS_LONG:
+	case IS_BOOL:
+		l = Z_LVAL_P(offset);
+		break;
+	case IS_DOUBLE:
+		l = zend_dval_to_lval(Z_DVAL_P(offset));
+		break;
+	case IS_STRING:
+		if (IS_LONG != is_numeric_string(Z_STRVAL_P(offset), Z_STRLEN_P(offset), &l, NULL, 0)) {
+			return FAILURE;
+		}
+		break;
+	default:
+		return FAILURE;
+	}
+	if (l < 0 || (unsigned long) l >= p->count) {
+		return FAILURE;
+	}
+	*i = l;
+	return SUCCESS;
+}
+
+static zval *php_ircclient_params_read_dimension(zval *object, zval *offset, int type TSRMLS_DC)
+{
+	php_ircclient_params_object_t *p = zend_object_store_get_object(object TSRMLS_CC);
+	unsigned int i;
+
+	if (type != BP_VAR_R && type != BP_VAR_IS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "irc\\client\\Params is read-only");
+		return EG(uninitialized_zval_ptr);
+	}
+	if (!offset || SUCCESS != php_ircclient_params_offset(p, offset, &i)) {
+		if (type != BP_VAR_IS) {
+			php_error_docref(NULL TSRMLS_CC, E_NOTICE, "Undefined offset");
+		}
+		return EG(uninitialized_zval_ptr);
+	}
+	return php_ircclient_params_entry(p, i);
+}
+
+static int php_ircclient_params_has_dimension(zval *object, zval *offset, int check_empty TSRMLS_DC)
+{
+	php_ircclient_params_object_t *p = zend_object_store_get_object(object TSRMLS_CC);
+	unsigned int i;
+
+	if (SUCCESS != php_ircclient_params_offset(p, offset, &i)) {
+		return 0;
+	}
+	if (check_empty) {
+		zval *entry = php_ircclient_params_entry(p, i);
+
+		return zend_is_true(entry);
+	}
+	return 1;
+}
+
+static void php_ircclient_params_write_dimension(zval *object, zval *offset, zval *value TSRMLS_DC)
+{
+	php_error_docref(NULL TSRMLS_CC, E_WARNING, "irc\\client\\Params is read-only");
+}
+
+static void php_ircclient_params_unset_dimension(zval *object, zval *offset TSRMLS_DC)
+{
+	php_error_docref(NULL TSRMLS_CC, E_WARNING, "irc\\client\\Params is read-only");
+}
+
+static int php_ircclient_params_count_elements(zval *object, long *count TSRMLS_DC)
+{
+	php_ircclient_params_object_t *p = zend_object_store_get_object(object TSRMLS_CC);
+
+	*count = p->count;
+	return SUCCESS;
+}
+
+static void php_ircclient_params_array(php_ircclient_params_object_t *p, zval *array)
+{
+	unsigned int i;
+
+	array_init_size(array, p->count);
+	for (i = 0; i < p->count; ++i) {
+		zval *entry = php_ircclient_params_entry(p, i);
+
+		Z_ADDREF_P(entry);
+		add_next_index_zval(array, entry);
+	}
+}
+
+static HashTable *php_ircclient_params_get_debug_info(zval *object, int *is_temp TSRMLS_DC)
+{
+	php_ircclient_params_object_t *p = zend_object_store_get_object(object TSRMLS_CC);
+	zval array;
+
+	php_ircclient_params_array(p, &array);
+	*is_temp = 1;
+	return Z_ARRVAL(array);
+}
+
+/* an idle Params object if nobody else holds on to it, or a new one */
+static zval *php_ircclient_params_bind(php_ircclient_session_object_t *obj, const char **params, unsigned int count TSRMLS_DC)
+{
+	php_ircclient_params_object_t *p;
+	zval *zp;
+
+	if ((zp = obj->params)) {
+		obj->params = NULL;
+	} else {
+		MAKE_STD_ZVAL(zp);
+		object_init_ex(zp, php_ircclient_params_class_entry);
+	}
+
+	p = zend_object_store_get_object(zp TSRMLS_CC);
+	p->params = params;
+	p->count = count;
+
+	return zp;
+}
+
+static void php_ircclient_params_unbind(php_ircclient_session_object_t *obj, zval *zp TSRMLS_DC)
+{
+	php_ircclient_params_object_t *p = zend_object_store_get_object(zp TSRMLS_CC);
+	unsigned int i;
+
+	if (Z_REFCOUNT_P(zp) > 1 || EG(objects_store).object_buckets[Z_OBJ_HANDLE_P(zp)].bucket.obj.refcount > 1) {
+		/* escaped the handler; libircclient's buffer won't outlive this call */
+		for (i = 0; i < p->count; ++i) {
+			php_ircclient_params_entry(p, i);
+		}
+		p->params = NULL;
+		zval_ptr_dtor(&zp);
+		return;
+	}
+
+	for (i = 0; i < p->size; ++i) {
+		if (p->entries[i]) {
+			zval_ptr_dtor(&p->entries[i]);
+			p->entries[i] = NULL;
+		}
+	}
+	p->params = NULL;
+	p->count = 0;
+
+	if (obj->params) {
+		/* bound recursively from within a handler */
+		zval_ptr_dtor(&zp);
+	} else {
+		obj->params = zp;
+	}
+}
+
+static inline zval *php_ircclient_session_params(php_ircclient_session_object_t *obj, const char **params, unsigned int count TSRMLS_DC)
+{
+	if (obj->opts & PHP_IRCCLIENT_OPTION_LAZY_PARAMS) {
+		return php_ircclient_params_bind(obj, params, count TSRMLS_CC);
+	}
+	return php_ircclient_zval_params(obj, params, count);
+}
+
+static inline void php_ircclient_session_params_dtor(php_ircclient_session_object_t *obj, zval *zp TSRMLS_DC)
+{
+	if (Z_TYPE_P(zp) == IS_OBJECT) {
+		php_ircclient_params_unbind(obj, zp TSRMLS_CC);
+	} else {
+		zval_ptr_dtor(&zp);
+	}
+}
+
+static void php_ircclient_tags_init(zval *ztags, const char *tags TSRMLS_DC)
+{
+	php_ircclient_tags_object_t *t;
+
+	object_init_ex(ztags, php_ircclient_tags_class_entry);
+	t = zend_object_store_get_object(ztags TSRMLS_CC);
+	t->len = strlen(tags);
+	t->str = estrndup(tags, t->len);
+}
+
+/* capabilities we know how to handle */
+static const struct {
+	const char *str;
+	size_t len;
+	unsigned opts;
+} php_ircclient_caps[] = {
+	{ZEND_STRL("message-tags"), PHP_IRCCLIENT_OPTION_MESSAGE_TAGS|PHP_IRCCLIENT_OPTION_BATCH},
+	{ZEND_STRL("server-time"), PHP_IRCCLIENT_OPTION_MESSAGE_TAGS},
+	{ZEND_STRL("batch"), PHP_IRCCLIENT_OPTION_BATCH},
+	{NULL, 0, 0}
+};
+
+/* space separated name[=value] list of CAP LS, ACK, NEW and DEL */
+static void php_ircclient_cap_list(HashTable *ht, const char *list, int del)
+{
+	while (*list) {
+		size_t len = strcspn(list, " "), key_len;
+		const char *eq;
+		char *key;
+
+		if (len) {
+			key_len = (eq = memchr(list, '=', len)) ? (size_t) (eq - list) : len;
+			key = estrndup(list, key_len);
+			if (del) {
+				zend_hash_del(ht, key, key_len + 1);
+			} else {
+				zval *zv;
+
+				MAKE_STD_ZVAL(zv);
+				if (eq) {
+					ZVAL_STRINGL(zv, eq + 1, list + len - eq - 1, 1);
+				} else {
+					ZVAL_EMPTY_STRING(zv);
+				}
+				zend_hash_update(ht, key, key_len + 1, (void *) &zv, sizeof(zval *), NULL);
+			}
+			efree(key);
+		}
+		list += len;
+		while (*list == ' ') {
+			++list;
+		}
+	}
+}
+
+static void php_ircclient_session_cap_end(php_ircclient_session_object_t *obj)
+{
+	if (obj->cap.negotiating) {
+		php_ircclient_session_send(obj, PHP_IRCCLIENT_SEND_QUIET, "CAP END");
+		obj->cap.negotiating = 0;
+	}
+}
+
+static void php_ircclient_session_cap_req(php_ircclient_session_object_t *obj)
+{
+	smart_str req = {0};
+	int i;
+
+	for (i = 0; php_ircclient_caps[i].str; ++i) {
+		if ((obj->opts & php_ircclient_caps[i].opts)
+		&&	zend_hash_exists(&obj->cap.available, php_ircclient_caps[i].str, php_ircclient_caps[i].len + 1)
+		&&	!zend_hash_exists(&obj->cap.enabled, php_ircclient_caps[i].str, php_ircclient_caps[i].len + 1)
+		) {
+			if (req.len) {
+				smart_str_appendc(&req, ' ');
+			}
+			smart_str_appendl(&req, php_ircclient_caps[i].str, php_ircclient_caps[i].len);
+		}
+	}
+
+	if (req.len) {
+		smart_str_0(&req);
+		php_ircclient_session_send(obj, PHP_IRCCLIENT_SEND_QUIET, "CAP REQ :%s", req.c);
+		smart_str_free(&req);
+	} else {
+		php_ircclient_session_cap_end(obj);
+	}
+}
+
+/* CAP <nick> <subcommand> [*] :<list> */
+static void php_ircclient_session_cap(php_ircclient_session_object_t *obj, const char **params, unsigned int count)
+{
+	const char *sub, *list;
+
+	if (count < 3) {
+		return;
+	}
+	sub = params[1];
+	list = params[count - 1];
+
+	if (!strcasecmp(sub, "LS")) {
+		php_ircclient_cap_list(&obj->cap.available, list, 0);
+		if (count == 3 || strcmp(params[2], "*")) {
+			php_ircclient_session_cap_req(obj);
+		}
+	} else if (!strcasecmp(sub, "ACK")) {
+		while (*list) {
+			size_t len = strcspn(list, " ");
+			int del = (*list == '-');
+			char *name = estrndup(list + del, len - del);
+			zval **zv;
+
+			if (del) {
+				zend_hash_del(&obj->cap.enabled, name, len - del + 1);
+			} else if (SUCCESS == zend_hash_find(&obj->cap.available, name, len + 1, (void *) &zv)) {
+				Z_ADDREF_PP(zv);
+				zend_hash_update(&obj->cap.enabled, name, len + 1, (void *) zv, sizeof(zval *), NULL);
+			} else {
+				php_ircclient_cap_list(&obj->cap.enabled, name, 0);
+			}
+			efree(name);
+			for (list += len; *list == ' '; ++list);
+		}
+		php_ircclient_session_cap_end(obj);
+	} else if (!strcasecmp(sub, "NAK")) {
+		php_ircclient_session_cap_end(obj);
+	} else if (!strcasecmp(sub, "NEW")) {
+		php_ircclient_cap_list(&obj->cap.available, list, 0);
+		php_ircclient_session_cap_req(obj);
+	} else if (!strcasecmp(sub, "DEL")) {
+		php_ircclient_cap_list(&obj->cap.available, list, 1);
+		php_ircclient_cap_list(&obj->cap.enabled, list, 1);
+	}
+}
+
+/* the open batch the current line is tagged for */
+static zval *php_ircclient_session_batch_of(php_ircclient_session_object_t *obj)
+{
+	php_ircclient_chunk_t ref;
+	char key[128];
+	zval **zb;
+
+	if (!obj->tags || !zend_hash_num_elements(&obj->batches)) {
+		return NULL;
+	}
+	if (SUCCESS != php_ircclient_tags_find(obj->tags, strlen(obj->tags), ZEND_STRL("batch"), &ref) || ref.len >= sizeof(key)) {
+		return NULL;
+	}
+	memcpy(key, ref.str, ref.len);
+	key[ref.len] = '\0';
+	if (SUCCESS != zend_hash_find(&obj->batches, key, ref.len + 1, (void *) &zb)) {
+		return NULL;
+	}
+	return *zb;
+}
+
+static inline void php_ircclient_batch_append(zval *zb, zval *zm)
+{
+	zval **zmessages;
+
+	if (SUCCESS == zend_hash_find(Z_ARRVAL_P(zb), ZEND_STRS("messages"), (void *) &zmessages)) {
+		add_next_index_zval(*zmessages, zm);
+	} else {
+		zval_ptr_dtor(&zm);
+	}
+}
+
+/* collect a message of an open batch instead of dispatching it */
+static int php_ircclient_session_batched(php_ircclient_session_object_t *obj, php_ircclient_event_t ev, const char *event, const char *origin, const char **params, unsigned int count TSRMLS_DC)
+{
+	zval *zb, *zm, *zt;
+
+	if (!(zb = php_ircclient_session_batch_of(obj))) {
+		return 0;
+	}
+
+	MAKE_STD_ZVAL(zm);
+	array_init_size(zm, 5);
+	add_assoc_stringl_ex(zm, ZEND_STRS("event"), (char *) php_ircclient_events[ev].str, php_ircclient_events[ev].len, 1);
+	add_assoc_string_ex(zm, ZEND_STRS("command"), (char *) event, 1);
+	add_assoc_zval_ex(zm, ZEND_STRS("origin"), php_ircclient_zval_origin(obj, origin));
+	add_assoc_zval_ex(zm, ZEND_STRS("params"), php_ircclient_zval_params(obj, params, count));
+	MAKE_STD_ZVAL(zt);
+	php_ircclient_tags_init(zt, obj->tags TSRMLS_CC);
+	add_assoc_zval_ex(zm, ZEND_STRS("tags"), zt);
+
+	php_ircclient_batch_append(zb, zm);
+	return 1;
+}
+
+/* BATCH +ref type [params...] opens, BATCH -ref closes a batch */
+static int php_ircclient_session_batch(php_ircclient_session_object_t *obj, const char *origin, const char **params, unsigned int count TSRMLS_DC)
+{
+	const char *ref;
+	zval *zb, **ztype, **zparams, **zmessages;
+	unsigned int i;
+
+	if (!count || !(obj->opts & PHP_IRCCLIENT_OPTION_BATCH)) {
+		return FAILURE;
+	}
+	ref = params[0];
+
+	if (*ref == '+') {
+		zval *zp, *zm, *parent;
+
+		if (count < 2 || !php_ircclient_session_listens(obj, PHP_IRCCLIENT_EVENT_BATCH TSRMLS_CC)) {
+			return FAILURE;
+		}
+
+		MAKE_STD_ZVAL(zb);
+		array_init_size(zb, 4);
+		add_assoc_string_ex(zb, ZEND_STRS("type"), (char *) params[1], 1);
+		MAKE_STD_ZVAL(zp);
+		array_init_size(zp, count - 2);
+		for (i = 2; i < count; ++i) {
+			add_next_index_string(zp, (char *) params[i], 1);
+		}
+		add_assoc_zval_ex(zb, ZEND_STRS("params"), zp);
+		MAKE_STD_ZVAL(zm);
+		array_init(zm);
+		add_assoc_zval_ex(zb, ZEND_STRS("messages"), zm);
+		add_assoc_zval_ex(zb, ZEND_STRS("origin"), php_ircclient_zval_origin(obj, origin));
+		if ((parent = php_ircclient_session_batch_of(obj))) {
+			/* nested; delivered as part of the enclosing one */
+			Z_ADDREF_P(zb);
+			php_ircclient_batch_append(parent, zb);
+		}
+		zend_hash_update(&obj->batches, ref + 1, strlen(ref + 1) + 1, (void *) &zb, sizeof(zval *), NULL);
+		return SUCCESS;
+	}
+
+	if (*ref == '-') {
+		zval **zbp;
+
+		if (SUCCESS != zend_hash_find(&obj->batches, ref + 1, strlen(ref + 1) + 1, (void *) &zbp)) {
+			return FAILURE;
+		}
+		zb = *zbp;
+		Z_ADDREF_P(zb);
+		zend_hash_del(&obj->batches, ref + 1, strlen(ref + 1) + 1);
+
+		/* a nested batch is still referenced by its parent's messages */
+		if (Z_REFCOUNT_P(zb) == 1
+		&&	SUCCESS == zend_hash_find(Z_ARRVAL_P(zb), ZEND_STRS("type"), (void *) &ztype)
+		&&	SUCCESS == zend_hash_find(Z_ARRVAL_P(zb), ZEND_STRS("params"), (void *) &zparams)
+		&&	SUCCESS == zend_hash_find(Z_ARRVAL_P(zb), ZEND_STRS("messages"), (void *) &zmessages)
+		) {
+			zval **argv[3];
+
+			argv[0] = ztype;
+			argv[1] = zparams;
+			argv[2] = zmessages;
+			php_ircclient_session_call(obj, PHP_IRCCLIENT_EVENT_BATCH, 3, argv TSRMLS_CC);
+		}
+		zval_ptr_dtor(&zb);
+		return SUCCESS;
+	}
+
+	return FAILURE;
+}
+
+static void php_ircclient_session_dispatch(php_ircclient_session_object_t *obj, php_ircclient_event_t ev, const char *event, const char *origin, const char **params, unsigned int count)
+{
+	zval *zo, *zp, *ze = NULL, **argv[3];
+	TSRMLS_FETCH_FROM_CTX(obj->ts);
+
+	++obj->stats.events[ev];
+	php_ircclient_trace(obj, ev, 0, origin, params, count);
+
+	if (ev == PHP_IRCCLIENT_EVENT_CONNECT) {
+		obj->motd = 1;
+		obj->reconnect.attempts = 0;
+	} else if (ev == PHP_IRCCLIENT_EVENT_UNKNOWN && event) {
+		if (!strcmp(event, "CAP")) {
+			php_ircclient_session_cap(obj, params, count);
+		} else if (!strcmp(event, "BATCH") && SUCCESS == php_ircclient_session_batch(obj, origin, params, count TSRMLS_CC)) {
+			return;
+		}
+	}
+
+	/* regardless of anybody listening */
+	php_ircclient_track(obj, ev, origin, params, count);
+	php_ircclient_reconnect_track(obj, ev, origin, params, count);
+
+	if (php_ircclient_session_batched(obj, ev, event, origin, params, count TSRMLS_CC)) {
+		return;
+	}
+	if (!php_ircclient_session_filter(obj, ev, params, count TSRMLS_CC)) {
+		return;
+	}
+
+	if (!php_ircclient_session_listens(obj, ev TSRMLS_CC)) {
+		return;
+	}
+
+	zo = php_ircclient_zval_origin(obj, origin);
+	zp = php_ircclient_session_params(obj, params, count TSRMLS_CC);
+
+	argv[0] = &zo;
+	argv[1] = &zp;
+
+	if (ev == PHP_IRCCLIENT_EVENT_UNKNOWN) {
+		/* there's no method per unknown command, so pass it on */
+		ze = php_ircclient_intern(obj, event);
+		argv[2] = &ze;
+		php_ircclient_session_call(obj, ev, 3, argv TSRMLS_CC);
+		zval_ptr_dtor(&ze);
+	} else {
+		php_ircclient_session_call(obj, ev, 2, argv TSRMLS_CC);
+	}
+
+	php_ircclient_session_params_dtor(obj, zp TSRMLS_CC);
+	zval_ptr_dtor(&zo);
+}
+
+#define PHP_IRCCLIENT_EVENT_CALLBACK(slot, ev) \
+static void php_ircclient_event_callback_ ##slot(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count) \
+{ \
+	php_ircclient_session_object_t *obj = irc_get_ctx(session); \
+	php_ircclient_capture(obj, PHP_IRCCLIENT_CAPTURE_EVENT + ev, event, origin, params, count); \
+	php_ircclient_stats_in(&obj->stats, origin, strlen(event), params, count); \
+	php_ircclient_session_dispatch(obj, ev, event, origin, params, count); \
+}
+
+PHP_IRCCLIENT_EVENT_CALLBACK(connect, PHP_IRCCLIENT_EVENT_CONNECT)
+PHP_IRCCLIENT_EVENT_CALLBACK(nick, PHP_IRCCLIENT_EVENT_NICK)
+PHP_IRCCLIENT_EVENT_CALLBACK(quit, PHP_IRCCLIENT_EVENT_QUIT)
+PHP_IRCCLIENT_EVENT_CALLBACK(join, PHP_IRCCLIENT_EVENT_JOIN)
+PHP_IRCCLIENT_EVENT_CALLBACK(part, PHP_IRCCLIENT_EVENT_PART)
+PHP_IRCCLIENT_EVENT_CALLBACK(mode, PHP_IRCCLIENT_EVENT_MODE)
+PHP_IRCCLIENT_EVENT_CALLBACK(umode, PHP_IRCCLIENT_EVENT_UMODE)
+PHP_IRCCLIENT_EVENT_CALLBACK(topic, PHP_IRCCLIENT_EVENT_TOPIC)
+PHP_IRCCLIENT_EVENT_CALLBACK(kick, PHP_IRCCLIENT_EVENT_KICK)
+PHP_IRCCLIENT_EVENT_CALLBACK(channel, PHP_IRCCLIENT_EVENT_CHANNEL)
+PHP_IRCCLIENT_EVENT_CALLBACK(privmsg, PHP_IRCCLIENT_EVENT_PRIVMSG)
+PHP_IRCCLIENT_EVENT_CALLBACK(notice, PHP_IRCCLIENT_EVENT_NOTICE)
+#if PHP_IRCCLIENT_HAVE_EVENT_CHANNEL_NOTICE
+PHP_IRCCLIENT_EVENT_CALLBACK(channel_notice, PHP_IRCCLIENT_EVENT_CHANNEL_NOTICE)
+#endif
+PHP_IRCCLIENT_EVENT_CALLBACK(invite, PHP_IRCCLIENT_EVENT_INVITE)
+PHP_IRCCLIENT_EVENT_CALLBACK(ctcp_req, PHP_IRCCLIENT_EVENT_CTCP_REQ)
+PHP_IRCCLIENT_EVENT_CALLBACK(ctcp_rep, PHP_IRCCLIENT_EVENT_CTCP_REP)
+PHP_IRCCLIENT_EVENT_CALLBACK(action, PHP_IRCCLIENT_EVENT_ACTION)
+
+static inline int php_ircclient_is_channel(const char *target)
+{
+	return target && *target && strchr("#&+!", *target);
+}
+
+/* libircclient doesn't know about IRCv3 message tags and takes "@tags" for the
+ * command, so that the rest of the line ends up in params; rebuild the line
+ * and route it the way libircclient would have */
+static void php_ircclient_session_tagged(php_ircclient_session_object_t *obj, const char *tags, const char **params, unsigned int count)
+{
+	php_ircclient_event_t ev = PHP_IRCCLIENT_EVENT_UNKNOWN;
+	php_ircclient_line_t line;
+	const char *argv[PHP_IRCCLIENT_LINE_PARAMS + 1];
+	char buf[1024 + 1], *prefix = NULL, *command;
+	unsigned int i, argc;
+	size_t len = 0;
+
+	if (count == 1 && strchr(params[0], ' ')) {
+		/* with a prefix, everything after its colon is one trailing param */
+		len = snprintf(buf, sizeof(buf), ":%s", params[0]);
+	} else {
+		for (i = 0; i < count && len < sizeof(buf); ++i) {
+			len += snprintf(buf + len, sizeof(buf) - len, !i ? "%s" : (i + 1 < count ? " %s" : " :%s"), params[i]);
+		}
+	}
+	if (len >= sizeof(buf)) {
+		len = sizeof(buf) - 1;
+	}
+	if (SUCCESS != php_ircclient_line_parse(&line, buf, len)) {
+		return;
+	}
+
+	/* each chunk is followed by a space or the end of the buffer */
+	if (line.prefix.str) {
+		prefix = (char *) line.prefix.str;
+		prefix[line.prefix.len] = '\0';
+	}
+	command = (char *) line.command.str;
+	command[line.command.len] = '\0';
+	for (argc = 0; argc < line.count; ++argc) {
+		argv[argc] = line.params[argc].str;
+		((char *) argv[argc])[line.params[argc].len] = '\0';
+	}
+	argv[argc] = NULL;
+
+	obj->tags = tags;
+
+	if (!strcmp(command, "PING")) {
+		const char *pong = argc ? argv[0] : "";
+
+		php_ircclient_session_send(obj, PHP_IRCCLIENT_SEND_QUIET, "PONG :%s", pong);
+	} else if (line.command.len == 3 && isdigit(command[0]) && isdigit(command[1]) && isdigit(command[2])) {
+		unsigned int code = atoi(command);
+
+		if ((code == 376 || code == 422) && !obj->motd) {
+			php_ircclient_session_dispatch(obj, PHP_IRCCLIENT_EVENT_CONNECT, "CONNECT", prefix, argv, argc);
+		}
+		php_ircclient_event_code_callback(obj->sess, code, prefix, argv, argc);
+	} else {
+		if (!strcmp(command, "NICK")) {
+			ev = PHP_IRCCLIENT_EVENT_NICK;
+		} else if (!strcmp(command, "QUIT")) {
+			ev = PHP_IRCCLIENT_EVENT_QUIT;
+		} else if (!strcmp(command, "JOIN")) {
+			ev = PHP_IRCCLIENT_EVENT_JOIN;
+		} else if (!strcmp(command, "PART")) {
+			ev = PHP_IRCCLIENT_EVENT_PART;
+		} else if (!strcmp(command, "MODE")) {
+			ev = php_ircclient_is_channel(argv[0]) ? PHP_IRCCLIENT_EVENT_MODE : PHP_IRCCLIENT_EVENT_UMODE;
+		} else if (!strcmp(command, "TOPIC")) {
+			ev = PHP_IRCCLIENT_EVENT_TOPIC;
+		} else if (!strcmp(command, "KICK")) {
+			ev = PHP_IRCCLIENT_EVENT_KICK;
+		} else if (!strcmp(command, "INVITE")) {
+			ev = PHP_IRCCLIENT_EVENT_INVITE;
+		} else if (!strcmp(command, "ERROR")) {
+			ev = PHP_IRCCLIENT_EVENT_ERROR;
+		} else if (!strcmp(command, "PRIVMSG") || !strcmp(command, "NOTICE")) {
+			int privmsg = *command == 'P';
+
+			if (argc < 2) {
+				goto done;
+			}
+			len = strlen(argv[1]);
+			if (len > 2 && argv[1][0] == '\001' && argv[1][len - 1] == '\001') {
+				char *ctcp = (char *) argv[1] + 1;
+
+				ctcp[len - 2] = '\0';
+				if (!privmsg) {
+					ev = PHP_IRCCLIENT_EVENT_CTCP_REP;
+				} else if (!strncasecmp(ctcp, "ACTION ", 7)) {
+					ev = PHP_IRCCLIENT_EVENT_ACTION;
+					command = "ACTION";
+					argv[1] = ctcp + 7;
+				} else {
+					/* including DCC requests; libircclient has no API to take them from outside */
+					ev = PHP_IRCCLIENT_EVENT_CTCP_REQ;
+				}
+				if (ev != PHP_IRCCLIENT_EVENT_ACTION) {
+					command = "CTCP";
+					argv[0] = ctcp;
+					argv[1] = NULL;
+					argc = 1;
+				}
+			} else if (!php_ircclient_is_channel(argv[0])) {
+				ev = privmsg ? PHP_IRCCLIENT_EVENT_PRIVMSG : PHP_IRCCLIENT_EVENT_NOTICE;
+			} else if (privmsg) {
+				ev = PHP_IRCCLIENT_EVENT_CHANNEL;
+			} else {
+#if PHP_IRCCLIENT_HAVE_EVENT_CHANNEL_NOTICE
+				ev = PHP_IRCCLIENT_EVENT_CHANNEL_NOTICE;
+#else
+				ev = PHP_IRCCLIENT_EVENT_NOTICE;
+#endif
+			}
+		} else if (!strcmp(command, "KILL")) {
+			/* ignored by libircclient, too */
+			goto done;
+		}
+		php_ircclient_session_dispatch(obj, ev, command, prefix, argv, argc);
+	}
+done:
+	obj->tags = NULL;
+}
+
+static void php_ircclient_event_callback_unknown(irc_session_t *session, const char *event, const char *origin, const char **params, unsigned int count)
+{
+	php_ircclient_session_object_t *obj = irc_get_ctx(session);
+	php_ircclient_event_t ev = PHP_IRCCLIENT_EVENT_UNKNOWN;
+
+	php_ircclient_capture(obj, PHP_IRCCLIENT_CAPTURE_EVENT + PHP_IRCCLIENT_EVENT_UNKNOWN, event, origin, params, count);
+	php_ircclient_stats_in(&obj->stats, origin, event ? strlen(event) : 0, params, count);
+
+	if (event && *event == '@' && count) {
+		php_ircclient_session_tagged(obj, event + 1, params, count);
+		return;
+	}
+	if (event && !strcmp(event, "ERROR")) {
+		ev = PHP_IRCCLIENT_EVENT_ERROR;
+	}
+	php_ircclient_session_dispatch(obj, ev, event, origin, params, count);
+}
+
+static zval *php_ircclient_aggregate_find(php_ircclient_session_object_t *obj, HashTable *ht, const char *name, int create)
+{
+	zval **zpp, *z;
+	char key[PHP_IRCCLIENT_KEY_SIZE];
+	size_t len = php_ircclient_casefold(obj, name, strlen(name), key);
+
+	if (SUCCESS == zend_hash_find(ht, key, len + 1, (void *) &zpp)) {
+		return *zpp;
+	}
+	if (!create) {
+		return NULL;
+	}
+	MAKE_STD_ZVAL(z);
+	array_init(z);
+	zend_hash_update(ht, key, len + 1, &z, sizeof(zval *), NULL);
+	return z;
+}
+
+/* hand the complete reply for name to the handler; empty if nothing was collected */
+static void php_ircclient_aggregate_done(php_ircclient_session_object_t *obj, php_ircclient_event_t ev, HashTable *ht, const char *name TSRMLS_DC)
+{
+	zval *zn, *zr = php_ircclient_aggregate_find(obj, ht, name, 1), **argv[2];
+	char key[PHP_IRCCLIENT_KEY_SIZE];
+	size_t len = php_ircclient_casefold(obj, name, strlen(name), key);
+
+	Z_ADDREF_P(zr);
+	zend_hash_del(ht, key, len + 1);
+
+	MAKE_STD_ZVAL(zn);
+	ZVAL_STRING(zn, estrdup(name), 0);
+
+	argv[0] = &zn;
+	argv[1] = &zr;
+	php_ircclient_session_call(obj, ev, 2, argv TSRMLS_CC);
+
+	zval_ptr_dtor(&zn);
+	zval_ptr_dtor(&zr);
+}
+
+static void php_ircclient_aggregate_names(php_ircclient_session_object_t *obj, const char *chan, const char *names)
+{
+	zval *zr = php_ircclient_aggregate_find(obj, &obj->aggregate.names, chan, 1);
+
+	while (*names) {
+		size_t len = strcspn(names, " "), plen = 0;
+
+		if (len) {
+			/* multi-prefix sends all of them */
+			while (plen < len && strchr(obj->isupport.prefix_chars, names[plen])) {
+				++plen;
+			}
+			if (plen < len) {
+				char *nick = estrndup(&names[plen], len - plen);
+
+				add_assoc_stringl_ex(zr, nick, len - plen + 1, estrndup(names, plen), plen, 0);
+				efree(nick);
+			}
+		}
+		names += len;
+		while (*names == ' ') {
+			++names;
+		}
+	}
+}
+
+static void php_ircclient_aggregate_whois(php_ircclient_session_object_t *obj, unsigned int event, const char **params, unsigned int count)
+{
+	zval *zr = php_ircclient_aggregate_find(obj, &obj->aggregate.whois, params[1], 1);
+
+	switch (event) {
+	case 311:
+		/* nick user host * :real */
+		if (count > 5) {
+			add_assoc_string_ex(zr, ZEND_STRS("user"), estrdup(params[2]), 0);
+			add_assoc_string_ex(zr, ZEND_STRS("host"), estrdup(params[3]), 0);
+			add_assoc_string_ex(zr, ZEND_STRS("real"), estrdup(params[5]), 0);
+		}
+		break;
+	case 312:
+		/* nick server :info */
+		if (count > 3) {
+			add_assoc_string_ex(zr, ZEND_STRS("server"), estrdup(params[2]), 0);
+			add_assoc_string_ex(zr, ZEND_STRS("server_info"), estrdup(params[3]), 0);
+		}
+		break;
+	case 313:
+		add_assoc_bool_ex(zr, ZEND_STRS("operator"), 1);
+		break;
+	case 317:
+		/* nick idle [signon] :seconds idle */
+		if (count > 3) {
+			add_assoc_long_ex(zr, ZEND_STRS("idle"), strtol(params[2], NULL, 10));
+		}
+		if (count > 4) {
+			add_assoc_long_ex(zr, ZEND_STRS("signon"), strtol(params[3], NULL, 10));
+		}
+		break;
+	case 319:
+		/* nick :@#chan +#chan ..., possibly more than one line */
+		if (count > 2) {
+			zval **zc, *zchans;
+			const char *chans = params[2];
+
+			if (SUCCESS == zend_hash_find(Z_ARRVAL_P(zr), ZEND_STRS("channels"), (void *) &zc)) {
+				zchans = *zc;
+			} else {
+				MAKE_STD_ZVAL(zchans);
+				array_init(zchans);
+				add_assoc_zval_ex(zr, ZEND_STRS("channels"), zchans);
+			}
+			while (*chans) {
+				size_t len = strcspn(chans, " ");
+
+				if (len) {
+					add_next_index_stringl(zchans, estrndup(chans, len), len, 0);
+				}
+				chans += len;
+				while (*chans == ' ') {
+					++chans;
+				}
+			}
+		}
+		break;
+	case 301:
+		if (count > 2) {
+			add_assoc_string_ex(zr, ZEND_STRS("away"), estrdup(params[2]), 0);
+		}
+		break;
+	default: {
+		/* e.g. RPL_WHOISACCOUNT, RPL_WHOISSECURE */
+		zval **ze, *zextra, *zp;
+		unsigned int i;
+
+		if (SUCCESS == zend_hash_find(Z_ARRVAL_P(zr), ZEND_STRS("extra"), (void *) &ze)) {
+			zextra = *ze;
+		} else {
+			MAKE_STD_ZVAL(zextra);
+			array_init(zextra);
+			add_assoc_zval_ex(zr, ZEND_STRS("extra"), zextra);
+		}
+		MAKE_STD_ZVAL(zp);
+		array_init_size(zp, count - 2);
+		for (i = 2; i < count; ++i) {
+			add_next_index_string(zp, estrdup(params[i]), 0);
+		}
+		add_index_zval(zextra, event, zp);
+		break;
+	}
+	}
+}
+
+/* collect multi-line replies; returns 1 if the numeric was consumed */
+static int php_ircclient_session_aggregate(php_ircclient_session_object_t *obj, unsigned int event, const char **params, unsigned int count TSRMLS_DC)
+{
+	switch (event) {
+	case 353:
+		/* nick [=*@] channel :names */
+		if (count < 3 || !php_ircclient_session_listens(obj, PHP_IRCCLIENT_EVENT_NAMES TSRMLS_CC)) {
+			return 0;
+		}
+		php_ircclient_aggregate_names(obj, params[count - 2], params[count - 1]);
+		return 1;
+	case 366:
+		if (count < 2 || !php_ircclient_session_listens(obj, PHP_IRCCLIENT_EVENT_NAMES TSRMLS_CC)) {
+			return 0;
+		}
+		php_ircclient_aggregate_done(obj, PHP_IRCCLIENT_EVENT_NAMES, &obj->aggregate.names, params[1] TSRMLS_CC);
+		return 1;
+
+	case 301:
+		/* also sent in reply to a PRIVMSG to somebody away */
+		if (count < 2 || !php_ircclient_aggregate_find(obj, &obj->aggregate.whois, params[1], 0)) {
+			return 0;
+		}
+		/* no break */
+	case 307: case 311: case 312: case 313: case 317: case 319: case 320:
+	case 330: case 338: case 378: case 379: case 671:
+		if (count < 2 || !php_ircclient_session_listens(obj, PHP_IRCCLIENT_EVENT_WHOIS TSRMLS_CC)) {
+			return 0;
+		}
+		php_ircclient_aggregate_whois(obj, event, params, count);
+		return 1;
+	case 318:
+		if (count < 2 || !php_ircclient_session_listens(obj, PHP_IRCCLIENT_EVENT_WHOIS TSRMLS_CC)) {
+			return 0;
+		}
+		php_ircclient_aggregate_done(obj, PHP_IRCCLIENT_EVENT_WHOIS, &obj->aggregate.whois, params[1] TSRMLS_CC);
+		return 1;
+
+	case 321:
+	case 322:
+		if (!php_ircclient_session_listens(obj, PHP_IRCCLIENT_EVENT_LIST TSRMLS_CC)) {
+			return 0;
+		}
+		if (!obj->aggregate.list) {
+			MAKE_STD_ZVAL(obj->aggregate.list);
+			array_init(obj->aggregate.list);
+		}
+		/* nick channel users :topic */
+		if (event == 322 && count > 3) {
+			zval *zc;
+
+			MAKE_STD_ZVAL(zc);
+			array_init_size(zc, 2);
+			add_assoc_long_ex(zc, ZEND_STRS("users"), strtol(params[2], NULL, 10));
+			add_assoc_string_ex(zc, ZEND_STRS("topic"), estrdup(params[3]), 0);
+			add_assoc_zval_ex(obj->aggregate.list, params[1], strlen(params[1]) + 1, zc);
+		}
+		return 1;
+	case 323:
+		if (!php_ircclient_session_listens(obj, PHP_IRCCLIENT_EVENT_LIST TSRMLS_CC)) {
+			return 0;
+		} else {
+			zval *zl = obj->aggregate.list, **argv[1];
+
+			obj->aggregate.list = NULL;
+			if (!zl) {
+				MAKE_STD_ZVAL(zl);
+				array_init(zl);
+			}
+			argv[0] = &zl;
+			php_ircclient_session_call(obj, PHP_IRCCLIENT_EVENT_LIST, 1, argv TSRMLS_CC);
+			zval_ptr_dtor(&zl);
+		}
+		return 1;
+
+	case 367:
+		/* nick channel mask [by time] */
+		if (count < 3 || !php_ircclient_session_listens(obj, PHP_IRCCLIENT_EVENT_BANLIST TSRMLS_CC)) {
+			return 0;
+		} else {
+			zval *zb, *zr = php_ircclient_aggregate_find(obj, &obj->aggregate.bans, params[1], 1);
+
+			MAKE_STD_ZVAL(zb);
+			array_init_size(zb, 3);
+			add_assoc_string_ex(zb, ZEND_STRS("mask"), estrdup(params[2]), 0);
+			if (count > 4) {
+				add_assoc_string_ex(zb, ZEND_STRS("by"), estrdup(params[3]), 0);
+				add_assoc_long_ex(zb, ZEND_STRS("time"), strtol(params[4], NULL, 10));
+			}
+			add_next_index_zval(zr, zb);
+		}
+		return 1;
+	case 368:
+		if (count < 2 || !php_ircclient_session_listens(obj, PHP_IRCCLIENT_EVENT_BANLIST TSRMLS_CC)) {
+			return 0;
+		}
+		php_ircclient_aggregate_done(obj, PHP_IRCCLIENT_EVENT_BANLIST, &obj->aggregate.bans, params[1] TSRMLS_CC);
+		return 1;
+	}
+	return 0;
+}
+
+static void php_ircclient_event_code_callback(irc_session_t *session, unsigned int event, const char *origin, const char **params, unsigned int count)
+{
+	php_ircclient_session_object_t *obj = irc_get_ctx(session);
+	TSRMLS_FETCH_FROM_CTX(obj->ts);
+
+	/* a tagged line was captured and counted as such already */
+	if (!obj->tags) {
+		php_ircclient_capture(obj, event, NULL, origin, params, count);
+		php_ircclient_stats_in(&obj->stats, origin, 3, params, count);
+	}
+	++obj->stats.events[PHP_IRCCLIENT_EVENT_NUMERIC];
+	php_ircclient_trace(obj, PHP_IRCCLIENT_EVENT_NUMERIC, event, origin, params, count);
+
+	if (event == 5) {
+		php_ircclient_session_isupport(obj, params, count);
+	}
+	if (obj->opts & PHP_IRCCLIENT_OPTION_TRACK_STATE) {
+		php_ircclient_track_numeric(obj, event, params, count);
+	}
+	if ((obj->opts & PHP_IRCCLIENT_OPTION_AGGREGATE) && php_ircclient_session_aggregate(obj, event, params, count TSRMLS_CC)) {
+		return;
+	}
+	if (!php_ircclient_session_filter(obj, PHP_IRCCLIENT_EVENT_NUMERIC, params, count TSRMLS_CC)) {
+		return;
+	}
+
+	if (php_ircclient_session_listens(obj, PHP_IRCCLIENT_EVENT_NUMERIC TSRMLS_CC)) {
+		zval *zo, *ze, *zp, **argv[3];
+
+		zo = php_ircclient_zval_origin(obj, origin);
+		MAKE_STD_ZVAL(ze);
+		ZVAL_LONG(ze, event);
+		zp = php_ircclient_session_params(obj, params, count TSRMLS_CC);
+
+		argv[0] = &zo;
+		argv[1] = &ze;
+		argv[2] = &zp;
+		php_ircclient_session_call(obj, PHP_IRCCLIENT_EVENT_NUMERIC, 3, argv TSRMLS_CC);
+
+		php_ircclient_session_params_dtor(obj, zp TSRMLS_CC);
+		zval_ptr_dtor(&ze);
+		zval_ptr_dtor(&zo);
+	}
+}
+
+static php_ircclient_dcc_t *php_ircclient_dcc_add(php_ircclient_session_object_t *obj, irc_dcc_t id, int chat, zend_fcall_info *fci, zend_fcall_info_cache *fcc);
+
+/* remember the kind of a request for Session::dccAccept(); libircclient times
+ * out unanswered ones without telling, so decline the oldest of too many */
+static void php_ircclient_dcc_request(php_ircclient_session_object_t *obj, irc_dcc_t id, int chat)
+{
+	php_ircclient_dcc_t *dcc;
+	HashPosition pos;
+	ulong oldest = 0;
+	unsigned pending = 0;
+
+	for (	zend_hash_internal_pointer_reset_ex(&obj->dcc, &pos);
+			SUCCESS == zend_hash_get_current_data_ex(&obj->dcc, (void *) &dcc, &pos);
+			zend_hash_move_forward_ex(&obj->dcc, &pos)
+	) {
+		if (dcc->pending && !pending++) {
+			zend_hash_get_current_key_ex(&obj->dcc, NULL, NULL, &oldest, 0, &pos);
+		}
+	}
+	if (pending >= PHP_IRCCLIENT_DCC_REQUESTS) {
+		zend_hash_index_del(&obj->dcc, oldest);
+		irc_dcc_decline(obj->sess, oldest);
+	}
+	php_ircclient_dcc_add(obj, id, chat, NULL, NULL)->pending = 1;
+}
+
+static void php_ircclient_event_dcc_chat_callback(irc_session_t *session, const char *nick, const char *addr, irc_dcc_t dccid)
+{
+	php_ircclient_session_object_t *obj = irc_get_ctx(session);
+	TSRMLS_FETCH_FROM_CTX(obj->ts);
+
+	++obj->stats.events[PHP_IRCCLIENT_EVENT_DCC_CHAT_REQ];
+	php_ircclient_dcc_request(obj, dccid, 1);
+	php_ircclient_trace(obj, PHP_IRCCLIENT_EVENT_DCC_CHAT_REQ, 0, nick, NULL, 0);
+
+	if (php_ircclient_session_listens(obj, PHP_IRCCLIENT_EVENT_DCC_CHAT_REQ TSRMLS_CC)) {
+		zval *zn, *za, *zd, **argv[3];
+
+		MAKE_STD_ZVAL(zn);
+		ZVAL_STRING(zn, estrdup(nick), 0);
+		MAKE_STD_ZVAL(za);
+		ZVAL_STRING(za, estrdup(addr), 0);
+		MAKE_STD_ZVAL(zd);
+		ZVAL_LONG(zd, dccid);
+
+		argv[0] = &zn;
+		argv[1] = &za;
+		argv[2] = &zd;
+		php_ircclient_session_call(obj, PHP_IRCCLIENT_EVENT_DCC_CHAT_REQ, 3, argv TSRMLS_CC);
+
+		zval_ptr_dtor(&zd);
+		zval_ptr_dtor(&za);
+		zval_ptr_dtor(&zn);
+	}
+}
+
+static void php_ircclient_event_dcc_send_callback(irc_session_t *session, const char *nick, const char *addr, const char *filename, unsigned long size, irc_dcc_t dccid)
+{
+	php_ircclient_session_object_t *obj = irc_get_ctx(session);
+	TSRMLS_FETCH_FROM_CTX(obj->ts);
+
+	++obj->stats.events[PHP_IRCCLIENT_EVENT_DCC_SEND_REQ];
+	php_ircclient_dcc_request(obj, dccid, 0);
+	php_ircclient_trace(obj, PHP_IRCCLIENT_EVENT_DCC_SEND_REQ, 0, nick, &filename, 1);
+
+	if (php_ircclient_session_listens(obj, PHP_IRCCLIENT_EVENT_DCC_SEND_REQ TSRMLS_CC)) {
+		zval *zn, *za, *zf, *zs, *zd, **argv[5];
+
+		MAKE_STD_ZVAL(zn);
+		ZVAL_STRING(zn, estrdup(nick), 0);
+		MAKE_STD_ZVAL(za);
+		ZVAL_STRING(za, estrdup(addr), 0);
+		MAKE_STD_ZVAL(zf);
+		ZVAL_STRING(zf, estrdup(filename), 0);
+		MAKE_STD_ZVAL(zs);
+		ZVAL_LONG(zs, size);
+		MAKE_STD_ZVAL(zd);
+		ZVAL_LONG(zd, dccid);
+
+		argv[0] = &zn;
+		argv[1] = &za;
+		argv[2] = &zf;
+		argv[3] = &zs;
+		argv[4] = &zd;
+		php_ircclient_session_call(obj, PHP_IRCCLIENT_EVENT_DCC_SEND_REQ, 5, argv TSRMLS_CC);
+
+		zval_ptr_dtor(&zd);
+		zval_ptr_dtor(&zs);
+		zval_ptr_dtor(&zf);
 		zval_ptr_dtor(&za);
 		zval_ptr_dtor(&zn);
 	}
 }
 
-ZEND_BEGIN_ARG_INFO_EX(ai_Session___construct, 0, 0, 0)
-	ZEND_ARG_INFO(0, nick)
-	ZEND_ARG_INFO(0, user)
-	ZEND_ARG_INFO(0, real)
+static inline php_stream *php_ircclient_dcc_stream(php_ircclient_dcc_t *dcc TSRMLS_DC)
+{
+	return dcc->stream = php_ircclient_stream(dcc->zstream TSRMLS_CC);
+}
+
+/* plain files report errors as (size_t) -1 */
+static inline size_t php_ircclient_dcc_put(php_stream *s, const char *buf, size_t len TSRMLS_DC)
+{
+	size_t n = php_stream_write(s, buf, len);
+
+	return n > len ? 0 : n;
+}
+
+/* write as much of the ring buffer as the stream takes */
+static int php_ircclient_dcc_flush(php_ircclient_dcc_t *dcc, int block TSRMLS_DC)
+{
+	int blocking = -1;
+
+	if (block) {
+		blocking = php_stream_set_option(dcc->stream, PHP_STREAM_OPTION_BLOCKING, 1, NULL);
+	}
+	while (dcc->len) {
+		size_t n = php_ircclient_dcc_put(dcc->stream, dcc->ring + dcc->head, MIN(dcc->len, dcc->size - dcc->head) TSRMLS_CC);
+
+		if (!n) {
+			break;
+		}
+		dcc->written += n;
+		dcc->head = (dcc->head + n) % dcc->size;
+		dcc->len -= n;
+	}
+	if (blocking == 0) {
+		php_stream_set_option(dcc->stream, PHP_STREAM_OPTION_BLOCKING, 0, NULL);
+	}
+	return dcc->len ? FAILURE : SUCCESS;
+}
+
+static int php_ircclient_dcc_write(php_ircclient_dcc_t *dcc, irc_dcc_t id, const char *data, size_t len TSRMLS_DC)
+{
+	size_t tail, n;
+
+	dcc->received += len;
+
+	/* straight to the stream, unless there is older data */
+	if (dcc->len) {
+		php_ircclient_dcc_flush(dcc, 0 TSRMLS_CC);
+	}
+	if (!dcc->len) {
+		n = php_ircclient_dcc_put(dcc->stream, data, len TSRMLS_CC);
+		dcc->written += n;
+		data += n;
+		len -= n;
+	}
+	if (!len) {
+		return SUCCESS;
+	}
+
+	/* the sender could not be held back, see php_ircclient_session_dcc_descriptors() */
+	if (len > dcc->size - dcc->len && SUCCESS != php_ircclient_dcc_flush(dcc, 1 TSRMLS_CC)) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "DCC %u: could not write to stream", id);
+		return FAILURE;
+	}
+
+	tail = (dcc->head + dcc->len) % dcc->size;
+	n = MIN(len, dcc->size - tail);
+	memcpy(dcc->ring + tail, data, n);
+	memcpy(dcc->ring, data + n, len - n);
+	dcc->len += len;
+	return SUCCESS;
+}
+
+/* data of an accepted DCC SEND or a DCC CHAT line, the progress of a file
+ * we send, the end of a transfer with neither data nor length, a DCC CHAT
+ * being established the same way, or the end of either with a non-zero
+ * status */
+static void php_ircclient_dcc_callback(irc_session_t *session, irc_dcc_t id, int status, void *ctx, const char *data, unsigned int length)
+{
+	php_ircclient_session_object_t *obj = irc_get_ctx(session);
+	php_ircclient_dcc_t *dcc;
+	zval *zcb, *zi, *zs, *zd, *zl, **argv[4], *retval = NULL;
+	zend_fcall_info fci;
+	zend_fcall_info_cache fcc;
+	int done;
+	TSRMLS_FETCH_FROM_CTX(obj->ts);
+
+	if (SUCCESS != zend_hash_index_find(&obj->dcc, id, (void *) &dcc)) {
+		return;
+	}
+	done = status || (!dcc->chat && !data && !length);
+	if (dcc->zstream) {
+		int failed = 0;
+
+		if (!php_ircclient_dcc_stream(dcc TSRMLS_CC)) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "DCC %u: stream was closed", id);
+			failed = 1;
+		} else if (!status && data && length) {
+			if (SUCCESS == php_ircclient_dcc_write(dcc, id, data, length TSRMLS_CC)) {
+				return;
+			}
+			failed = 1;
+		} else if (dcc->len && SUCCESS != php_ircclient_dcc_flush(dcc, 1 TSRMLS_CC)) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "DCC %u: could not write to stream", id);
+			failed = 1;
+		}
+		/* rather than leaving a corrupt file behind a successful transfer */
+		if (failed && !status) {
+			if (data) {
+				irc_dcc_destroy(obj->sess, id);
+			}
+			status = LIBIRC_ERR_WRITE;
+		}
+		/* the end; report the total instead */
+		data = NULL;
+		length = dcc->received;
+		done = 1;
+	}
+	if (!dcc->zcb) {
+		if (done) {
+			zend_hash_index_del(&obj->dcc, id);
+		}
+		return;
+	}
+
+	/* the handler might call Session::dccDestroy() */
+	zcb = dcc->zcb;
+	Z_ADDREF_P(zcb);
+	fci = dcc->fci;
+	fcc = dcc->fcc;
+
+	MAKE_STD_ZVAL(zi);
+	ZVAL_LONG(zi, id);
+	MAKE_STD_ZVAL(zs);
+	ZVAL_LONG(zs, status);
+	MAKE_STD_ZVAL(zd);
+	if (data) {
+		ZVAL_STRINGL(zd, data, length, 1);
+	} else {
+		ZVAL_NULL(zd);
+	}
+	MAKE_STD_ZVAL(zl);
+	ZVAL_LONG(zl, length);
+
+	argv[0] = &zi;
+	argv[1] = &zs;
+	argv[2] = &zd;
+	argv[3] = &zl;
+	fci.retval_ptr_ptr = &retval;
+	fci.param_count = 4;
+	fci.params = argv;
+
+	zend_call_function(&fci, &fcc TSRMLS_CC);
+
+	if (retval) {
+		zval_ptr_dtor(&retval);
+	}
+	zval_ptr_dtor(&zl);
+	zval_ptr_dtor(&zd);
+	zval_ptr_dtor(&zs);
+	zval_ptr_dtor(&zi);
+	zval_ptr_dtor(&zcb);
+
+	/* libircclient is done with it */
+	if (done) {
+		zend_hash_index_del(&obj->dcc, id);
+	}
+}
+
+/* wait for streams to take buffered data, and stop reading DCC data while
+ * a buffer is about full, so that TCP holds the sender back */
+static void php_ircclient_session_dcc_descriptors(php_ircclient_session_object_t *obj, fd_set *i, fd_set *o, int *max TSRMLS_DC)
+{
+	php_ircclient_dcc_t *dcc;
+	HashPosition pos;
+	int fd, full = 0;
+
+	for (	zend_hash_internal_pointer_reset_ex(&obj->dcc, &pos);
+			SUCCESS == zend_hash_get_current_data_ex(&obj->dcc, (void *) &dcc, &pos);
+			zend_hash_move_forward_ex(&obj->dcc, &pos)
+	) {
+		if (!dcc->len || !php_ircclient_dcc_stream(dcc TSRMLS_CC)) {
+			continue;
+		}
+		if (SUCCESS != php_ircclient_dcc_flush(dcc, 0 TSRMLS_CC)
+		&&	SUCCESS == php_stream_cast(dcc->stream, PHP_STREAM_AS_FD_FOR_SELECT|PHP_STREAM_CAST_INTERNAL, (void *) &fd, 1) && fd != -1
+		) {
+			PHP_SAFE_FD_SET(fd, o);
+			if (*max < fd) {
+				*max = fd;
+			}
+		}
+		if (dcc->size - dcc->len < PHP_IRCCLIENT_DCC_CHUNK) {
+			/* without knowing which socket is the server's, wait for the stream */
+			if (obj->sock == -1) {
+				php_ircclient_dcc_flush(dcc, 1 TSRMLS_CC);
+			} else {
+				full = 1;
+			}
+		}
+	}
+
+	/* all of this session's, libircclient does not tell which socket is which DCC */
+	if (full) {
+		for (fd = 0; fd <= *max; ++fd) {
+			if (fd != obj->sock && PHP_SAFE_FD_ISSET(fd, i)) {
+				PHP_SAFE_FD_CLR(fd, i);
+			}
+		}
+	}
+}
+
+static void php_ircclient_session_dcc_flush(php_ircclient_session_object_t *obj TSRMLS_DC)
+{
+	php_ircclient_dcc_t *dcc;
+	HashPosition pos;
+
+	for (	zend_hash_internal_pointer_reset_ex(&obj->dcc, &pos);
+			SUCCESS == zend_hash_get_current_data_ex(&obj->dcc, (void *) &dcc, &pos);
+			zend_hash_move_forward_ex(&obj->dcc, &pos)
+	) {
+		if (dcc->len && php_ircclient_dcc_stream(dcc TSRMLS_CC)) {
+			php_ircclient_dcc_flush(dcc, 0 TSRMLS_CC);
+		}
+	}
+}
+
+/* chat < 0 keeps what the request said, see php_ircclient_event_dcc_chat_callback() */
+static php_ircclient_dcc_t *php_ircclient_dcc_add(php_ircclient_session_object_t *obj, irc_dcc_t id, int chat, zend_fcall_info *fci, zend_fcall_info_cache *fcc)
+{
+	php_ircclient_dcc_t dcc, *ptr = NULL;
+
+	if (chat < 0) {
+		chat = SUCCESS == zend_hash_index_find(&obj->dcc, id, (void *) &ptr) && ptr->chat;
+	}
+	PHP_IRCCLIENT_EPOLL_RENEW(obj);
+	memset(&dcc, 0, sizeof(dcc));
+	dcc.chat = chat;
+	if (fci) {
+		dcc.zcb = fci->function_name;
+		Z_ADDREF_P(dcc.zcb);
+		dcc.fci = *fci;
+		dcc.fcc = *fcc;
+	}
+	zend_hash_index_update(&obj->dcc, id, (void *) &dcc, sizeof(dcc), (void *) &ptr);
+	return ptr;
+}
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Session___construct, 0, 0, 0)
+	ZEND_ARG_INFO(0, nick)
+	ZEND_ARG_INFO(0, user)
+	ZEND_ARG_INFO(0, real)
+ZEND_END_ARG_INFO()
+/* {{{ proto void Session::__construct([string nick[, string user[, string real]]]) */
+PHP_METHOD(Session, __construct)
+{
+	char *nick_str = NULL, *user_str = NULL, *real_str = NULL;
+	int nick_len = 0, user_len = 0, real_len = 0;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "|s!s!s!", &nick_str, &nick_len, &user_str, &user_len, &real_str, &real_len)) {
+		if (nick_str && nick_len) {
+			zend_update_property_stringl(php_ircclient_session_class_entry, getThis(), ZEND_STRL("nick"), nick_str, nick_len TSRMLS_CC);
+		}
+		if (nick_str && nick_len) {
+			zend_update_property_stringl(php_ircclient_session_class_entry, getThis(), ZEND_STRL("nick"), nick_str, nick_len TSRMLS_CC);
+		}
+		if (real_str && real_len) {
+			zend_update_property_stringl(php_ircclient_session_class_entry, getThis(), ZEND_STRL("real"), real_str, real_len TSRMLS_CC);
+		}
+	}
+}
+/* }}} */
+
+/* libircclient does not tell its socket, but it is the only one waiting
+ * for the connection to complete right after irc_connect() */
+static void php_ircclient_session_sock(php_ircclient_session_object_t *obj)
+{
+	fd_set i, o;
+	int fd, max = 0;
+
+	obj->sock = -1;
+
+	FD_ZERO(&i);
+	FD_ZERO(&o);
+	if (0 != irc_add_select_descriptors(obj->sess, &i, &o, &max)) {
+		return;
+	}
+	for (fd = 0; fd <= max; ++fd) {
+		if (FD_ISSET(fd, &o)) {
+			if (obj->sock != -1) {
+				obj->sock = -1;
+				return;
+			}
+			obj->sock = fd;
+		}
+	}
+}
+
+static int php_ircclient_session_connect(php_ircclient_session_object_t *obj, zval *zobject, zend_bool ip6, const char *server_str, long port, const char *passwd_str TSRMLS_DC)
+{
+	char *nick = NULL, *user = NULL, *real = NULL;
+	zval *znick, *zuser, *zreal;
+	int rv = SUCCESS;
+
+	PHP_IRCCLIENT_EPOLL_RENEW(obj);
+
+	znick = zend_read_property(php_ircclient_session_class_entry, zobject, ZEND_STRL("nick"), 0 TSRMLS_CC);
+	SEPARATE_ARG_IF_REF(znick);
+	convert_to_string_ex(&znick);
+	if (Z_STRLEN_P(znick)) {
+		nick = Z_STRVAL_P(znick);
+	}
+	zuser = zend_read_property(php_ircclient_session_class_entry, zobject, ZEND_STRL("user"), 0 TSRMLS_CC);
+	SEPARATE_ARG_IF_REF(zuser);
+	convert_to_string_ex(&zuser);
+	if (Z_STRLEN_P(zuser)) {
+		user = Z_STRVAL_P(zuser);
+	}
+	zreal = zend_read_property(php_ircclient_session_class_entry, zobject, ZEND_STRL("real"), 0 TSRMLS_CC);
+	SEPARATE_ARG_IF_REF(zreal);
+	convert_to_string_ex(&zreal);
+	if (Z_STRLEN_P(zreal)) {
+		real = Z_STRVAL_P(zreal);
+	}
+
+	obj->cap.pending = !!(obj->opts & (PHP_IRCCLIENT_OPTION_MESSAGE_TAGS|PHP_IRCCLIENT_OPTION_BATCH));
+	obj->cap.negotiating = 0;
+	zend_hash_clean(&obj->cap.available);
+	zend_hash_clean(&obj->cap.enabled);
+	zend_hash_clean(&obj->batches);
+	obj->motd = 0;
+
+	/* might be another network */
+	php_ircclient_isupport_reset(obj);
+	php_ircclient_track_clear(obj);
+	php_ircclient_aggregate_clear(obj);
+
+	if (ip6) {
+		if (0 != irc_connect6(obj->sess, server_str, port, passwd_str, nick, user, real)) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
+			rv = FAILURE;
+		}
+	} else if (0 != irc_connect(obj->sess, server_str, port, passwd_str, nick, user, real)) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
+		rv = FAILURE;
+	}
+	php_ircclient_session_sock(obj);
+
+	zval_ptr_dtor(&znick);
+	zval_ptr_dtor(&zuser);
+	zval_ptr_dtor(&zreal);
+
+	return rv;
+}
+
+/* seconds until the next reconnect attempt, growing exponentially */
+static double php_ircclient_reconnect_backoff(php_ircclient_session_object_t *obj TSRMLS_DC)
+{
+	double delay = obj->reconnect.delay;
+	long i;
+
+	for (i = 1; i < obj->reconnect.attempts && delay < obj->reconnect.max_delay; ++i) {
+		delay *= 2;
+	}
+	if (delay > obj->reconnect.max_delay) {
+		delay = obj->reconnect.max_delay;
+	}
+	/* so that a netsplit does not bring everybody back at once */
+	return delay * (1.0 + obj->reconnect.jitter * (2.0 * php_combined_lcg(TSRMLS_C) - 1.0));
+}
+
+/* the connection is gone; returns SUCCESS if another attempt is scheduled */
+static int php_ircclient_session_lost(php_ircclient_session_object_t *obj TSRMLS_DC)
+{
+	if (!obj->reconnect.max || obj->reconnect.quit || !obj->reconnect.host) {
+		return FAILURE;
+	}
+	if (obj->reconnect.due) {
+		return SUCCESS;
+	}
+	if (obj->reconnect.max > 0 && obj->reconnect.attempts >= obj->reconnect.max) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "giving up after %ld reconnect attempts", obj->reconnect.attempts);
+		obj->reconnect.quit = 1;
+		return FAILURE;
+	}
+	if (!obj->reconnect.attempts) {
+		/* what we were on, unless joined again from onConnect */
+		php_ircclient_rejoin_move(&obj->reconnect.channels, &obj->reconnect.rejoin);
+	}
+	++obj->reconnect.attempts;
+	obj->reconnect.due = php_ircclient_now() + php_ircclient_reconnect_backoff(obj TSRMLS_CC);
+
+	/* whatever is left of it */
+	irc_disconnect(obj->sess);
+	obj->sock = -1;
+	return SUCCESS;
+}
+
+/* connect to the next server of the rotation, if an attempt is due */
+static void php_ircclient_session_reconnect(php_ircclient_session_object_t *obj TSRMLS_DC)
+{
+	const char *host = obj->reconnect.host;
+	char *tmp = NULL;
+	long port = obj->reconnect.port;
+	zend_bool ip6 = obj->reconnect.ip6;
+	long n = obj->reconnect.servers ? zend_hash_num_elements(Z_ARRVAL_P(obj->reconnect.servers)) : 0;
+
+	if (!obj->reconnect.due || php_ircclient_now() < obj->reconnect.due || !obj->zthis) {
+		return;
+	}
+	obj->reconnect.due = 0;
+
+	if (n && (obj->reconnect.server %= n + 1)) {
+		zval **zs;
+
+		zend_hash_internal_pointer_reset(Z_ARRVAL_P(obj->reconnect.servers));
+		for (n = 1; n < obj->reconnect.server; ++n) {
+			zend_hash_move_forward(Z_ARRVAL_P(obj->reconnect.servers));
+		}
+		if (SUCCESS == zend_hash_get_current_data(Z_ARRVAL_P(obj->reconnect.servers), (void *) &zs)) {
+			/* host, host:port, [ip6] or [ip6]:port */
+			char *colon;
+
+			host = tmp = estrndup(Z_STRVAL_PP(zs), Z_STRLEN_PP(zs));
+			if (*tmp == '[' && (colon = strchr(tmp, ']'))) {
+				*colon++ = '\0';
+				++host;
+				ip6 = 1;
+				colon = *colon == ':' ? colon : NULL;
+			} else {
+				colon = strrchr(tmp, ':');
+				ip6 = 0;
+			}
+			if (colon) {
+				*colon++ = '\0';
+				port = strtol(colon, NULL, 10);
+			}
+		}
+	}
+	++obj->reconnect.server;
+
+	irc_disconnect(obj->sess);
+	if (SUCCESS != php_ircclient_session_connect(obj, obj->zthis, ip6, host, port, obj->reconnect.passwd TSRMLS_CC)) {
+		php_ircclient_session_lost(obj TSRMLS_CC);
+	}
+	STR_FREE(tmp);
+}
+
+/* seconds until the next reconnect attempt is due, if any */
+static inline double php_ircclient_reconnect_timeout(php_ircclient_session_object_t *obj, double to)
+{
+	if (obj->reconnect.due) {
+		double delay = obj->reconnect.due - php_ircclient_now();
+
+		return delay < 0 ? 0 : (delay < to ? delay : to);
+	}
+	return to;
+}
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_doConnect, 0, 0, 2)
+	ZEND_ARG_INFO(0, ip6)
+	ZEND_ARG_INFO(0, host)
+	ZEND_ARG_INFO(0, port)
+	ZEND_ARG_INFO(0, password)
+ZEND_END_ARG_INFO()
+/* {{{ proto bool Session::doConnect(bool ip6, string host[, int port[, string password]])
+	Returns TRUE when the command was sent successfully. */
+PHP_METHOD(Session, doConnect)
+{
+	char *server_str, *passwd_str = NULL;
+	int server_len, passwd_len = 0;
+	long port = 6667;
+	zend_bool ip6;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "bs|ls!", &ip6, &server_str, &server_len, &port, &passwd_str, &passwd_len)) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+
+		/* remembered for Session::setReconnect() */
+		STR_FREE(obj->reconnect.host);
+		STR_FREE(obj->reconnect.passwd);
+		obj->reconnect.host = estrndup(server_str, server_len);
+		obj->reconnect.passwd = passwd_str ? estrndup(passwd_str, passwd_len) : NULL;
+		obj->reconnect.port = port;
+		obj->reconnect.ip6 = ip6;
+		obj->reconnect.server = 0;
+		obj->reconnect.attempts = 0;
+		obj->reconnect.due = 0;
+		obj->reconnect.quit = 0;
+		zend_hash_clean(&obj->reconnect.channels);
+		zend_hash_clean(&obj->reconnect.rejoin);
+
+		RETVAL_BOOL(SUCCESS == php_ircclient_session_connect(obj, getThis(), ip6, server_str, port, passwd_str TSRMLS_CC));
+	}
+}
+/* }}} */
+
+/* {{{ proto bool Session::isConnected() */
+PHP_METHOD(Session, isConnected)
+{
+	if (SUCCESS == zend_parse_parameters_none()) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+
+		RETURN_BOOL(irc_is_connected(obj->sess));
+	}
+}
+/* }}} */
+
+/* {{{ proto void Session::disconnect()
+	Discards anything still waiting in the send queue. */
+PHP_METHOD(Session, disconnect)
+{
+	if (SUCCESS == zend_parse_parameters_none()) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+
+		irc_disconnect(obj->sess);
+		obj->sock = -1;
+		obj->reconnect.quit = 1;
+		obj->reconnect.due = 0;
+		php_ircclient_queue_dtor(&obj->queue);
+		php_ircclient_track_clear(obj);
+		php_ircclient_aggregate_clear(obj);
+		zend_hash_clean(&obj->batches);
+	}
+}
+/* }}} */
+
+static void php_ircclient_fds_add(HashTable *fds, fd_set *set, int *max, int cast TSRMLS_DC)
+{
+	zval **zfd;
+
+	for (	zend_hash_internal_pointer_reset(fds);
+			SUCCESS == zend_hash_get_current_data(fds, (void *) &zfd);
+			zend_hash_move_forward(fds)
+	) {
+		if (Z_TYPE_PP(zfd) == IS_RESOURCE) {
+			php_stream *s = NULL;
+			int fd = -1;
+
+			php_stream_from_zval_no_verify(s, zfd);
+
+			if (!s || SUCCESS != php_stream_cast(s, cast, (void *) &fd, 1) || fd == -1) {
+				php_error_docref(NULL TSRMLS_CC, E_NOTICE, "invalid resource");
+			} else {
+				PHP_SAFE_FD_SET(fd, set);
+				if (*max < fd) {
+					*max = fd;
+				}
+			}
+		}
+	}
+}
+
+static zval *php_ircclient_fds_ready(HashTable *fds, fd_set *set TSRMLS_DC)
+{
+	zval **zfd, *zready;
+
+	MAKE_STD_ZVAL(zready);
+	array_init(zready);
+
+	if (fds) {
+		for (	zend_hash_internal_pointer_reset(fds);
+				SUCCESS == zend_hash_get_current_data(fds, (void *) &zfd);
+				zend_hash_move_forward(fds)
+		) {
+			if (Z_TYPE_PP(zfd) == IS_RESOURCE) {
+				php_stream *s = NULL;
+				int fd = -1;
+
+				php_stream_from_zval_no_verify(s, zfd);
+
+				if (s && SUCCESS == php_stream_cast(s, PHP_STREAM_AS_FD_FOR_SELECT|PHP_STREAM_CAST_INTERNAL, (void *) &fd, 1) && fd != -1) {
+					if (PHP_SAFE_FD_ISSET(fd, set)) {
+						Z_ADDREF_PP(zfd);
+						add_next_index_zval(zready, *zfd);
+					}
+				}
+			}
+		}
+	}
+
+	return zready;
+}
+
+static inline int php_ircclient_watch_valid(php_ircclient_watch_t *w TSRMLS_DC)
+{
+	int type;
+
+	/* cheaper than looking up the stream and casting it again */
+	return zend_list_find(Z_RESVAL_P(w->zstream), &type) && (type == php_file_le_stream() || type == php_file_le_pstream());
+}
+
+typedef struct php_ircclient_watch_fds {
+	fd_set *i, *o;
+	int *max;
+} php_ircclient_watch_fds_t;
+
+static int php_ircclient_watch_add(void *ptr, void *arg TSRMLS_DC)
+{
+	php_ircclient_watch_t *w = ptr;
+	php_ircclient_watch_fds_t *fds = arg;
+
+	if (!php_ircclient_watch_valid(w TSRMLS_CC)) {
+		php_error_docref(NULL TSRMLS_CC, E_NOTICE, "watched stream has been closed");
+		return ZEND_HASH_APPLY_REMOVE;
+	}
+	if (w->mode & PHP_IRCCLIENT_WATCH_READ) {
+		PHP_SAFE_FD_SET(w->fd, fds->i);
+	}
+	if (w->mode & PHP_IRCCLIENT_WATCH_WRITE) {
+		PHP_SAFE_FD_SET(w->fd, fds->o);
+	}
+	if (*fds->max < w->fd) {
+		*fds->max = w->fd;
+	}
+	return ZEND_HASH_APPLY_KEEP;
+}
+
+static void php_ircclient_watch_add_descriptors(php_ircclient_session_object_t *obj, fd_set *i, fd_set *o, int *max TSRMLS_DC)
+{
+	php_ircclient_watch_fds_t fds = {i, o, max};
+
+	zend_hash_apply_with_argument(&obj->watches, php_ircclient_watch_add, &fds TSRMLS_CC);
+}
+
+static void php_ircclient_watch_ready(php_ircclient_session_object_t *obj, zval *zr, zval *zw, fd_set *i, fd_set *o TSRMLS_DC)
+{
+	HashPosition pos;
+	php_ircclient_watch_t *w;
+
+	for (	zend_hash_internal_pointer_reset_ex(&obj->watches, &pos);
+			SUCCESS == zend_hash_get_current_data_ex(&obj->watches, (void *) &w, &pos);
+			zend_hash_move_forward_ex(&obj->watches, &pos)
+	) {
+		if ((w->mode & PHP_IRCCLIENT_WATCH_READ) && PHP_SAFE_FD_ISSET(w->fd, i)) {
+			Z_ADDREF_P(w->zstream);
+			add_next_index_zval(zr, w->zstream);
+		}
+		if ((w->mode & PHP_IRCCLIENT_WATCH_WRITE) && PHP_SAFE_FD_ISSET(w->fd, o)) {
+			Z_ADDREF_P(w->zstream);
+			add_next_index_zval(zw, w->zstream);
+		}
+	}
+}
+
+static int php_ircclient_session_add_descriptors(php_ircclient_session_object_t *obj, fd_set *i, fd_set *o, int *max TSRMLS_DC)
+{
+	/* libircclient refuses to send anything before the connection is up */
+	if (obj->cap.pending && SUCCESS == php_ircclient_session_send(obj, PHP_IRCCLIENT_SEND_QUIET, "CAP LS 302")) {
+		obj->cap.pending = 0;
+		obj->cap.negotiating = 1;
+	}
+	/* after onConnect had its chance to join them */
+	if (obj->motd && zend_hash_num_elements(&obj->reconnect.rejoin)) {
+		php_ircclient_session_rejoin(obj);
+	}
+	/* so that libircclient asks for writability if there's anything due */
+	php_ircclient_queue_drain(obj);
+
+	if (!zend_hash_num_elements(&obj->dcc)) {
+		if (0 != irc_add_select_descriptors(obj->sess, i, o, max)) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "irc_add_select_descriptors: %s", irc_strerror(irc_errno(obj->sess)));
+			return FAILURE;
+		}
+	} else {
+		/* a set of our own, so that backpressure holds back nobody else's sockets */
+		fd_set si, so;
+		int fd, m = 0;
+
+		FD_ZERO(&si);
+		FD_ZERO(&so);
+		if (0 != irc_add_select_descriptors(obj->sess, &si, &so, &m)) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "irc_add_select_descriptors: %s", irc_strerror(irc_errno(obj->sess)));
+			return FAILURE;
+		}
+		php_ircclient_session_dcc_descriptors(obj, &si, &so, &m TSRMLS_CC);
+
+		for (fd = 0; fd <= m; ++fd) {
+			if (FD_ISSET(fd, &si)) {
+				PHP_SAFE_FD_SET(fd, i);
+			}
+			if (FD_ISSET(fd, &so)) {
+				PHP_SAFE_FD_SET(fd, o);
+			}
+		}
+		if (*max < m) {
+			*max = m;
+		}
+	}
+	return SUCCESS;
+}
+
+static int php_ircclient_session_process_descriptors(php_ircclient_session_object_t *obj, zval *zthis, fd_set *i, fd_set *o TSRMLS_DC)
+{
+	int rv = SUCCESS;
+	zval *zthis_prev = obj->zthis;
+
+	obj->zthis = zthis;
+	if (0 != irc_process_select_descriptors(obj->sess, i, o)) {
+		int err = irc_errno(obj->sess);
+
+		if (err) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "irc_process: %s", irc_strerror(err));
+			rv = FAILURE;
+		}
+	}
+	if (zend_hash_num_elements(&obj->dcc)) {
+		php_ircclient_session_dcc_flush(obj TSRMLS_CC);
+	}
+	if (obj->capture.zstream) {
+		php_ircclient_capture_flush(obj TSRMLS_CC);
+	}
+	obj->zthis = zthis_prev;
+
+	return rv;
+}
+
+/* select(), accounting for the time blocked in it */
+static int php_ircclient_session_select(php_ircclient_session_object_t *obj, int n, fd_set *i, fd_set *o, struct timeval *t)
+{
+	double start = php_ircclient_now();
+	int rc = select(n, i, o, NULL, t);
+
+	obj->stats.wait += php_ircclient_now() - start;
+	return rc;
+}
+
+static inline struct timeval *php_ircclient_timeval(double to, struct timeval *t)
+{
+	if (to == php_get_inf()) {
+		return NULL;
+	}
+	t->tv_sec = (time_t) to;
+	t->tv_usec = (suseconds_t) ((to - t->tv_sec) * 1000000.0);
+	return t;
+}
+
+/* wake up in time for the next line of the send queue */
+static inline double php_ircclient_session_timeout(php_ircclient_session_object_t *obj, double to)
+{
+	double delay = php_ircclient_queue_delay(&obj->queue);
+
+	return delay < to ? delay : to;
+}
+
+/* try to connect again, if the connection is gone and an attempt is due */
+static void php_ircclient_session_revive(php_ircclient_session_object_t *obj TSRMLS_DC)
+{
+	if (obj->reconnect.max && !irc_is_connected(obj->sess) && SUCCESS == php_ircclient_session_lost(obj TSRMLS_CC)) {
+		php_ircclient_session_reconnect(obj TSRMLS_CC);
+	}
+}
+
+/* irc_run() drop-in which lets the send queue drain on every tick */
+static int php_ircclient_session_loop(php_ircclient_session_object_t *obj TSRMLS_DC)
+{
+	int rv = SUCCESS;
+
+	for (;;) {
+		struct timeval t;
+
+		while (irc_is_connected(obj->sess)) {
+			fd_set i, o;
+			int m = 0;
+
+			FD_ZERO(&i);
+			FD_ZERO(&o);
+
+			if (SUCCESS != php_ircclient_session_add_descriptors(obj, &i, &o, &m TSRMLS_CC)) {
+				return FAILURE;
+			}
+			if (0 > php_ircclient_session_select(obj, m + 1, &i, &o, php_ircclient_timeval(php_ircclient_session_timeout(obj, php_get_inf()), &t))) {
+				if (errno == EINTR) {
+					continue;
+				}
+				php_error_docref(NULL TSRMLS_CC, E_WARNING, "select() error: %s", strerror(errno));
+				return FAILURE;
+			}
+			if (SUCCESS != php_ircclient_session_process_descriptors(obj, obj->zthis, &i, &o TSRMLS_CC)) {
+				rv = FAILURE;
+				break;
+			}
+		}
+
+		if (!obj->reconnect.max || SUCCESS != php_ircclient_session_lost(obj TSRMLS_CC)) {
+			return obj->reconnect.attempts ? FAILURE : rv;
+		}
+		rv = SUCCESS;
+		php_ircclient_session_select(obj, 0, NULL, NULL, php_ircclient_timeval(php_ircclient_reconnect_timeout(obj, php_get_inf()), &t));
+		php_ircclient_session_reconnect(obj TSRMLS_CC);
+	}
+}
+
+#if HAVE_SYS_EPOLL_H
+static void php_ircclient_epoll_want(php_ircclient_session_object_t *obj, int fd, long owner, unsigned events)
+{
+	php_ircclient_epoll_fd_t *efd;
+
+	if (SUCCESS != zend_hash_index_find(&obj->epoll.fds, fd, (void *) &efd)) {
+		php_ircclient_epoll_fd_t tmp = {fd, owner, 0, 0, 0, 0};
+
+		zend_hash_index_update(&obj->epoll.fds, fd, &tmp, sizeof(tmp), (void *) &efd);
+	} else if (efd->owner != owner) {
+		/* closing the old file dropped its registration */
+		efd->owner = owner;
+		efd->events = 0;
+	}
+	if (efd->tick != obj->epoll.tick) {
+		efd->tick = obj->epoll.tick;
+		efd->wanted = 0;
+	}
+	efd->wanted |= events;
+}
+
+static int php_ircclient_epoll_sync(void *ptr, void *arg TSRMLS_DC)
+{
+	php_ircclient_epoll_fd_t *efd = ptr;
+	php_ircclient_session_object_t *obj = arg;
+	struct epoll_event ev;
+
+	efd->revents = 0;
+
+	if (efd->tick != obj->epoll.tick) {
+		/* may have been closed already, which removes it from the set anyway */
+		epoll_ctl(obj->epoll.fd, EPOLL_CTL_DEL, efd->fd, &ev);
+		return ZEND_HASH_APPLY_REMOVE;
+	}
+	if (efd->wanted == efd->events) {
+		return ZEND_HASH_APPLY_KEEP;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = efd->wanted;
+	ev.data.fd = efd->fd;
+
+	if (efd->events) {
+		/* the fd number might have been closed and reused meanwhile */
+		if (0 != epoll_ctl(obj->epoll.fd, EPOLL_CTL_MOD, efd->fd, &ev) && errno == ENOENT) {
+			epoll_ctl(obj->epoll.fd, EPOLL_CTL_ADD, efd->fd, &ev);
+		}
+	} else if (0 != epoll_ctl(obj->epoll.fd, EPOLL_CTL_ADD, efd->fd, &ev) && errno == EEXIST) {
+		epoll_ctl(obj->epoll.fd, EPOLL_CTL_MOD, efd->fd, &ev);
+	}
+	efd->events = efd->wanted;
+
+	return ZEND_HASH_APPLY_KEEP;
+}
+
+static int php_ircclient_epoll_watch(void *ptr, void *arg TSRMLS_DC)
+{
+	php_ircclient_watch_t *w = ptr;
+	php_ircclient_session_object_t *obj = arg;
+
+	if (!php_ircclient_watch_valid(w TSRMLS_CC)) {
+		php_error_docref(NULL TSRMLS_CC, E_NOTICE, "watched stream has been closed");
+		return ZEND_HASH_APPLY_REMOVE;
+	}
+	php_ircclient_epoll_want(obj, w->fd, Z_RESVAL_P(w->zstream), ((w->mode & PHP_IRCCLIENT_WATCH_READ) ? EPOLLIN : 0) | ((w->mode & PHP_IRCCLIENT_WATCH_WRITE) ? EPOLLOUT : 0));
+	return ZEND_HASH_APPLY_KEEP;
+}
+
+static int php_ircclient_epoll_stream_fd(zval **zfd, int cast TSRMLS_DC)
+{
+	php_stream *s = NULL;
+	int fd = -1;
+
+	php_stream_from_zval_no_verify(s, zfd);
+
+	if (!s || SUCCESS != php_stream_cast(s, cast, (void *) &fd, 1)) {
+		return -1;
+	}
+	return fd;
+}
+
+/* same contract as the select() path of php_ircclient_session_run(), but
+ * the registration set lives on in the kernel between calls, so only changes
+ * cost a syscall and readiness checking scales with the active fds */
+static void php_ircclient_session_run_epoll(php_ircclient_session_object_t *obj, HashTable *ifds, HashTable *ofds, double to, zval *return_value TSRMLS_DC)
+{
+	struct {
+		zval **zfd;
+		int fd;
+		unsigned events;
+	} *sfds;
+	int connected, i, n = 0, m = 0, nready, timeout = -1;
+	double start;
+	fd_set irc_i, irc_o;
+	zval **zfd, *zr, *zw;
+	HashTable *fds[2];
+
+	if (obj->epoll.fd == -1) {
+		if (-1 == (obj->epoll.fd = epoll_create1(EPOLL_CLOEXEC))) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "epoll_create() error: %s", strerror(errno));
+			RETURN_FALSE;
+		}
+		zend_hash_init(&obj->epoll.fds, 16, NULL, NULL, 0);
+	}
+	++obj->epoll.tick;
+
+	FD_ZERO(&irc_i);
+	FD_ZERO(&irc_o);
+
+	php_ircclient_session_revive(obj TSRMLS_CC);
+	if ((connected = irc_is_connected(obj->sess))) {
+		if (SUCCESS != php_ircclient_session_add_descriptors(obj, &irc_i, &irc_o, &m TSRMLS_CC)) {
+			RETURN_FALSE;
+		}
+		for (i = 0; i <= m; ++i) {
+			if (FD_ISSET(i, &irc_i)) {
+				php_ircclient_epoll_want(obj, i, -1 - obj->epoll.gen, EPOLLIN);
+			}
+			if (FD_ISSET(i, &irc_o)) {
+				php_ircclient_epoll_want(obj, i, -1 - obj->epoll.gen, EPOLLOUT);
+			}
+		}
+	}
+
+	fds[0] = ifds;
+	fds[1] = ofds;
+	sfds = safe_emalloc((ifds ? zend_hash_num_elements(ifds) : 0) + (ofds ? zend_hash_num_elements(ofds) : 0), sizeof(*sfds), 0);
+
+	for (i = 0; i < 2; ++i) {
+		if (!fds[i]) {
+			continue;
+		}
+		for (	zend_hash_internal_pointer_reset(fds[i]);
+				SUCCESS == zend_hash_get_current_data(fds[i], (void *) &zfd);
+				zend_hash_move_forward(fds[i])
+		) {
+			if (Z_TYPE_PP(zfd) == IS_RESOURCE) {
+				int fd = php_ircclient_epoll_stream_fd(zfd, i ? PHP_STREAM_AS_FD_FOR_SELECT|PHP_STREAM_CAST_INTERNAL : PHP_STREAM_AS_FD_FOR_SELECT TSRMLS_CC);
+
+				if (fd == -1) {
+					php_error_docref(NULL TSRMLS_CC, E_NOTICE, "invalid resource");
+				} else {
+					sfds[n].zfd = zfd;
+					sfds[n].fd = fd;
+					sfds[n].events = i ? EPOLLOUT : EPOLLIN;
+					php_ircclient_epoll_want(obj, fd, Z_RESVAL_PP(zfd), sfds[n].events);
+					++n;
+				}
+			}
+		}
+	}
+
+	zend_hash_apply_with_argument(&obj->watches, php_ircclient_epoll_watch, obj TSRMLS_CC);
+	zend_hash_apply_with_argument(&obj->epoll.fds, php_ircclient_epoll_sync, obj TSRMLS_CC);
+
+	if (obj->epoll.nevents < zend_hash_num_elements(&obj->epoll.fds)) {
+		obj->epoll.nevents = zend_hash_num_elements(&obj->epoll.fds);
+		obj->epoll.events = safe_erealloc(obj->epoll.events, obj->epoll.nevents, sizeof(struct epoll_event), 0);
+	}
+
+	array_init(return_value);
+
+	to = connected ? php_ircclient_session_timeout(obj, to) : php_ircclient_reconnect_timeout(obj, to);
+	if (to != php_get_inf()) {
+		timeout = (int) (to * 1000.0 + 0.999);
+	}
+
+	start = php_ircclient_now();
+	nready = epoll_wait(obj->epoll.fd, obj->epoll.events, MAX(obj->epoll.nevents, 1), timeout);
+	obj->stats.wait += php_ircclient_now() - start;
+
+	if (0 > nready) {
+		efree(sfds);
+
+		if (errno == EINTR) {
+			/* interrupt; let userland be able to handle signals etc. */
+			return;
+		}
+
+		zval_dtor(return_value);
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "epoll_wait() error: %s", strerror(errno));
+		RETURN_FALSE;
+	}
+
+	for (i = 0; i < nready; ++i) {
+		php_ircclient_epoll_fd_t *efd;
+		unsigned revents = obj->epoll.events[i].events;
+
+		/* select() reports errors and hangups as readiness, too */
+		if (revents & (EPOLLERR|EPOLLHUP)) {
+			revents |= EPOLLIN|EPOLLOUT;
+		}
+		if (SUCCESS == zend_hash_index_find(&obj->epoll.fds, obj->epoll.events[i].data.fd, (void *) &efd)) {
+			efd->revents = revents & efd->events;
+		}
+	}
+
+	if (connected) {
+		for (i = 0; i <= m; ++i) {
+			php_ircclient_epoll_fd_t *efd;
+
+			if ((FD_ISSET(i, &irc_i) || FD_ISSET(i, &irc_o)) && SUCCESS == zend_hash_index_find(&obj->epoll.fds, i, (void *) &efd)) {
+				if (!(efd->revents & EPOLLIN)) {
+					FD_CLR(i, &irc_i);
+				}
+				if (!(efd->revents & EPOLLOUT)) {
+					FD_CLR(i, &irc_o);
+				}
+			}
+		}
+		if (SUCCESS != php_ircclient_session_process_descriptors(obj, obj->zthis, &irc_i, &irc_o TSRMLS_CC)
+		&&	SUCCESS != php_ircclient_session_lost(obj TSRMLS_CC)
+		) {
+			efree(sfds);
+			zval_dtor(return_value);
+			RETURN_FALSE;
+		}
+	}
+
+	MAKE_STD_ZVAL(zr);
+	array_init(zr);
+	MAKE_STD_ZVAL(zw);
+	array_init(zw);
+
+	for (i = 0; i < n; ++i) {
+		php_ircclient_epoll_fd_t *efd;
+
+		if (SUCCESS == zend_hash_index_find(&obj->epoll.fds, sfds[i].fd, (void *) &efd) && (efd->revents & sfds[i].events)) {
+			Z_ADDREF_PP(sfds[i].zfd);
+			add_next_index_zval(sfds[i].events == EPOLLIN ? zr : zw, *sfds[i].zfd);
+		}
+	}
+	efree(sfds);
+
+	if (zend_hash_num_elements(&obj->watches)) {
+		HashPosition pos;
+		php_ircclient_watch_t *w;
+
+		for (	zend_hash_internal_pointer_reset_ex(&obj->watches, &pos);
+				SUCCESS == zend_hash_get_current_data_ex(&obj->watches, (void *) &w, &pos);
+				zend_hash_move_forward_ex(&obj->watches, &pos)
+		) {
+			php_ircclient_epoll_fd_t *efd;
+
+			if (SUCCESS == zend_hash_index_find(&obj->epoll.fds, w->fd, (void *) &efd)) {
+				if ((w->mode & PHP_IRCCLIENT_WATCH_READ) && (efd->revents & EPOLLIN)) {
+					Z_ADDREF_P(w->zstream);
+					add_next_index_zval(zr, w->zstream);
+				}
+				if ((w->mode & PHP_IRCCLIENT_WATCH_WRITE) && (efd->revents & EPOLLOUT)) {
+					Z_ADDREF_P(w->zstream);
+					add_next_index_zval(zw, w->zstream);
+				}
+			}
+		}
+	}
+
+	add_next_index_zval(return_value, zr);
+	add_next_index_zval(return_value, zw);
+}
+#endif
+
+static void php_ircclient_session_run(php_ircclient_session_object_t *obj, HashTable *ifds, HashTable *ofds, double to, zval *return_value TSRMLS_DC)
+{
+#if HAVE_SYS_EPOLL_H
+	if ((ifds || ofds || zend_hash_num_elements(&obj->watches)) && (obj->opts & PHP_IRCCLIENT_OPTION_EPOLL)) {
+		php_ircclient_session_run_epoll(obj, ifds, ofds, to, return_value TSRMLS_CC);
+		return;
+	}
+#endif
+
+	if (ifds || ofds || zend_hash_num_elements(&obj->watches)) {
+		struct timeval t;
+		fd_set i, o;
+		int connected, m = 0;
+		zval *zr, *zw;
+
+		FD_ZERO(&i);
+		FD_ZERO(&o);
+
+		php_ircclient_session_revive(obj TSRMLS_CC);
+		if ((connected = irc_is_connected(obj->sess))) {
+			if (SUCCESS != php_ircclient_session_add_descriptors(obj, &i, &o, &m TSRMLS_CC)) {
+				RETURN_FALSE;
+			}
+		}
+		if (ifds) {
+			php_ircclient_fds_add(ifds, &i, &m, PHP_STREAM_AS_FD_FOR_SELECT TSRMLS_CC);
+		}
+		if (ofds) {
+			php_ircclient_fds_add(ofds, &o, &m, PHP_STREAM_AS_FD_FOR_SELECT|PHP_STREAM_CAST_INTERNAL TSRMLS_CC);
+		}
+		php_ircclient_watch_add_descriptors(obj, &i, &o, &m TSRMLS_CC);
+
+		PHP_SAFE_MAX_FD(m, m);
+		array_init(return_value);
+
+		to = connected ? php_ircclient_session_timeout(obj, to) : php_ircclient_reconnect_timeout(obj, to);
+
+		if (0 > php_ircclient_session_select(obj, m + 1, &i, &o, php_ircclient_timeval(to, &t))) {
+			if (errno == EINTR) {
+				/* interrupt; let userland be able to handle signals etc. */
+				return;
+			}
+
+			zval_dtor(return_value);
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "select() error: %s", strerror(errno));
+			RETURN_FALSE;
+		}
+
+		if (connected) {
+			if (SUCCESS != php_ircclient_session_process_descriptors(obj, obj->zthis, &i, &o TSRMLS_CC)
+			&&	SUCCESS != php_ircclient_session_lost(obj TSRMLS_CC)
+			) {
+				zval_dtor(return_value);
+				RETURN_FALSE;
+			}
+		}
+
+		zr = php_ircclient_fds_ready(ifds, &i TSRMLS_CC);
+		zw = php_ircclient_fds_ready(ofds, &o TSRMLS_CC);
+		php_ircclient_watch_ready(obj, zr, zw, &i, &o TSRMLS_CC);
+
+		add_next_index_zval(return_value, zr);
+		add_next_index_zval(return_value, zw);
+
+		return;
+
+	} else if (PHP_IRCCLIENT_QUEUED(obj) || obj->reconnect.max || obj->capture.zstream || obj->cap.pending) {
+		if (SUCCESS != php_ircclient_session_loop(obj TSRMLS_CC)) {
+			RETURN_FALSE;
+		}
+	} else {
+		if (0 != irc_run(obj->sess)) {
+			int err = irc_errno(obj->sess);
+
+			if (err) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING, "irc_run: %s", irc_strerror(err));
+				RETURN_FALSE;
+			}
+		}
+	}
+
+	RETURN_TRUE;
+}
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_run, 0, 0, 0)
+	ZEND_ARG_INFO(0, read_fd_array_for_select)
+	ZEND_ARG_INFO(0, write_fd_array_for_select)
+	ZEND_ARG_INFO(0, timeout_seconds)
+ZEND_END_ARG_INFO()
+/* {{{ proto array Session::run([array read_fds_for_select[, array write_fds_for_select[, double timeout = null]]])
+	Returns early when the next line of the send queue is due.
+	Returns array(array of readable fds, array of writeable fds) or false on error. */
+PHP_METHOD(Session, run)
+{
+	HashTable *ifds = NULL, *ofds = NULL;
+	double to = php_get_inf();
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "|H!H!d", &ifds, &ofds, &to)) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+		zval *zthis = obj->zthis;
+
+		/* event callbacks will only ever be called from here */
+		obj->zthis = getThis();
+		php_ircclient_session_run(obj, ifds, ofds, to, return_value TSRMLS_CC);
+		obj->zthis = zthis;
+	}
+}
+/* }}} */
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_watch, 0, 0, 1)
+	ZEND_ARG_INFO(0, stream)
+	ZEND_ARG_INFO(0, mode)
+ZEND_END_ARG_INFO()
+/* {{{ proto bool Session::watch(resource stream[, int mode = irc\client\WATCH_READ])
+	Registers a stream once for all subsequent calls to Session::run(), which
+	will report it in its readable/writable arrays when ready.
+	Returns TRUE when the stream could be registered. */
+PHP_METHOD(Session, watch)
+{
+	zval *zstream;
+	long mode = PHP_IRCCLIENT_WATCH_READ;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "r|l", &zstream, &mode)) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+		php_ircclient_watch_t w;
+		php_stream *s = NULL;
+
+		php_stream_from_zval(s, &zstream);
+
+		w.fd = -1;
+		if (SUCCESS != php_stream_cast(s, PHP_STREAM_AS_FD_FOR_SELECT|PHP_STREAM_CAST_INTERNAL, (void *) &w.fd, 1) || w.fd == -1) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "invalid resource");
+			RETURN_FALSE;
+		}
+
+		w.mode = mode & (PHP_IRCCLIENT_WATCH_READ|PHP_IRCCLIENT_WATCH_WRITE);
+		w.zstream = zstream;
+		Z_ADDREF_P(zstream);
+		zend_hash_index_update(&obj->watches, Z_RESVAL_P(zstream), &w, sizeof(w), NULL);
+
+		RETURN_TRUE;
+	}
+}
+/* }}} */
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_unwatch, 0, 0, 1)
+	ZEND_ARG_INFO(0, stream)
+ZEND_END_ARG_INFO()
+/* {{{ proto bool Session::unwatch(resource stream)
+	Returns TRUE when the stream was watched. */
+PHP_METHOD(Session, unwatch)
+{
+	zval *zstream;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "r", &zstream)) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+
+		RETURN_BOOL(SUCCESS == zend_hash_index_del(&obj->watches, Z_RESVAL_P(zstream)));
+	}
+}
+/* }}} */
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_on, 0, 0, 2)
+	ZEND_ARG_INFO(0, event)
+	ZEND_ARG_INFO(0, callback)
+	ZEND_ARG_INFO(0, priority)
+ZEND_END_ARG_INFO()
+/* {{{ proto int Session::on(int event, callable callback[, int priority = irc\client\PRIORITY_NORMAL])
+	Adds a listener for one of the irc\client\EVENT_* constants, which gets
+	the same arguments as the onXxx handler. Listeners are called in order
+	of priority, PRIORITY_HIGH first, and in the order they were added
+	within the same priority; the onXxx handler is called before the
+	listeners of PRIORITY_NORMAL. Listeners may be added and removed while
+	an event is dispatched; that takes effect with the next event.
+	Returns an id for Session::off(), or FALSE on error. */
+PHP_METHOD(Session, on)
+{
+	long mask, priority = PHP_IRCCLIENT_PRIORITY_NORMAL;
+	zend_fcall_info fci;
+	zend_fcall_info_cache fcc;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "lf|l", &mask, &fci, &fcc, &priority)) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+		php_ircclient_listeners_t *ls;
+		php_ircclient_listener_t *l;
+		unsigned i;
+		int ev;
+
+		/* the constants are bits, as for Session::addFilter() */
+		for (ev = 0; ev < PHP_IRCCLIENT_EVENT_COUNT && (unsigned long) mask != PHP_IRCCLIENT_EVENT_MASK(ev); ++ev);
+		if (ev == PHP_IRCCLIENT_EVENT_COUNT) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "unknown event %ld", mask);
+			RETURN_FALSE;
+		}
+
+		ls = php_ircclient_listeners_copy(obj->listeners[ev], 0);
+		for (i = ls->count; i > 0 && ls->entries[i - 1].priority > priority; --i);
+		memmove(&ls->entries[i + 1], &ls->entries[i], (ls->count - i) * sizeof(*l));
+		++ls->count;
+
+		l = &ls->entries[i];
+		l->id = ++obj->listener_id;
+		l->priority = priority;
+		l->zcb = fci.function_name;
+		Z_ADDREF_P(l->zcb);
+		l->fci = fci;
+		l->fcc = fcc;
+
+		php_ircclient_listeners_release(obj->listeners[ev]);
+		obj->listeners[ev] = ls;
+		obj->mask_dirty = 1;
+
+		RETURN_LONG(l->id);
+	}
+}
+/* }}} */
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_off, 0, 0, 1)
+	ZEND_ARG_INFO(0, id)
+ZEND_END_ARG_INFO()
+/* {{{ proto bool Session::off(int id)
+	Removes a listener added by Session::on().
+	Returns TRUE when there was one. */
+PHP_METHOD(Session, off)
+{
+	long id;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l", &id)) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+		int ev;
+
+		for (ev = 0; ev < PHP_IRCCLIENT_EVENT_COUNT; ++ev) {
+			php_ircclient_listeners_t *ls = obj->listeners[ev];
+			unsigned i;
+
+			for (i = 0; ls && i < ls->count; ++i) {
+				if (ls->entries[i].id == id) {
+					obj->listeners[ev] = ls->count > 1 ? php_ircclient_listeners_copy(ls, id) : NULL;
+					php_ircclient_listeners_release(ls);
+					obj->mask_dirty = 1;
+					RETURN_TRUE;
+				}
+			}
+		}
+		RETURN_FALSE;
+	}
+}
+/* }}} */
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_setOption, 0, 0, 1)
+	ZEND_ARG_INFO(0, option)
+	ZEND_ARG_INFO(0, enable)
+ZEND_END_ARG_INFO()
+/* {{{ proto void Session::setOption(int option[, bool enable = true]) */
+PHP_METHOD(Session, setOption)
+{
+	long opt;
+	zend_bool onoff = 1;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l|b", &opt, &onoff)) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+
+#if !HAVE_SYS_EPOLL_H
+		if (opt & PHP_IRCCLIENT_OPTION_EPOLL) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "epoll is not supported on this platform");
+			opt &= ~PHP_IRCCLIENT_OPTION_EPOLL;
+		}
+#endif
+		if (onoff) {
+			obj->opts |= opt;
+			irc_option_set(obj->sess, opt & ~PHP_IRCCLIENT_OPTIONS);
+			/* see Session::dumpTrace() */
+			if ((opt & LIBIRC_OPTION_DEBUG) && !obj->trace.ring) {
+				php_ircclient_trace_alloc(obj, PHP_IRCCLIENT_TRACE_SIZE);
+			}
+		} else {
+			obj->opts &= ~opt;
+			irc_option_reset(obj->sess, opt & ~PHP_IRCCLIENT_OPTIONS);
+		}
+		if (!(obj->opts & PHP_IRCCLIENT_OPTION_TRACK_STATE)) {
+			/* would be stale when enabled again */
+			zend_hash_clean(&obj->track.channels);
+		}
+	}
+}
+/* }}} */
+
+static php_ircclient_channel_t *php_ircclient_session_channel(php_ircclient_session_object_t *obj, const char *chan TSRMLS_DC)
+{
+	if (!(obj->opts & PHP_IRCCLIENT_OPTION_TRACK_STATE)) {
+		php_error_docref(NULL TSRMLS_CC, E_NOTICE, "state tracking is not enabled");
+		return NULL;
+	}
+	return php_ircclient_track_channel(obj, chan);
+}
+
+static char *php_ircclient_member_modes(php_ircclient_session_object_t *obj, php_ircclient_member_t *m, char *buf)
+{
+	char *ptr = buf;
+	int i;
+
+	/* highest rank first */
+	for (i = 0; obj->isupport.prefix_modes[i]; ++i) {
+		if (m->modes & (1U << i)) {
+			*ptr++ = obj->isupport.prefix_modes[i];
+		}
+	}
+	*ptr = '\0';
+	return buf;
+}
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_isOn, 0, 0, 1)
+	ZEND_ARG_INFO(0, channel)
+	ZEND_ARG_INFO(0, nick)
+ZEND_END_ARG_INFO()
+/* {{{ proto bool Session::isOn(string channel[, string nick])
+	Needs irc\client\OPTION_TRACK_STATE.
+	Returns TRUE when nick, or we ourselves if omitted, are on the channel. */
+PHP_METHOD(Session, isOn)
+{
+	char *chan_str, *nick_str = NULL;
+	int chan_len, nick_len = 0;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s|s!", &chan_str, &chan_len, &nick_str, &nick_len)) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+		php_ircclient_channel_t *ch = php_ircclient_session_channel(obj, chan_str TSRMLS_CC);
+
+		if (!ch) {
+			RETURN_FALSE;
+		}
+		RETURN_BOOL(!nick_str || php_ircclient_member_find(obj, ch, nick_str, nick_len));
+	}
+}
+/* }}} */
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_getUsers, 0, 0, 1)
+	ZEND_ARG_INFO(0, channel)
+ZEND_END_ARG_INFO()
+/* {{{ proto array Session::getUsers(string channel)
+	Needs irc\client\OPTION_TRACK_STATE.
+	Returns array(nick => modes) or false if we are not on the channel. */
+PHP_METHOD(Session, getUsers)
+{
+	char *chan_str;
+	int chan_len;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &chan_str, &chan_len)) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+		php_ircclient_channel_t *ch = php_ircclient_session_channel(obj, chan_str TSRMLS_CC);
+		php_ircclient_member_t *m;
+		HashPosition pos;
+		char modes[sizeof(obj->isupport.prefix_modes)];
+
+		if (!ch) {
+			RETURN_FALSE;
+		}
+
+		array_init_size(return_value, zend_hash_num_elements(&ch->members));
+		for (	zend_hash_internal_pointer_reset_ex(&ch->members, &pos);
+				SUCCESS == zend_hash_get_current_data_ex(&ch->members, (void *) &m, &pos);
+				zend_hash_move_forward_ex(&ch->members, &pos)
+		) {
+			add_assoc_string_ex(return_value, m->nick, strlen(m->nick) + 1, php_ircclient_member_modes(obj, m, modes), 1);
+		}
+	}
+}
+/* }}} */
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_getModes, 0, 0, 2)
+	ZEND_ARG_INFO(0, channel)
+	ZEND_ARG_INFO(0, nick)
+ZEND_END_ARG_INFO()
+/* {{{ proto string Session::getModes(string channel, string nick)
+	Needs irc\client\OPTION_TRACK_STATE.
+	Returns the channel user modes of nick, e.g. "ov", or false if not on the channel. */
+PHP_METHOD(Session, getModes)
+{
+	char *chan_str, *nick_str;
+	int chan_len, nick_len;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ss", &chan_str, &chan_len, &nick_str, &nick_len)) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+		php_ircclient_channel_t *ch = php_ircclient_session_channel(obj, chan_str TSRMLS_CC);
+		php_ircclient_member_t *m;
+		char modes[sizeof(obj->isupport.prefix_modes)];
+
+		if (!ch || !(m = php_ircclient_member_find(obj, ch, nick_str, nick_len))) {
+			RETURN_FALSE;
+		}
+		RETURN_STRING(php_ircclient_member_modes(obj, m, modes), 1);
+	}
+}
+/* }}} */
+
+/* {{{ proto array Session::getChannels()
+	Needs irc\client\OPTION_TRACK_STATE.
+	Returns the names of the channels we are on. */
+PHP_METHOD(Session, getChannels)
+{
+	if (SUCCESS == zend_parse_parameters_none()) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+		php_ircclient_channel_t **ch;
+		HashPosition pos;
+
+		if (!(obj->opts & PHP_IRCCLIENT_OPTION_TRACK_STATE)) {
+			php_error_docref(NULL TSRMLS_CC, E_NOTICE, "state tracking is not enabled");
+			RETURN_FALSE;
+		}
+
+		array_init_size(return_value, zend_hash_num_elements(&obj->track.channels));
+		for (	zend_hash_internal_pointer_reset_ex(&obj->track.channels, &pos);
+				SUCCESS == zend_hash_get_current_data_ex(&obj->track.channels, (void *) &ch, &pos);
+				zend_hash_move_forward_ex(&obj->track.channels, &pos)
+		) {
+			add_next_index_string(return_value, (*ch)->name, 1);
+		}
+	}
+}
+/* }}} */
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_setFloodControl, 0, 0, 1)
+	ZEND_ARG_INFO(0, rate)
+	ZEND_ARG_INFO(0, burst)
+	ZEND_ARG_INFO(0, max)
+ZEND_END_ARG_INFO()
+/* {{{ proto void Session::setFloodControl(double lines_per_second[, int burst = 5[, int max = 0]])
+	Queues outgoing commands instead of sending them right away, and lets
+	Session::run() send them as the rate allows, highest priority first.
+	doQuit() and doUserMode() always bypass the queue.
+	A rate of 0 disables pacing; queued lines are sent as fast as possible.
+	With a max greater than 0, commands that would queue more lines than that
+	are refused with a warning, and their methods return false. */
+PHP_METHOD(Session, setFloodControl)
+{
+	double rate;
+	long burst = 5, max = 0;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "d|ll", &rate, &burst, &max)) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+
+		if (max < 0) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "max must not be negative");
+			max = 0;
+		}
+		obj->queue.max = max;
+
+		if (rate > 0) {
+			if (burst < 1) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING, "burst must be at least 1");
+				burst = 1;
+			}
+			if (obj->queue.rate <= 0) {
+				obj->queue.tokens = burst;
+				obj->queue.stamp = php_ircclient_now();
+			}
+			obj->queue.rate = rate;
+			obj->queue.burst = burst;
+		} else {
+			obj->queue.rate = 0;
+		}
+	}
+}
+/* }}} */
+
+/* {{{ proto int Session::getQueueLength()
+	Returns the number of lines waiting in the send queue. */
+PHP_METHOD(Session, getQueueLength)
+{
+	if (SUCCESS == zend_parse_parameters_none()) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+
+		RETURN_LONG(obj->queue.count);
+	}
+}
+/* }}} */
+
+/* {{{ proto irc\client\Tags Session::getTags()
+	Message tags of the event being handled, or NULL if it has none.
+	See irc\client\OPTION_MESSAGE_TAGS. */
+PHP_METHOD(Session, getTags)
+{
+	if (SUCCESS == zend_parse_parameters_none()) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+
+		if (obj->tags) {
+			php_ircclient_tags_init(return_value, obj->tags TSRMLS_CC);
+		}
+	}
+}
+/* }}} */
+
+/* {{{ proto array Session::getCaps()
+	Returns the acknowledged IRCv3 capabilities, name => value.
+	Capabilities are negotiated with irc\client\OPTION_MESSAGE_TAGS or irc\client\OPTION_BATCH. */
+PHP_METHOD(Session, getCaps)
+{
+	if (SUCCESS == zend_parse_parameters_none()) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+
+		array_init_size(return_value, zend_hash_num_elements(&obj->cap.enabled));
+		zend_hash_copy(Z_ARRVAL_P(return_value), &obj->cap.enabled, (copy_ctor_func_t) zval_add_ref, NULL, sizeof(zval *));
+	}
+}
+/* }}} */
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_addFilter, 0, 0, 1)
+	ZEND_ARG_ARRAY_INFO(0, rule, 0)
+ZEND_END_ARG_INFO()
+/* {{{ proto int Session::addFilter(array rule)
+	Adds a rule which events have to match to be dispatched; rules are checked
+	in C before any PHP value is built and an event passes if any rule which
+	applies to it matches. All given conditions of a rule have to match:
+		events		irc\client\EVENT_* bit mask the rule applies to,
+					defaults to channel, private, notice and action messages;
+					DCC requests cannot be filtered
+		channels	array of channel names, the first param is one of
+		target		the first param, e.g. our nick for private messages
+		prefix		the last param, i.e. the text, starts with
+		mention		bool, the text contains our nick
+		pattern		PCRE the text matches
+	Returns the id of the rule, or FALSE on error. */
+PHP_METHOD(Session, addFilter)
+{
+	HashTable *rule;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "h", &rule)) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+		php_ircclient_filter_t f;
+		char key[PHP_IRCCLIENT_KEY_SIZE];
+		zval **zv;
+		long id;
+
+		memset(&f, 0, sizeof(f));
+		f.events = PHP_IRCCLIENT_FILTER_EVENTS;
+
+		if (SUCCESS == zend_hash_find(rule, ZEND_STRS("events"), (void *) &zv)) {
+			zval *tmp = *zv;
+
+			SEPARATE_ARG_IF_REF(tmp);
+			convert_to_long_ex(&tmp);
+			f.events = Z_LVAL_P(tmp);
+			zval_ptr_dtor(&tmp);
+
+			if (f.events & PHP_IRCCLIENT_FILTER_NONE) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING, "DCC requests cannot be filtered");
+				RETURN_FALSE;
+			}
+		}
+		if (SUCCESS == zend_hash_find(rule, ZEND_STRS("channels"), (void *) &zv)) {
+			zval **zc;
+			HashPosition pos;
+
+			if (Z_TYPE_PP(zv) != IS_ARRAY) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING, "channels must be an array");
+				RETURN_FALSE;
+			}
+			ALLOC_HASHTABLE(f.channels);
+			zend_hash_init(f.channels, zend_hash_num_elements(Z_ARRVAL_PP(zv)), NULL, NULL, 0);
+			for (	zend_hash_internal_pointer_reset_ex(Z_ARRVAL_PP(zv), &pos);
+					SUCCESS == zend_hash_get_current_data_ex(Z_ARRVAL_PP(zv), (void *) &zc, &pos);
+					zend_hash_move_forward_ex(Z_ARRVAL_PP(zv), &pos)
+			) {
+				zval *tmp = *zc;
+				size_t len;
+
+				SEPARATE_ARG_IF_REF(tmp);
+				convert_to_string_ex(&tmp);
+				len = php_ircclient_casefold(obj, Z_STRVAL_P(tmp), Z_STRLEN_P(tmp), key);
+
+				zend_hash_add_empty_element(f.channels, key, len + 1);
+				zval_ptr_dtor(&tmp);
+			}
+		}
+		if (SUCCESS == zend_hash_find(rule, ZEND_STRS("target"), (void *) &zv)) {
+			zval *tmp = *zv;
+
+			SEPARATE_ARG_IF_REF(tmp);
+			convert_to_string_ex(&tmp);
+
+			f.target_len = php_ircclient_casefold(obj, Z_STRVAL_P(tmp), Z_STRLEN_P(tmp), key);
+			f.target = estrndup(key, f.target_len);
+			zval_ptr_dtor(&tmp);
+		}
+		if (SUCCESS == zend_hash_find(rule, ZEND_STRS("prefix"), (void *) &zv)) {
+			zval *tmp = *zv;
+
+			SEPARATE_ARG_IF_REF(tmp);
+			convert_to_string_ex(&tmp);
+
+			f.prefix_len = Z_STRLEN_P(tmp);
+			f.prefix = estrndup(Z_STRVAL_P(tmp), f.prefix_len);
+			zval_ptr_dtor(&tmp);
+		}
+		if (SUCCESS == zend_hash_find(rule, ZEND_STRS("mention"), (void *) &zv)) {
+			f.mention = zend_is_true(*zv);
+		}
+		if (SUCCESS == zend_hash_find(rule, ZEND_STRS("pattern"), (void *) &zv)) {
+			zval *tmp = *zv;
+
+			SEPARATE_ARG_IF_REF(tmp);
+			convert_to_string_ex(&tmp);
+
+			f.pattern_len = Z_STRLEN_P(tmp);
+			f.pattern = estrndup(Z_STRVAL_P(tmp), f.pattern_len);
+			zval_ptr_dtor(&tmp);
+
+			/* emits a warning if it does not compile */
+			if (!pcre_get_compiled_regex_cache(f.pattern, f.pattern_len TSRMLS_CC)) {
+				php_ircclient_filter_dtor(&f);
+				RETURN_FALSE;
+			}
+		}
+
+		id = zend_hash_next_free_element(&obj->filters);
+		zend_hash_next_index_insert(&obj->filters, (void *) &f, sizeof(f), NULL);
+		php_ircclient_session_filtered(obj);
+
+		RETURN_LONG(id);
+	}
+}
+/* }}} */
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_removeFilter, 0, 0, 1)
+	ZEND_ARG_INFO(0, id)
+ZEND_END_ARG_INFO()
+/* {{{ proto bool Session::removeFilter(int id)
+	Returns TRUE when the rule existed. */
+PHP_METHOD(Session, removeFilter)
+{
+	long id;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l", &id)) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+
+		if (SUCCESS != zend_hash_index_del(&obj->filters, id)) {
+			RETURN_FALSE;
+		}
+		php_ircclient_session_filtered(obj);
+		RETURN_TRUE;
+	}
+}
+/* }}} */
+
+/* {{{ proto void Session::clearFilters() */
+PHP_METHOD(Session, clearFilters)
+{
+	if (SUCCESS == zend_parse_parameters_none()) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+
+		zend_hash_clean(&obj->filters);
+		obj->filtered = 0;
+	}
+}
+/* }}} */
+
+/* {{{ proto array Session::getStats()
+	Returns the counters since the session was created or resetStats():
+		elapsed		seconds since then
+		wait		seconds spent waiting for the network in run()
+		lines_in	lines received
+		bytes_in	their length, as reassembled from the parsed line
+		commands	lines sent, including internal ones like PONG and CAP
+		bytes_out	their length
+		events		by handler name: count of events received, calls of the
+					handler, their total time in seconds and a histogram of
+					the call times by upper bound
+	Lines libircclient sends on its own, e.g. at registration, are not
+	counted. */
+PHP_METHOD(Session, getStats)
+{
+	if (SUCCESS == zend_parse_parameters_none()) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+		php_ircclient_stats_t *st = &obj->stats;
+		zval *zevents;
+		int i;
+
+		array_init(return_value);
+		add_assoc_double_ex(return_value, ZEND_STRS("elapsed"), php_ircclient_now() - st->since);
+		add_assoc_double_ex(return_value, ZEND_STRS("wait"), st->wait);
+		add_assoc_long_ex(return_value, ZEND_STRS("lines_in"), st->lines_in);
+		add_assoc_long_ex(return_value, ZEND_STRS("bytes_in"), st->bytes_in);
+		add_assoc_long_ex(return_value, ZEND_STRS("commands"), st->commands);
+		add_assoc_long_ex(return_value, ZEND_STRS("bytes_out"), st->bytes_out);
+
+		MAKE_STD_ZVAL(zevents);
+		array_init(zevents);
+		for (i = 0; i < PHP_IRCCLIENT_EVENT_COUNT; ++i) {
+			zval *zev, *zhist;
+			size_t b;
+
+			if (!st->events[i] && !st->calls[i]) {
+				continue;
+			}
+
+			MAKE_STD_ZVAL(zhist);
+			array_init_size(zhist, PHP_IRCCLIENT_STATS_BUCKETS);
+			for (b = 0; b < PHP_IRCCLIENT_STATS_BUCKETS; ++b) {
+				add_assoc_long_ex(zhist, php_ircclient_stats_buckets[b].name, php_ircclient_stats_buckets[b].name_len + 1, st->histogram[i][b]);
+			}
+
+			MAKE_STD_ZVAL(zev);
+			array_init_size(zev, 4);
+			add_assoc_long_ex(zev, ZEND_STRS("count"), st->events[i]);
+			add_assoc_long_ex(zev, ZEND_STRS("calls"), st->calls[i]);
+			add_assoc_double_ex(zev, ZEND_STRS("time"), st->time[i]);
+			add_assoc_zval_ex(zev, ZEND_STRS("histogram"), zhist);
+
+			add_assoc_zval_ex(zevents, php_ircclient_events[i].str, php_ircclient_events[i].len + 1, zev);
+		}
+		add_assoc_zval_ex(return_value, ZEND_STRS("events"), zevents);
+	}
+}
+/* }}} */
+
+/* {{{ proto void Session::resetStats()
+	Starts a new measuring period. */
+PHP_METHOD(Session, resetStats)
+{
+	if (SUCCESS == zend_parse_parameters_none()) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+
+		php_ircclient_stats_reset(&obj->stats);
+	}
+}
+/* }}} */
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_setWatchdog, 0, 0, 1)
+	ZEND_ARG_INFO(0, threshold)
+	ZEND_ARG_INFO(0, pong)
+ZEND_END_ARG_INFO()
+/* {{{ proto void Session::setWatchdog(double threshold[, bool pong = true])
+	Reports handlers taking threshold seconds or longer to onSlowHandler, or
+	as a warning if nobody listens to it; 0 disables the watchdog.
+	With pong, a slow handler also makes the session answer any PING already
+	waiting in the socket buffer right away, instead of after all the lines
+	received before it were dispatched. It cannot help while a handler still
+	blocks. */
+PHP_METHOD(Session, setWatchdog)
+{
+	double threshold;
+	zend_bool pong = 1;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "d|b", &threshold, &pong)) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+
+		obj->watchdog.threshold = threshold > 0 ? threshold : 0;
+		obj->watchdog.pong = pong;
+	}
+}
+/* }}} */
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_capture, 0, 0, 0)
+	ZEND_ARG_INFO(0, stream)
+ZEND_END_ARG_INFO()
+/* {{{ proto bool Session::capture(resource stream = NULL)
+	Records everything received from the server, as it was passed on by
+	libircclient, with the time in between, to stream; open it in append
+	mode to add to an existing capture. NULL stops recording.
+	Records are buffered and written after each pass of Session::run(). */
+PHP_METHOD(Session, capture)
+{
+	zval *zstream = NULL;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "|r!", &zstream)) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+
+		php_ircclient_capture_stop(obj TSRMLS_CC);
+		if (zstream) {
+			php_stream *s = NULL;
+
+			php_stream_from_zval(s, &zstream);
+
+			obj->capture.zstream = zstream;
+			Z_ADDREF_P(zstream);
+			obj->capture.stamp = php_ircclient_now();
+			smart_str_appendl(&obj->capture.buf, PHP_IRCCLIENT_CAPTURE_MAGIC, PHP_IRCCLIENT_CAPTURE_HEAD);
+		}
+		RETURN_TRUE;
+	}
+}
+/* }}} */
+
+/* indexed by php_ircclient_event_t, up to PHP_IRCCLIENT_EVENT_UNKNOWN */
+static const irc_event_callback_t php_ircclient_capture_callbacks[PHP_IRCCLIENT_EVENT_COUNT] = {
+	php_ircclient_event_callback_connect,
+	php_ircclient_event_callback_nick,
+	php_ircclient_event_callback_quit,
+	php_ircclient_event_callback_join,
+	php_ircclient_event_callback_part,
+	php_ircclient_event_callback_mode,
+	php_ircclient_event_callback_umode,
+	php_ircclient_event_callback_topic,
+	php_ircclient_event_callback_kick,
+	php_ircclient_event_callback_channel,
+	php_ircclient_event_callback_privmsg,
+	php_ircclient_event_callback_notice,
+#if PHP_IRCCLIENT_HAVE_EVENT_CHANNEL_NOTICE
+	php_ircclient_event_callback_channel_notice,
+#else
+	NULL,
+#endif
+	php_ircclient_event_callback_invite,
+	php_ircclient_event_callback_ctcp_req,
+	php_ircclient_event_callback_ctcp_rep,
+	php_ircclient_event_callback_action,
+	php_ircclient_event_callback_unknown
+};
+
+static inline unsigned int php_ircclient_replay_u16(const unsigned char *buf)
+{
+	return (buf[0] << 8) | buf[1];
+}
+
+/* FAILURE on a truncated capture */
+static int php_ircclient_replay_read(php_stream *s, void *buf, size_t len TSRMLS_DC)
+{
+	size_t n = 0, r;
+
+	while (n < len && (r = php_stream_read(s, (char *) buf + n, len - n)) > 0) {
+		n += r;
+	}
+	return n == len ? SUCCESS : FAILURE;
+}
+
+/* one record of a capture, after its head */
+static int php_ircclient_replay_record(php_ircclient_session_object_t *obj, php_stream *s, const unsigned char *head, smart_str *buf TSRMLS_DC)
+{
+	unsigned int type = php_ircclient_replay_u16(head + 4), count = head[6], i;
+	size_t offsets[0xff + 2];
+	const char *argv[0xff + 2];
+	unsigned char len[2];
+
+	buf->len = 0;
+	for (i = 0; i < count + 2; ++i) {
+		unsigned int n;
+		size_t newlen;
+
+		if (SUCCESS != php_ircclient_replay_read(s, len, 2 TSRMLS_CC)) {
+			return FAILURE;
+		}
+		if (PHP_IRCCLIENT_CAPTURE_NULL == (n = php_ircclient_replay_u16(len))) {
+			/* only the event name of numerics and the origin may be missing */
+			if (i > 1 || (i == 0 && type >= PHP_IRCCLIENT_CAPTURE_EVENT)) {
+				return FAILURE;
+			}
+			offsets[i] = (size_t) -1;
+			continue;
+		}
+		offsets[i] = buf->len;
+		smart_str_alloc(buf, n + 1, 0);
+		if (SUCCESS != php_ircclient_replay_read(s, buf->c + buf->len, n TSRMLS_CC)) {
+			return FAILURE;
+		}
+		buf->len += n;
+		buf->c[buf->len++] = '\0';
+	}
+	/* the buffer is not going to move anymore */
+	for (i = 0; i < count + 2; ++i) {
+		argv[i] = offsets[i] == (size_t) -1 ? NULL : buf->c + offsets[i];
+	}
+	argv[count + 2] = NULL;
+
+	if (type < PHP_IRCCLIENT_CAPTURE_EVENT) {
+		php_ircclient_event_code_callback(obj->sess, type, argv[1], argv + 2, count);
+	} else if (type - PHP_IRCCLIENT_CAPTURE_EVENT < PHP_IRCCLIENT_EVENT_COUNT && php_ircclient_capture_callbacks[type - PHP_IRCCLIENT_CAPTURE_EVENT]) {
+		php_ircclient_capture_callbacks[type - PHP_IRCCLIENT_CAPTURE_EVENT](obj->sess, argv[0], argv[1], argv + 2, count);
+	} else {
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_replay, 0, 0, 1)
+	ZEND_ARG_INFO(0, stream)
+	ZEND_ARG_INFO(0, speed)
+ZEND_END_ARG_INFO()
+/* {{{ proto int Session::replay(resource stream[, double speed = 1.0])
+	Feeds a recording of Session::capture() through the same path as
+	received lines, calling the same handlers with the same state tracking,
+	paced as recorded, speed times as fast, or as fast as possible if speed
+	is 0. Commands of handlers fail unless the session is connected.
+	Returns the number of records replayed, or FALSE on error. */
+PHP_METHOD(Session, replay)
+{
+	zval *zstream;
+	double speed = 1.0;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "r|d", &zstream, &speed)) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+		php_stream *s = NULL;
+		unsigned char head[PHP_IRCCLIENT_CAPTURE_HEAD];
+		smart_str buf = {0};
+		zval *zthis = obj->zthis;
+		double start = 0, offset = 0;
+		long replayed = 0;
+		int rv = SUCCESS;
+
+		php_stream_from_zval(s, &zstream);
+
+		if (SUCCESS != php_ircclient_replay_read(s, head, sizeof(head) TSRMLS_CC)
+		||	memcmp(head, PHP_IRCCLIENT_CAPTURE_MAGIC, sizeof(head))
+		) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "not a capture");
+			RETURN_FALSE;
+		}
+
+		obj->zthis = getThis();
+		obj->capture.replay = 1;
+		start = php_ircclient_now();
+
+		while (!EG(exception)) {
+			size_t n = php_stream_read(s, (char *) head, sizeof(head));
+
+			if (!n) {
+				break;
+			}
+			if (n < sizeof(head) && SUCCESS != php_ircclient_replay_read(s, head + n, sizeof(head) - n TSRMLS_CC)) {
+				rv = FAILURE;
+				break;
+			}
+			/* an appended capture starts over */
+			if (!memcmp(head, PHP_IRCCLIENT_CAPTURE_MAGIC, sizeof(head))) {
+				start = php_ircclient_now();
+				offset = 0;
+				continue;
+			}
+			if (speed > 0) {
+				double wait;
+
+				offset += (double) (((unsigned long) php_ircclient_replay_u16(head) << 16) | php_ircclient_replay_u16(head + 2)) / 1000000.0;
+				wait = start + offset / speed - php_ircclient_now();
+				if (wait > 0) {
+					struct timeval tv;
+
+					php_ircclient_session_select(obj, 0, NULL, NULL, php_ircclient_timeval(wait, &tv));
+				}
+			}
+			if (SUCCESS != php_ircclient_replay_record(obj, s, head, &buf TSRMLS_CC)) {
+				rv = FAILURE;
+				break;
+			}
+			++replayed;
+		}
+
+		obj->capture.replay = 0;
+		obj->zthis = zthis;
+		smart_str_free(&buf);
+
+		if (rv != SUCCESS) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "invalid or truncated capture after %ld records", replayed);
+			RETURN_FALSE;
+		}
+		RETURN_LONG(replayed);
+	}
+}
+/* }}} */
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_setTrace, 0, 0, 1)
+	ZEND_ARG_INFO(0, records)
+ZEND_END_ARG_INFO()
+/* {{{ proto void Session::setTrace(int records)
+	Keeps the last records events received, with the monotonic time,
+	origin and lengths of the first params, for Session::dumpTrace().
+	Cheap enough to be left on. 0 disables tracing; LIBIRC_OPTION_DEBUG
+	enables it with 1024 records unless set otherwise. At most 65536
+	records are kept. */
+PHP_METHOD(Session, setTrace)
+{
+	long size;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l", &size)) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+
+		if (size > PHP_IRCCLIENT_TRACE_MAX) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "keeping at most %d records", PHP_IRCCLIENT_TRACE_MAX);
+			size = PHP_IRCCLIENT_TRACE_MAX;
+		}
+		php_ircclient_trace_alloc(obj, size > 0 ? size : 0);
+	}
+}
+/* }}} */
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_dumpTrace, 0, 0, 0)
+	ZEND_ARG_INFO(0, stream)
+ZEND_END_ARG_INFO()
+/* {{{ proto mixed Session::dumpTrace([resource stream])
+	Returns the records of Session::setTrace(), oldest first, or writes them
+	to stream one per line and returns their number. */
+PHP_METHOD(Session, dumpTrace)
+{
+	zval *zstream = NULL;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "|r", &zstream)) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+		php_stream *s = NULL;
+		unsigned long i, n;
+
+		if (zstream) {
+			php_stream_from_zval(s, &zstream);
+		} else {
+			array_init(return_value);
+		}
+		if (!obj->trace.ring) {
+			if (s) {
+				RETURN_LONG(0);
+			}
+			return;
+		}
+
+		i = obj->trace.count > obj->trace.size ? obj->trace.count - obj->trace.size : 0;
+		for (n = 0; i < obj->trace.count; ++i, ++n) {
+			php_ircclient_trace_t *t = &obj->trace.ring[i % obj->trace.size];
+			unsigned int p;
+
+			if (s) {
+				php_stream_printf(s TSRMLS_CC, "%.6F %-15s %03u %-*s %u",
+						t->time, php_ircclient_events[t->ev].str, t->code,
+						PHP_IRCCLIENT_TRACE_ORIGIN - 1, *t->origin ? t->origin : "-", t->count);
+				for (p = 0; p < MIN(t->count, PHP_IRCCLIENT_TRACE_PARAMS); ++p) {
+					php_stream_printf(s TSRMLS_CC, " %u", t->lens[p]);
+				}
+				php_stream_write(s, "\n", 1);
+			} else {
+				zval *zt, *zlens;
+
+				MAKE_STD_ZVAL(zlens);
+				array_init_size(zlens, PHP_IRCCLIENT_TRACE_PARAMS);
+				for (p = 0; p < MIN(t->count, PHP_IRCCLIENT_TRACE_PARAMS); ++p) {
+					add_next_index_long(zlens, t->lens[p]);
+				}
+
+				MAKE_STD_ZVAL(zt);
+				array_init_size(zt, 6);
+				add_assoc_double_ex(zt, ZEND_STRS("time"), t->time);
+				add_assoc_stringl_ex(zt, ZEND_STRS("event"), (char *) php_ircclient_events[t->ev].str, php_ircclient_events[t->ev].len, 1);
+				add_assoc_long_ex(zt, ZEND_STRS("code"), t->code);
+				if (*t->origin) {
+					add_assoc_string_ex(zt, ZEND_STRS("origin"), t->origin, 1);
+				} else {
+					add_assoc_null_ex(zt, ZEND_STRS("origin"));
+				}
+				add_assoc_long_ex(zt, ZEND_STRS("count"), t->count);
+				add_assoc_zval_ex(zt, ZEND_STRS("lengths"), zlens);
+				add_next_index_zval(return_value, zt);
+			}
+		}
+		if (s) {
+			RETURN_LONG(n);
+		}
+	}
+}
+/* }}} */
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_setReconnect, 0, 0, 1)
+	ZEND_ARG_INFO(0, attempts)
+	ZEND_ARG_INFO(0, delay)
+	ZEND_ARG_INFO(0, max_delay)
+	ZEND_ARG_INFO(0, jitter)
+	ZEND_ARG_ARRAY_INFO(0, servers, 1)
 ZEND_END_ARG_INFO()
-/* {{{ proto void Session::__construct([string nick[, string user[, string real]]]) */
-PHP_METHOD(Session, __construct)
+/* {{{ proto void Session::setReconnect(int attempts[, double delay = 1[, double max_delay = 300[, double jitter = 0.25[, array servers = NULL]]]])
+	Lets Session::run() and SessionPool::run() connect again when the
+	connection is lost, but not after Session::doQuit() or disconnect().
+	attempts limits the attempts in a row, 0 disables reconnecting and a
+	negative number means no limit. The delay before each attempt doubles up
+	to max_delay, and varies by the jitter fraction either way. Attempts alternate between the server of
+	Session::doConnect() and the servers given as "host", "host:port",
+	"[ip6]" or "[ip6]:port".
+	The channels we were on are joined again after onConnect, unless it
+	joined them itself, as few per JOIN as possible and paced by
+	Session::setFloodControl(). */
+PHP_METHOD(Session, setReconnect)
 {
-	char *nick_str = NULL, *user_str = NULL, *real_str = NULL;
-	int nick_len = 0, user_len = 0, real_len = 0;
+	long attempts;
+	double delay = 1.0, max_delay = 300.0, jitter = 0.25;
+	zval *zservers = NULL;
 
-	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "|s!s!s!", &nick_str, &nick_len, &user_str, &user_len, &real_str, &real_len)) {
-		if (nick_str && nick_len) {
-			zend_update_property_stringl(php_ircclient_session_class_entry, getThis(), ZEND_STRL("nick"), nick_str, nick_len TSRMLS_CC);
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l|ddda!", &attempts, &delay, &max_delay, &jitter, &zservers)) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+
+		if (delay < 0 || max_delay < delay) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "invalid delay: %g, max_delay: %g", delay, max_delay);
+			return;
 		}
-		if (nick_str && nick_len) {
-			zend_update_property_stringl(php_ircclient_session_class_entry, getThis(), ZEND_STRL("nick"), nick_str, nick_len TSRMLS_CC);
+		if (jitter < 0 || jitter > 1) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "jitter must be between 0 and 1");
+			jitter = jitter < 0 ? 0 : 1;
 		}
-		if (real_str && real_len) {
-			zend_update_property_stringl(php_ircclient_session_class_entry, getThis(), ZEND_STRL("real"), real_str, real_len TSRMLS_CC);
+
+		if (obj->reconnect.servers) {
+			zval_ptr_dtor(&obj->reconnect.servers);
+			obj->reconnect.servers = NULL;
 		}
+		if (zservers && zend_hash_num_elements(Z_ARRVAL_P(zservers))) {
+			zval **zs;
+
+			MAKE_STD_ZVAL(obj->reconnect.servers);
+			array_init_size(obj->reconnect.servers, zend_hash_num_elements(Z_ARRVAL_P(zservers)));
+			for (	zend_hash_internal_pointer_reset(Z_ARRVAL_P(zservers));
+					SUCCESS == zend_hash_get_current_data(Z_ARRVAL_P(zservers), (void *) &zs);
+					zend_hash_move_forward(Z_ARRVAL_P(zservers))
+			) {
+				zval *tmp = *zs;
+
+				SEPARATE_ARG_IF_REF(tmp);
+				convert_to_string_ex(&tmp);
+				if (Z_STRLEN_P(tmp)) {
+					add_next_index_zval(obj->reconnect.servers, tmp);
+				} else {
+					zval_ptr_dtor(&tmp);
+				}
+			}
+		}
+
+		if (!(obj->reconnect.max = attempts)) {
+			obj->reconnect.due = 0;
+			obj->reconnect.attempts = 0;
+			zend_hash_clean(&obj->reconnect.channels);
+			zend_hash_clean(&obj->reconnect.rejoin);
+		}
+		obj->reconnect.delay = delay;
+		obj->reconnect.max_delay = max_delay;
+		obj->reconnect.jitter = jitter;
 	}
 }
 /* }}} */
 
-ZEND_BEGIN_ARG_INFO_EX(ai_Session_doConnect, 0, 0, 2)
-	ZEND_ARG_INFO(0, ip6)
-	ZEND_ARG_INFO(0, host)
-	ZEND_ARG_INFO(0, port)
-	ZEND_ARG_INFO(0, password)
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_dccAccept, 0, 0, 2)
+	ZEND_ARG_INFO(0, dccid)
+	ZEND_ARG_INFO(0, callback)
 ZEND_END_ARG_INFO()
-/* {{{ proto bool Session::doConnect(bool ip6, string host[, int port[, string password]])
-	Returns TRUE when the command was sent successfully. */
-PHP_METHOD(Session, doConnect)
+/* {{{ proto bool Session::dccAccept(int dccid, callable callback)
+	Accepts a DCC CHAT or SEND request of onDccChatReq or onDccSendReq.
+	Transfers run along with the IRC connection in Session::run(), where
+	callback(int dccid, int status, string data, int length) gets the
+	received data in chunks, or chat lines, as they arrive. A transfer
+	ends with NULL data and zero length, a chat is established that way;
+	either ends with a non-zero status on error or when closed.
+	Of more than 16 requests not answered, the oldest is declined.
+	Once irc\client\OPTION_MESSAGE_TAGS or OPTION_BATCH got message tags
+	enabled, requests arrive tagged and libircclient never sees them; they
+	are passed to onCtcpReq instead and cannot be accepted. */
+PHP_METHOD(Session, dccAccept)
 {
-	char *server_str, *passwd_str = NULL;
-	int server_len, passwd_len = 0;
-	long port = 6667;
-	zend_bool ip6;
+	long id;
+	zend_fcall_info fci;
+	zend_fcall_info_cache fcc;
 
-	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "bs|ls!", &ip6, &server_str, &server_len, &port, &passwd_str, &passwd_len)) {
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "lf", &id, &fci, &fcc)) {
 		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
-		char *nick = NULL, *user = NULL, *real = NULL;
-		zval *znick, *zuser, *zreal;
-
-		znick = zend_read_property(php_ircclient_session_class_entry, getThis(), ZEND_STRL("nick"), 0 TSRMLS_CC);
-		SEPARATE_ARG_IF_REF(znick);
-		convert_to_string_ex(&znick);
-		if (Z_STRLEN_P(znick)) {
-			nick = Z_STRVAL_P(znick);
-		}
-		zuser = zend_read_property(php_ircclient_session_class_entry, getThis(), ZEND_STRL("user"), 0 TSRMLS_CC);
-		SEPARATE_ARG_IF_REF(zuser);
-		convert_to_string_ex(&zuser);
-		if (Z_STRLEN_P(zuser)) {
-			user = Z_STRVAL_P(zuser);
-		}
-		zreal = zend_read_property(php_ircclient_session_class_entry, getThis(), ZEND_STRL("real"), 0 TSRMLS_CC);
-		SEPARATE_ARG_IF_REF(zreal);
-		convert_to_string_ex(&zreal);
-		if (Z_STRLEN_P(zreal)) {
-			real = Z_STRVAL_P(zreal);
-		}
-
-		if (ip6) {
-			if (0 != irc_connect6(obj->sess, server_str, port, passwd_str, nick, user, real)) {
-				php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
-				RETVAL_FALSE;
-			}
-		} else if (0 != irc_connect(obj->sess, server_str, port, passwd_str, nick, user, real)) {
+
+		php_ircclient_dcc_add(obj, id, -1, &fci, &fcc);
+		if (0 != irc_dcc_accept(obj->sess, id, NULL, php_ircclient_dcc_callback)) {
 			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
-			RETVAL_FALSE;
-		} else {
-			RETVAL_TRUE;
+			zend_hash_index_del(&obj->dcc, id);
+			RETURN_FALSE;
 		}
-
-		zval_ptr_dtor(&znick);
-		zval_ptr_dtor(&zuser);
-		zval_ptr_dtor(&zreal);
+		RETURN_TRUE;
 	}
 }
 /* }}} */
 
-/* {{{ proto bool Session::isConnected() */
-PHP_METHOD(Session, isConnected)
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_dccid, 0, 0, 1)
+	ZEND_ARG_INFO(0, dccid)
+ZEND_END_ARG_INFO()
+/* {{{ proto bool Session::dccDecline(int dccid)
+	Declines a DCC CHAT or SEND request. */
+PHP_METHOD(Session, dccDecline)
 {
-	if (SUCCESS == zend_parse_parameters_none()) {
+	long id;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l", &id)) {
 		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
 
-		RETURN_BOOL(irc_is_connected(obj->sess));
+		zend_hash_index_del(&obj->dcc, id);
+		if (0 != irc_dcc_decline(obj->sess, id)) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
+			RETURN_FALSE;
+		}
+		RETURN_TRUE;
 	}
 }
 /* }}} */
 
-/* {{{ proto void Session::disconnect() */
-PHP_METHOD(Session, disconnect)
+/* {{{ proto bool Session::dccDestroy(int dccid)
+	Closes a DCC; its callback is not called anymore. */
+PHP_METHOD(Session, dccDestroy)
 {
-	if (SUCCESS == zend_parse_parameters_none()) {
+	long id;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l", &id)) {
 		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
 
-		irc_disconnect(obj->sess);
+		zend_hash_index_del(&obj->dcc, id);
+		if (0 != irc_dcc_destroy(obj->sess, id)) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
+			RETURN_FALSE;
+		}
+		RETURN_TRUE;
 	}
 }
 /* }}} */
 
-ZEND_BEGIN_ARG_INFO_EX(ai_Session_run, 0, 0, 0)
-	ZEND_ARG_INFO(0, read_fd_array_for_select)
-	ZEND_ARG_INFO(0, write_fd_array_for_select)
-	ZEND_ARG_INFO(0, timeout_seconds)
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_dccChat, 0, 0, 2)
+	ZEND_ARG_INFO(0, nick)
+	ZEND_ARG_INFO(0, callback)
 ZEND_END_ARG_INFO()
-/* {{{ proto array Session::run([array read_fds_for_select[, array write_fds_for_select[, double timeout = null]]])
-	Returns array(array of readable fds, array of writeable fds) or false on error. */
-PHP_METHOD(Session, run)
+/* {{{ proto int Session::dccChat(string nick, callable callback)
+	Offers nick a DCC CHAT; see Session::dccAccept() for the callback.
+	Returns the DCC id, or FALSE on error. */
+PHP_METHOD(Session, dccChat)
 {
-	HashTable *ifds = NULL, *ofds = NULL;
-	double to = php_get_inf();
-	int connected;
+	char *nick_str;
+	int nick_len;
+	zend_fcall_info fci;
+	zend_fcall_info_cache fcc;
 
-	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "|H!H!d", &ifds, &ofds, &to)) {
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "sf", &nick_str, &nick_len, &fci, &fcc)) {
 		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+		irc_dcc_t id;
 
-		if (ifds || ofds) {
-			struct timeval t, *tp = NULL;
-			fd_set i, o;
-			int m = 0;
-			zval **zfd, *zr, *zw;
-
-			FD_ZERO(&i);
-			FD_ZERO(&o);
-
-			if ((connected = irc_is_connected(obj->sess))) {
-				if (0 != irc_add_select_descriptors(obj->sess, &i, &o, &m)) {
-					php_error_docref(NULL TSRMLS_CC, E_WARNING, "irc_add_select_descriptors: %s", irc_strerror(irc_errno(obj->sess)));
-					RETURN_FALSE;
-				}
-			}
-			if (ifds) {
-				for (	zend_hash_internal_pointer_reset(ifds);
-						SUCCESS == zend_hash_get_current_data(ifds, (void *) &zfd);
-						zend_hash_move_forward(ifds)
-				) {
-					if (Z_TYPE_PP(zfd) == IS_RESOURCE) {
-						php_stream *s = NULL;
-						int fd = -1;
-
-						php_stream_from_zval_no_verify(s, zfd);
-
-						if (!s || SUCCESS != php_stream_cast(s, PHP_STREAM_AS_FD_FOR_SELECT, (void *) &fd, 1) || fd == -1) {
-							php_error_docref(NULL TSRMLS_CC, E_NOTICE, "invalid resource");
-						} else {
-							PHP_SAFE_FD_SET(fd, &i);
-							if (m < fd) {
-								m = fd;
-							}
-						}
-					}
-				}
-			}
-			if (ofds) {
-				for (	zend_hash_internal_pointer_reset(ofds);
-						SUCCESS == zend_hash_get_current_data(ofds, (void *) &zfd);
-						zend_hash_move_forward(ofds)
-				) {
-					if (Z_TYPE_PP(zfd) == IS_RESOURCE) {
-						php_stream *s = NULL;
-						int fd = -1;
-
-						php_stream_from_zval_no_verify(s, zfd);
-
-						if (!s || SUCCESS != php_stream_cast(s, PHP_STREAM_AS_FD_FOR_SELECT|PHP_STREAM_CAST_INTERNAL, (void *) &fd, 1) || fd == -1) {
-							php_error_docref(NULL TSRMLS_CC, E_NOTICE, "invalid resource");
-						} else {
-							PHP_SAFE_FD_SET(fd, &o);
-							if (m < fd) {
-								m = fd;
-							}
-						}
-					}
-				}
-			}
-
-			PHP_SAFE_MAX_FD(m, m);
-			array_init(return_value);
-
-			if (to != php_get_inf()) {
-				t.tv_sec = (time_t) to;
-				t.tv_usec = (suseconds_t) ((to - t.tv_sec) * 1000000.0);
-				tp = &t;
-			}
-
-			if (0 > select(m + 1, &i, &o, NULL, tp)) {
-				if (errno == EINTR) {
-					/* interrupt; let userland be able to handle signals etc. */
-					return;
-				}
+		if (0 != irc_dcc_chat(obj->sess, NULL, nick_str, php_ircclient_dcc_callback, &id)) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
+			RETURN_FALSE;
+		}
+		php_ircclient_dcc_add(obj, id, 1, &fci, &fcc);
+		RETURN_LONG(id);
+	}
+}
+/* }}} */
 
-				php_error_docref(NULL TSRMLS_CC, E_WARNING, "select() error: %s", strerror(errno));
-				RETURN_FALSE;
-			}
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_dccMsg, 0, 0, 2)
+	ZEND_ARG_INFO(0, dccid)
+	ZEND_ARG_INFO(0, message)
+ZEND_END_ARG_INFO()
+/* {{{ proto bool Session::dccMsg(int dccid, string message)
+	Sends a line over a DCC CHAT. */
+PHP_METHOD(Session, dccMsg)
+{
+	long id;
+	char *msg_str;
+	int msg_len;
 
-			if (connected) {
-				if (0 != irc_process_select_descriptors(obj->sess, &i, &o)) {
-					int err = irc_errno(obj->sess);
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ls", &id, &msg_str, &msg_len)) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
 
-					if (err) {
-						php_error_docref(NULL TSRMLS_CC, E_WARNING, "irc_process: %s", irc_strerror(err));
-						RETURN_FALSE;
-					}
-				}
-			}
+		if (0 != irc_dcc_msg(obj->sess, id, msg_str)) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
+			RETURN_FALSE;
+		}
+		RETURN_TRUE;
+	}
+}
+/* }}} */
 
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_dccSendFile, 0, 0, 3)
+	ZEND_ARG_INFO(0, nick)
+	ZEND_ARG_INFO(0, filename)
+	ZEND_ARG_INFO(0, callback)
+ZEND_END_ARG_INFO()
+/* {{{ proto int Session::dccSendFile(string nick, string filename, callable callback)
+	Offers nick a file by DCC SEND. The file is read and sent by libircclient
+	in Session::run(), its contents never become a PHP string. The callback
+	gets NULL data and the number of bytes acknowledged so far as length,
+	zero length when the transfer is complete, or a non-zero status on
+	error. Returns the DCC id, or FALSE on error. */
+PHP_METHOD(Session, dccSendFile)
+{
+	char *nick_str, *file_str;
+	int nick_len, file_len;
+	zend_fcall_info fci;
+	zend_fcall_info_cache fcc;
 
-			MAKE_STD_ZVAL(zr);
-			array_init(zr);
-			MAKE_STD_ZVAL(zw);
-			array_init(zw);
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ssf", &nick_str, &nick_len, &file_str, &file_len, &fci, &fcc)) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+		irc_dcc_t id;
 
-			if (ifds) {
-				for (	zend_hash_internal_pointer_reset(ifds);
-						SUCCESS == zend_hash_get_current_data(ifds, (void *) &zfd);
-						zend_hash_move_forward(ifds)
-				) {
-					if (Z_TYPE_PP(zfd) == IS_RESOURCE) {
-						php_stream *s = NULL;
-						int fd = -1;
+		if (strlen(file_str) != (size_t) file_len || php_check_open_basedir(file_str TSRMLS_CC)) {
+			RETURN_FALSE;
+		}
+		if (0 != irc_dcc_sendfile(obj->sess, NULL, nick_str, file_str, php_ircclient_dcc_callback, &id)) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
+			RETURN_FALSE;
+		}
+		php_ircclient_dcc_add(obj, id, 0, &fci, &fcc);
+		RETURN_LONG(id);
+	}
+}
+/* }}} */
 
-						php_stream_from_zval_no_verify(s, zfd);
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_dccReceive, 0, 0, 2)
+	ZEND_ARG_INFO(0, dccid)
+	ZEND_ARG_INFO(0, stream)
+	ZEND_ARG_INFO(0, callback)
+	ZEND_ARG_INFO(0, buffer)
+ZEND_END_ARG_INFO()
+/* {{{ proto bool Session::dccReceive(int dccid, resource stream[, callable callback[, int buffer = 65536]])
+	Accepts a DCC SEND request of onDccSendReq and writes the file to stream
+	as it arrives, without calling back into PHP for every chunk. Up to
+	buffer bytes the stream does not take right away are kept until it is
+	writable again; when the buffer runs full, reading of DCC data pauses
+	until it drains. The callback, if any, is only called at the end with
+	NULL data and the total number of bytes received as length; a failed
+	write to stream ends the transfer with LIBIRC_ERR_WRITE as status. */
+PHP_METHOD(Session, dccReceive)
+{
+	long id, size = 65536;
+	zval *zstream;
+	zend_fcall_info fci = empty_fcall_info;
+	zend_fcall_info_cache fcc = empty_fcall_info_cache;
 
-						if (s && SUCCESS == php_stream_cast(s, PHP_STREAM_AS_FD_FOR_SELECT|PHP_STREAM_CAST_INTERNAL, (void *) &fd, 1) && fd != -1) {
-							if (PHP_SAFE_FD_ISSET(fd, &i)) {
-								Z_ADDREF_PP(zfd);
-								add_next_index_zval(zr, *zfd);
-							}
-						}
-					}
-				}
-			}
-			if (ofds) {
-				for (	zend_hash_internal_pointer_reset(ofds);
-						SUCCESS == zend_hash_get_current_data(ofds, (void *) &zfd);
-						zend_hash_move_forward(ofds)
-				) {
-					if (Z_TYPE_PP(zfd) == IS_RESOURCE) {
-						php_stream *s = NULL;
-						int fd = -1;
-
-						php_stream_from_zval_no_verify(s, zfd);
-
-						if (s && SUCCESS == php_stream_cast(s, PHP_STREAM_AS_FD_FOR_SELECT|PHP_STREAM_CAST_INTERNAL, (void *) &fd, 1) && fd != -1) {
-							if (PHP_SAFE_FD_ISSET(fd, &o)) {
-								Z_ADDREF_PP(zfd);
-								add_next_index_zval(zw, *zfd);
-							}
-						}
-					}
-				}
-			}
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "lr|f!l", &id, &zstream, &fci, &fcc, &size)) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+		php_ircclient_dcc_t *dcc;
+		php_stream *s = NULL;
 
-			add_next_index_zval(return_value, zr);
-			add_next_index_zval(return_value, zw);
+		php_stream_from_zval(s, &zstream);
 
-			return;
+		if (size < PHP_IRCCLIENT_DCC_CHUNK) {
+			size = PHP_IRCCLIENT_DCC_CHUNK;
+		}
+		if (SUCCESS == zend_hash_index_find(&obj->dcc, id, (void *) &dcc) && dcc->chat) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "DCC %ld is a chat", id);
+			RETURN_FALSE;
+		}
 
-		} else {
-			if (0 != irc_run(obj->sess)) {
-				int err = irc_errno(obj->sess);
+		dcc = php_ircclient_dcc_add(obj, id, -1, ZEND_FCI_INITIALIZED(fci) ? &fci : NULL, &fcc);
+		dcc->zstream = zstream;
+		Z_ADDREF_P(zstream);
+		dcc->stream = s;
+		dcc->size = size;
+		dcc->ring = emalloc(size);
 
-				if (err) {
-					php_error_docref(NULL TSRMLS_CC, E_WARNING, "irc_run: %s", irc_strerror(err));
-					RETURN_FALSE;
-				}
-			}
+		if (0 != irc_dcc_accept(obj->sess, id, NULL, php_ircclient_dcc_callback)) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
+			zend_hash_index_del(&obj->dcc, id);
+			RETURN_FALSE;
 		}
-
 		RETURN_TRUE;
 	}
 }
 /* }}} */
 
-ZEND_BEGIN_ARG_INFO_EX(ai_Session_setOption, 0, 0, 1)
-	ZEND_ARG_INFO(0, option)
-	ZEND_ARG_INFO(0, enable)
-ZEND_END_ARG_INFO()
-/* {{{ proto void Session::setOption(int option[, bool enable = true]) */
-PHP_METHOD(Session, setOption)
+/* {{{ proto array Session::dccProgress(int dccid)
+	Returns the numbers of bytes received, written and still buffered of a
+	transfer started by Session::dccReceive(), or FALSE if there is none. */
+PHP_METHOD(Session, dccProgress)
 {
-	long opt;
-	zend_bool onoff = 1;
+	long id;
 
-	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l|b", &opt, &onoff)) {
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "l", &id)) {
 		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+		php_ircclient_dcc_t *dcc;
 
-		if (onoff) {
-			obj->opts |= opt;
-			irc_option_set(obj->sess, opt);
-		} else {
-			obj->opts ^= opt;
-			irc_option_reset(obj->sess, opt);
+		if (SUCCESS != zend_hash_index_find(&obj->dcc, id, (void *) &dcc) || !dcc->zstream) {
+			RETURN_FALSE;
 		}
+		array_init(return_value);
+		add_assoc_long_ex(return_value, ZEND_STRS("received"), dcc->received);
+		add_assoc_long_ex(return_value, ZEND_STRS("written"), dcc->written);
+		add_assoc_long_ex(return_value, ZEND_STRS("buffered"), dcc->len);
 	}
 }
 /* }}} */
@@ -693,12 +6075,9 @@ PHP_METHOD(Session, doJoin)
 	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s|s!", &chan_str, &chan_len, &key_str, &key_len)) {
 		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
 
-		if (0 != irc_cmd_join(obj->sess, chan_str, key_str)) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
-			RETVAL_FALSE;
-		} else {
-			RETVAL_TRUE;
-		}
+		php_ircclient_rejoin_list(obj, chan_str, key_str, 1);
+
+		RETVAL_BOOL(SUCCESS == php_ircclient_session_send(obj, PHP_IRCCLIENT_PRIORITY_NORMAL, "JOIN %s%s%s", chan_str, key_str ? " :" : "", key_str ? key_str : ""));
 	}
 }
 /* }}} */
@@ -716,12 +6095,9 @@ PHP_METHOD(Session, doPart)
 	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &chan_str, &chan_len)) {
 		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
 
-		if (0 != irc_cmd_part(obj->sess, chan_str)) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
-			RETVAL_FALSE;
-		} else {
-			RETVAL_TRUE;
-		}
+		php_ircclient_rejoin_list(obj, chan_str, NULL, 0);
+
+		RETVAL_BOOL(SUCCESS == php_ircclient_session_send(obj, PHP_IRCCLIENT_PRIORITY_NORMAL, "PART %s", chan_str));
 	}
 }
 /* }}} */
@@ -740,12 +6116,7 @@ PHP_METHOD(Session, doInvite)
 	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ss", &nick_str, &nick_len, &chan_str, &chan_len)) {
 		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
 
-		if (0 != irc_cmd_invite(obj->sess, nick_str, chan_str)) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
-			RETVAL_FALSE;
-		} else {
-			RETVAL_TRUE;
-		}
+		RETVAL_BOOL(SUCCESS == php_ircclient_session_send(obj, PHP_IRCCLIENT_PRIORITY_NORMAL, "INVITE %s %s", nick_str, chan_str));
 	}
 }
 /* }}} */
@@ -763,12 +6134,7 @@ PHP_METHOD(Session, doNames)
 	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &chan_str, &chan_len)) {
 		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
 
-		if (0 != irc_cmd_names(obj->sess, chan_str)) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
-			RETVAL_FALSE;
-		} else {
-			RETVAL_TRUE;
-		}
+		RETVAL_BOOL(SUCCESS == php_ircclient_session_send(obj, PHP_IRCCLIENT_PRIORITY_NORMAL, "NAMES %s", chan_str));
 	}
 }
 /* }}} */
@@ -786,12 +6152,7 @@ PHP_METHOD(Session, doList)
 	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &chan_str, &chan_len)) {
 		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
 
-		if (0 != irc_cmd_list(obj->sess, chan_str)) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
-			RETVAL_FALSE;
-		} else {
-			RETVAL_TRUE;
-		}
+		RETVAL_BOOL(SUCCESS == php_ircclient_session_send(obj, PHP_IRCCLIENT_PRIORITY_NORMAL, "LIST %s", chan_str));
 	}
 }
 /* }}} */
@@ -810,12 +6171,7 @@ PHP_METHOD(Session, doTopic)
 	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s|s!", &chan_str, &chan_len, &topic_str, &topic_len)) {
 		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
 
-		if (0 != irc_cmd_topic(obj->sess, chan_str, topic_str)) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
-			RETVAL_FALSE;
-		} else {
-			RETVAL_TRUE;
-		}
+		RETVAL_BOOL(SUCCESS == php_ircclient_session_send(obj, PHP_IRCCLIENT_PRIORITY_NORMAL, "TOPIC %s%s%s", chan_str, topic_str ? " :" : "", topic_str ? topic_str : ""));
 	}
 }
 /* }}} */
@@ -834,12 +6190,7 @@ PHP_METHOD(Session, doChannelMode)
 	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s|s!", &chan_str, &chan_len, &mode_str, &mode_len)) {
 		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
 
-		if (0 != irc_cmd_channel_mode(obj->sess, chan_str, mode_str)) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
-			RETVAL_FALSE;
-		} else {
-			RETVAL_TRUE;
-		}
+		RETVAL_BOOL(SUCCESS == php_ircclient_session_send(obj, PHP_IRCCLIENT_PRIORITY_HIGH, "MODE %s%s%s", chan_str, mode_str ? " " : "", mode_str ? mode_str : ""));
 	}
 }
 /* }}} */
@@ -859,12 +6210,7 @@ PHP_METHOD(Session, doKick)
 	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ss|s!", &nick_str, &nick_len, &chan_str, &chan_len, &reason_str, &reason_len)) {
 		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
 
-		if (0 != irc_cmd_kick(obj->sess, nick_str, chan_str, reason_str)) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
-			RETVAL_FALSE;
-		} else {
-			RETVAL_TRUE;
-		}
+		RETVAL_BOOL(SUCCESS == php_ircclient_session_send(obj, PHP_IRCCLIENT_PRIORITY_HIGH, "KICK %s %s%s%s", chan_str, nick_str, reason_str ? " :" : "", reason_str ? reason_str : ""));
 	}
 }
 /* }}} */
@@ -883,12 +6229,7 @@ PHP_METHOD(Session, doMsg)
 	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ss", &dest_str, &dest_len, &msg_str, &msg_len)) {
 		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
 
-		if (0 != irc_cmd_msg(obj->sess, dest_str, msg_str)) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
-			RETVAL_FALSE;
-		} else {
-			RETVAL_TRUE;
-		}
+		RETVAL_BOOL(SUCCESS == php_ircclient_session_send(obj, PHP_IRCCLIENT_PRIORITY_LOW, "PRIVMSG %s :%s", dest_str, msg_str));
 	}
 }
 /* }}} */
@@ -907,12 +6248,7 @@ PHP_METHOD(Session, doMe)
 	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ss", &dest_str, &dest_len, &msg_str, &msg_len)) {
 		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
 
-		if (0 != irc_cmd_me(obj->sess, dest_str, msg_str)) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
-			RETVAL_FALSE;
-		} else {
-			RETVAL_TRUE;
-		}
+		RETVAL_BOOL(SUCCESS == php_ircclient_session_send(obj, PHP_IRCCLIENT_PRIORITY_LOW, "PRIVMSG %s :\001ACTION %s\001", dest_str, msg_str));
 	}
 }
 /* }}} */
@@ -931,12 +6267,97 @@ PHP_METHOD(Session, doNotice)
 	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ss", &dest_str, &dest_len, &msg_str, &msg_len)) {
 		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
 
-		if (0 != irc_cmd_notice(obj->sess, dest_str, msg_str)) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
-			RETVAL_FALSE;
+		RETVAL_BOOL(SUCCESS == php_ircclient_session_send(obj, PHP_IRCCLIENT_PRIORITY_LOW, "NOTICE %s :%s", dest_str, msg_str));
+	}
+}
+/* }}} */
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_doMsgMany, 0, 0, 2)
+	ZEND_ARG_ARRAY_INFO(0, destinations, 0)
+	ZEND_ARG_INFO(0, message)
+ZEND_END_ARG_INFO()
+/* {{{ proto int Session::doMsgMany(array destinations, mixed message)
+	Sends a message, or an array of messages, to all destinations with as
+	few PRIVMSG lines as the server's TARGMAX and the line length allow.
+	The lines go through the send queue at irc\client\PRIORITY_LOW.
+	Returns the number of lines queued. */
+PHP_METHOD(Session, doMsgMany)
+{
+	HashTable *dests;
+	zval *zmsg;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "Hz", &dests, &zmsg)) {
+		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+		long targmax = php_ircclient_session_targmax(obj), lines = 0;
+		HashPosition mpos, dpos;
+		HashTable *msgs;
+		zval **zm, **zd, *zarr = NULL;
+		smart_str to = {0};
+
+		if (Z_TYPE_P(zmsg) == IS_ARRAY) {
+			msgs = Z_ARRVAL_P(zmsg);
 		} else {
-			RETVAL_TRUE;
+			MAKE_STD_ZVAL(zarr);
+			array_init(zarr);
+			Z_ADDREF_P(zmsg);
+			add_next_index_zval(zarr, zmsg);
+			msgs = Z_ARRVAL_P(zarr);
+		}
+
+		for (	zend_hash_internal_pointer_reset_ex(msgs, &mpos);
+				SUCCESS == zend_hash_get_current_data_ex(msgs, (void *) &zm, &mpos);
+				zend_hash_move_forward_ex(msgs, &mpos)
+		) {
+			zval msg = **zm;
+			/* 512 bytes minus CRLF, "PRIVMSG " and " :" */
+			long room, n = 0;
+
+			zval_copy_ctor(&msg);
+			convert_to_string(&msg);
+			room = 510 - 10 - Z_STRLEN(msg);
+
+			for (	zend_hash_internal_pointer_reset_ex(dests, &dpos);
+					SUCCESS == zend_hash_get_current_data_ex(dests, (void *) &zd, &dpos);
+					zend_hash_move_forward_ex(dests, &dpos)
+			) {
+				zval dest = **zd;
+
+				zval_copy_ctor(&dest);
+				convert_to_string(&dest);
+
+				if (Z_STRLEN(dest)) {
+					if (n && ((targmax && n >= targmax) || (long) (to.len + 1 + Z_STRLEN(dest)) > room)) {
+						if (SUCCESS == php_ircclient_queue_push(obj, PHP_IRCCLIENT_PRIORITY_LOW, "PRIVMSG %.*s :%s", (int) to.len, to.c, Z_STRVAL(msg))) {
+							++lines;
+						}
+						to.len = 0;
+						n = 0;
+					}
+					if (n++) {
+						smart_str_appendc(&to, ',');
+					}
+					smart_str_appendl(&to, Z_STRVAL(dest), Z_STRLEN(dest));
+				}
+				zval_dtor(&dest);
+			}
+			if (n) {
+				if (SUCCESS == php_ircclient_queue_push(obj, PHP_IRCCLIENT_PRIORITY_LOW, "PRIVMSG %.*s :%s", (int) to.len, to.c, Z_STRVAL(msg))) {
+					++lines;
+				}
+				to.len = 0;
+			}
+			zval_dtor(&msg);
+		}
+
+		smart_str_free(&to);
+		if (zarr) {
+			zval_ptr_dtor(&zarr);
 		}
+
+		/* without flood control this is as far as it goes right now */
+		php_ircclient_queue_drain(obj);
+
+		RETURN_LONG(lines);
 	}
 }
 /* }}} */
@@ -954,12 +6375,11 @@ PHP_METHOD(Session, doQuit)
 	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "|s!", &reason_str, &reason_len)) {
 		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
 
-		if (0 != irc_cmd_quit(obj->sess, reason_str)) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
-			RETVAL_FALSE;
-		} else {
-			RETVAL_TRUE;
-		}
+		/* no reconnecting after the server closed the link */
+		obj->reconnect.quit = 1;
+
+		/* the default reason of libircclient's irc_cmd_quit() */
+		RETVAL_BOOL(SUCCESS == php_ircclient_session_send(obj, PHP_IRCCLIENT_SEND_NOW, "QUIT :%s", reason_str ? reason_str : "quit"));
 	}
 }
 /* }}} */
@@ -977,11 +6397,12 @@ PHP_METHOD(Session, doUserMode)
 	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "|s!", &mode_str, &mode_len)) {
 		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
 
-		if (0 != irc_cmd_user_mode(obj->sess, mode_str)) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
+		/* our own nick is only known once connected */
+		if (!obj->track.self) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(LIBIRC_ERR_STATE));
 			RETVAL_FALSE;
 		} else {
-			RETVAL_TRUE;
+			RETVAL_BOOL(SUCCESS == php_ircclient_session_send(obj, PHP_IRCCLIENT_SEND_NOW, "MODE %s%s%s", obj->track.self, mode_str ? " " : "", mode_str ? mode_str : ""));
 		}
 	}
 }
@@ -1000,12 +6421,7 @@ PHP_METHOD(Session, doNick)
 	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &nick_str, &nick_len)) {
 		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
 
-		if (0 != irc_cmd_nick(obj->sess, nick_str)) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
-			RETVAL_FALSE;
-		} else {
-			RETVAL_TRUE;
-		}
+		RETVAL_BOOL(SUCCESS == php_ircclient_session_send(obj, PHP_IRCCLIENT_PRIORITY_HIGH, "NICK %s", nick_str));
 	}
 }
 /* }}} */
@@ -1023,11 +6439,12 @@ PHP_METHOD(Session, doWhois)
 	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "|s!", &nick_str, &nick_len)) {
 		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
 
-		if (0 != irc_cmd_whois(obj->sess, nick_str)) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
+		/* as libircclient's irc_cmd_whois() would */
+		if (!nick_str) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(LIBIRC_ERR_INVAL));
 			RETVAL_FALSE;
 		} else {
-			RETVAL_TRUE;
+			RETVAL_BOOL(SUCCESS == php_ircclient_session_send(obj, PHP_IRCCLIENT_PRIORITY_NORMAL, "WHOIS %s %s", nick_str, nick_str));
 		}
 	}
 }
@@ -1047,12 +6464,7 @@ PHP_METHOD(Session, doCtcpReply)
 	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ss", &nick_str, &nick_len, &reply_str, &reply_len)) {
 		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
 
-		if (0 != irc_cmd_ctcp_reply(obj->sess, nick_str, reply_str)) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
-			RETVAL_FALSE;
-		} else {
-			RETVAL_TRUE;
-		}
+		RETVAL_BOOL(SUCCESS == php_ircclient_session_send(obj, PHP_IRCCLIENT_PRIORITY_NORMAL, "NOTICE %s :\001%s\001", nick_str, reply_str));
 	}
 }
 /* }}} */
@@ -1071,35 +6483,34 @@ PHP_METHOD(Session, doCtcpRequest)
 	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "ss", &nick_str, &nick_len, &request_str, &request_len)) {
 		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
 
-		if (0 != irc_cmd_ctcp_request(obj->sess, nick_str, request_str)) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
-			RETVAL_FALSE;
-		} else {
-			RETVAL_TRUE;
-		}
+		RETVAL_BOOL(SUCCESS == php_ircclient_session_send(obj, PHP_IRCCLIENT_PRIORITY_NORMAL, "PRIVMSG %s :\001%s\001", nick_str, request_str));
 	}
 }
 /* }}} */
 
 ZEND_BEGIN_ARG_INFO_EX(ai_Session_doRaw, 0, 0, 1)
 	ZEND_ARG_INFO(0, message)
+	ZEND_ARG_INFO(0, priority)
 ZEND_END_ARG_INFO()
-/* {{{ proto bool Session::doRaw(string message)
+/* {{{ proto bool Session::doRaw(string message[, int priority = irc\client\PRIORITY_NORMAL])
+	The priority only matters with flood control enabled. Lines of 1024
+	bytes or more are rejected.
 	Returns TRUE when the command was sent successfully. */
 PHP_METHOD(Session, doRaw)
 {
 	char *msg_str;
 	int msg_len;
+	long prio = PHP_IRCCLIENT_PRIORITY_NORMAL;
 
-	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &msg_str, &msg_len)) {
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s|l", &msg_str, &msg_len, &prio)) {
 		php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
 
-		if (0 != irc_send_raw(obj->sess, "%.*s", msg_len, msg_str)) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", irc_strerror(irc_errno(obj->sess)));
-			RETVAL_FALSE;
-		} else {
-			RETVAL_TRUE;
+		if (prio < PHP_IRCCLIENT_PRIORITY_HIGH || prio > PHP_IRCCLIENT_PRIORITY_LOW) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "invalid priority: %ld", prio);
+			RETURN_FALSE;
 		}
+
+		RETVAL_BOOL(SUCCESS == php_ircclient_session_send(obj, prio, "%.*s", msg_len, msg_str));
 	}
 }
 /* }}} */
@@ -1109,6 +6520,11 @@ ZEND_BEGIN_ARG_INFO_EX(ai_Session_event, 0, 0, 2)
 	ZEND_ARG_INFO(0, origin)
 	ZEND_ARG_ARRAY_INFO(0, args, 0)
 ZEND_END_ARG_INFO()
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_event_unknown, 0, 0, 2)
+	ZEND_ARG_INFO(0, origin)
+	ZEND_ARG_ARRAY_INFO(0, args, 0)
+	ZEND_ARG_INFO(0, event)
+ZEND_END_ARG_INFO()
 ZEND_BEGIN_ARG_INFO_EX(ai_Session_event_code, 0, 0, 3)
 	ZEND_ARG_INFO(0, origin)
 	ZEND_ARG_INFO(0, event)
@@ -1127,58 +6543,105 @@ ZEND_BEGIN_ARG_INFO_EX(ai_Session_event_dcc_send, 0, 0, 5)
 	ZEND_ARG_INFO(0, dccid)
 ZEND_END_ARG_INFO()
 
-static void call_closure(INTERNAL_FUNCTION_PARAMETERS, /* stupid non-const API */ char *prop_str, size_t prop_len)
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_event_names, 0, 0, 2)
+	ZEND_ARG_INFO(0, channel)
+	ZEND_ARG_ARRAY_INFO(0, users, 0)
+ZEND_END_ARG_INFO()
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_event_whois, 0, 0, 2)
+	ZEND_ARG_INFO(0, nick)
+	ZEND_ARG_ARRAY_INFO(0, info, 0)
+ZEND_END_ARG_INFO()
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_event_list, 0, 0, 1)
+	ZEND_ARG_ARRAY_INFO(0, channels, 0)
+ZEND_END_ARG_INFO()
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_event_batch, 0, 0, 3)
+	ZEND_ARG_INFO(0, type)
+	ZEND_ARG_ARRAY_INFO(0, params, 0)
+	ZEND_ARG_ARRAY_INFO(0, messages, 0)
+ZEND_END_ARG_INFO()
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_event_slow_handler, 0, 0, 2)
+	ZEND_ARG_INFO(0, handler)
+	ZEND_ARG_INFO(0, seconds)
+ZEND_END_ARG_INFO()
+ZEND_BEGIN_ARG_INFO_EX(ai_Session_event_banlist, 0, 0, 2)
+	ZEND_ARG_INFO(0, channel)
+	ZEND_ARG_ARRAY_INFO(0, bans, 0)
+ZEND_END_ARG_INFO()
+
+static void call_closure(INTERNAL_FUNCTION_PARAMETERS, php_ircclient_event_t ev)
 {
-	zval **params = ecalloc(ZEND_NUM_ARGS(), sizeof(zval *));
 	php_ircclient_session_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
-
-	if (obj->opts & LIBIRC_OPTION_DEBUG) {
-		zval za;
-
-		INIT_PZVAL(&za);
-		array_init(&za);
-
-		if (SUCCESS == zend_copy_parameters_array(ZEND_NUM_ARGS(), &za TSRMLS_CC)) {
-			php_printf("ircclient: %s - ", prop_str);
-			zend_print_flat_zval_r(&za TSRMLS_CC);
-			php_printf("\n");
+	php_ircclient_session_callback_t *cb = &obj->cbc[ev];
+	zval ***params = ecalloc(ZEND_NUM_ARGS(), sizeof(zval **));
+
+	if (SUCCESS == zend_get_parameters_array_ex(ZEND_NUM_ARGS(), params)) {
+		switch (php_ircclient_session_property(obj, getThis(), ev TSRMLS_CC)) {
+		case PHP_IRCCLIENT_PROPERTY_NULL:
+			break;
+		case PHP_IRCCLIENT_PROPERTY_CACHED: {
+			zend_fcall_info fci = cb->pfci;
+			zend_fcall_info_cache fcc = cb->pfcc;
+			/* the handler might replace itself */
+			zval *zcb = cb->zprop, *retval = NULL;
+
+			Z_ADDREF_P(zcb);
+			fci.retval_ptr_ptr = &retval;
+			fci.param_count = ZEND_NUM_ARGS();
+			fci.params = params;
+			zend_call_function(&fci, &fcc TSRMLS_CC);
+			if (retval) {
+				RETVAL_ZVAL(retval, 1, 1);
+			}
+			zval_ptr_dtor(&zcb);
+			break;
+		}
+		default: {
+			/* referenced, or not callable, which call_user_function_ex() complains about */
+			zval *prop = zend_read_property(Z_OBJCE_P(getThis()), getThis(), php_ircclient_events[ev].str, php_ircclient_events[ev].len, 0 TSRMLS_CC);
+			zval *retval = NULL;
+
+			if (Z_TYPE_P(prop) != IS_NULL) {
+				call_user_function_ex(NULL, NULL, prop, &retval, ZEND_NUM_ARGS(), params, 0, NULL TSRMLS_CC);
+				if (retval) {
+					RETVAL_ZVAL(retval, 1, 1);
+				}
+			}
+			break;
 		}
-		zval_dtor(&za);
-	}
-
-	if (SUCCESS == zend_get_parameters_array(ZEND_NUM_ARGS(), ZEND_NUM_ARGS(), params)) {
-		zval *prop = zend_read_property(Z_OBJCE_P(getThis()), getThis(), prop_str, prop_len, 0 TSRMLS_CC);
-
-		if (Z_TYPE_P(prop) != IS_NULL) {
-			call_user_function(NULL, NULL, prop, return_value, ZEND_NUM_ARGS(), params TSRMLS_CC);
 		}
 	}
 
 	efree(params);
 }
 
-PHP_METHOD(Session, onConnect) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, ZEND_STRL("onConnect")); }
-PHP_METHOD(Session, onNick) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, ZEND_STRL("onNick")); }
-PHP_METHOD(Session, onQuit) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, ZEND_STRL("onQuit")); }
-PHP_METHOD(Session, onJoin) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, ZEND_STRL("onJoin")); }
-PHP_METHOD(Session, onPart) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, ZEND_STRL("onPart")); }
-PHP_METHOD(Session, onMode) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, ZEND_STRL("onMode")); }
-PHP_METHOD(Session, onUmode) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, ZEND_STRL("onUmode")); }
-PHP_METHOD(Session, onTopic) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, ZEND_STRL("onTopic")); }
-PHP_METHOD(Session, onKick) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, ZEND_STRL("onKick")); }
-PHP_METHOD(Session, onChannel) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, ZEND_STRL("onChannel")); }
-PHP_METHOD(Session, onPrivmsg) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, ZEND_STRL("onPrivmsg")); }
-PHP_METHOD(Session, onNotice) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, ZEND_STRL("onNotice")); }
-PHP_METHOD(Session, onChannelNotice) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, ZEND_STRL("onChannelNotice")); }
-PHP_METHOD(Session, onInvite) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, ZEND_STRL("onInvite")); }
-PHP_METHOD(Session, onCtcpReq) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, ZEND_STRL("onCtcpReq")); }
-PHP_METHOD(Session, onCtcpRep) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, ZEND_STRL("onCtcpRep")); }
-PHP_METHOD(Session, onAction) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, ZEND_STRL("onAction")); }
-PHP_METHOD(Session, onUnknown) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, ZEND_STRL("onUnknown")); }
-PHP_METHOD(Session, onNumeric) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, ZEND_STRL("onNumeric")); }
-PHP_METHOD(Session, onDccChatReq) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, ZEND_STRL("onDccChatReq")); }
-PHP_METHOD(Session, onDccSendReq) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, ZEND_STRL("onDccSendReq")); }
-PHP_METHOD(Session, onError) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, ZEND_STRL("onError")); }
+PHP_METHOD(Session, onConnect) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_CONNECT); }
+PHP_METHOD(Session, onNick) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_NICK); }
+PHP_METHOD(Session, onQuit) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_QUIT); }
+PHP_METHOD(Session, onJoin) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_JOIN); }
+PHP_METHOD(Session, onPart) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_PART); }
+PHP_METHOD(Session, onMode) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_MODE); }
+PHP_METHOD(Session, onUmode) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_UMODE); }
+PHP_METHOD(Session, onTopic) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_TOPIC); }
+PHP_METHOD(Session, onKick) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_KICK); }
+PHP_METHOD(Session, onChannel) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_CHANNEL); }
+PHP_METHOD(Session, onPrivmsg) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_PRIVMSG); }
+PHP_METHOD(Session, onNotice) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_NOTICE); }
+PHP_METHOD(Session, onChannelNotice) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_CHANNEL_NOTICE); }
+PHP_METHOD(Session, onInvite) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_INVITE); }
+PHP_METHOD(Session, onCtcpReq) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_CTCP_REQ); }
+PHP_METHOD(Session, onCtcpRep) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_CTCP_REP); }
+PHP_METHOD(Session, onAction) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_ACTION); }
+PHP_METHOD(Session, onUnknown) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_UNKNOWN); }
+PHP_METHOD(Session, onNumeric) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_NUMERIC); }
+PHP_METHOD(Session, onDccChatReq) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_DCC_CHAT_REQ); }
+PHP_METHOD(Session, onDccSendReq) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_DCC_SEND_REQ); }
+PHP_METHOD(Session, onError) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_ERROR); }
+PHP_METHOD(Session, onNames) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_NAMES); }
+PHP_METHOD(Session, onWhois) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_WHOIS); }
+PHP_METHOD(Session, onList) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_LIST); }
+PHP_METHOD(Session, onBanList) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_BANLIST); }
+PHP_METHOD(Session, onBatch) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_BATCH); }
+PHP_METHOD(Session, onSlowHandler) { call_closure(INTERNAL_FUNCTION_PARAM_PASSTHRU, PHP_IRCCLIENT_EVENT_SLOW_HANDLER); }
 /* }}} */
 
 #define ME(m, ai) PHP_ME(Session, m, ai, ZEND_ACC_PUBLIC)
@@ -1189,7 +6652,43 @@ zend_function_entry php_ircclient_session_method_entry[] = {
 	ME(isConnected, NULL)
 	ME(disconnect, NULL)
 	ME(run, ai_Session_run)
+	ME(watch, ai_Session_watch)
+	ME(unwatch, ai_Session_unwatch)
+	ME(on, ai_Session_on)
+	ME(off, ai_Session_off)
 	ME(setOption, ai_Session_setOption)
+	ME(setFloodControl, ai_Session_setFloodControl)
+	ME(getQueueLength, NULL)
+	ME(getTags, NULL)
+	ME(getCaps, NULL)
+
+	ME(addFilter, ai_Session_addFilter)
+	ME(removeFilter, ai_Session_removeFilter)
+	ME(clearFilters, NULL)
+
+	ME(getStats, NULL)
+	ME(resetStats, NULL)
+
+	ME(setWatchdog, ai_Session_setWatchdog)
+	ME(capture, ai_Session_capture)
+	ME(replay, ai_Session_replay)
+	ME(setTrace, ai_Session_setTrace)
+	ME(dumpTrace, ai_Session_dumpTrace)
+	ME(setReconnect, ai_Session_setReconnect)
+
+	ME(dccAccept, ai_Session_dccAccept)
+	ME(dccDecline, ai_Session_dccid)
+	ME(dccDestroy, ai_Session_dccid)
+	ME(dccChat, ai_Session_dccChat)
+	ME(dccMsg, ai_Session_dccMsg)
+	ME(dccSendFile, ai_Session_dccSendFile)
+	ME(dccReceive, ai_Session_dccReceive)
+	ME(dccProgress, ai_Session_dccid)
+
+	ME(isOn, ai_Session_isOn)
+	ME(getUsers, ai_Session_getUsers)
+	ME(getModes, ai_Session_getModes)
+	ME(getChannels, NULL)
 
 	ME(doJoin, ai_Session_doJoin)
 	ME(doPart, ai_Session_doPart)
@@ -1203,6 +6702,7 @@ zend_function_entry php_ircclient_session_method_entry[] = {
 	ME(doMsg, ai_Session_doMsg)
 	ME(doMe, ai_Session_doMe)
 	ME(doNotice, ai_Session_doNotice)
+	ME(doMsgMany, ai_Session_doMsgMany)
 
 	ME(doQuit, ai_Session_doQuit)
 	ME(doUserMode, ai_Session_doUserMode)
@@ -1231,11 +6731,484 @@ zend_function_entry php_ircclient_session_method_entry[] = {
 	ME(onCtcpReq, ai_Session_event)
 	ME(onCtcpRep, ai_Session_event)
 	ME(onAction, ai_Session_event)
-	ME(onUnknown, ai_Session_event)
+	ME(onUnknown, ai_Session_event_unknown)
 	ME(onNumeric, ai_Session_event_code)
 	ME(onDccChatReq, ai_Session_event_dcc_chat)
 	ME(onDccSendReq, ai_Session_event_dcc_send)
 	ME(onError, ai_Session_event)
+	ME(onNames, ai_Session_event_names)
+	ME(onWhois, ai_Session_event_whois)
+	ME(onList, ai_Session_event_list)
+	ME(onBanList, ai_Session_event_banlist)
+	ME(onBatch, ai_Session_event_batch)
+	ME(onSlowHandler, ai_Session_event_slow_handler)
+	{0}
+};
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Params_offset, 0, 0, 1)
+	ZEND_ARG_INFO(0, offset)
+ZEND_END_ARG_INFO()
+/* {{{ proto bool Params::offsetExists(int offset) */
+PHP_METHOD(Params, offsetExists)
+{
+	zval *offset;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "z", &offset)) {
+		RETURN_BOOL(php_ircclient_params_has_dimension(getThis(), offset, 0 TSRMLS_CC));
+	}
+}
+/* }}} */
+
+/* {{{ proto string Params::offsetGet(int offset) */
+PHP_METHOD(Params, offsetGet)
+{
+	zval *offset;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "z", &offset)) {
+		zval *entry = php_ircclient_params_read_dimension(getThis(), offset, BP_VAR_R TSRMLS_CC);
+
+		RETURN_ZVAL(entry, 1, 0);
+	}
+}
+/* }}} */
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Params_offsetSet, 0, 0, 2)
+	ZEND_ARG_INFO(0, offset)
+	ZEND_ARG_INFO(0, value)
+ZEND_END_ARG_INFO()
+/* {{{ proto void Params::offsetSet(int offset, mixed value)
+	Params are read-only. */
+PHP_METHOD(Params, offsetSet)
+{
+	php_ircclient_params_write_dimension(getThis(), NULL, NULL TSRMLS_CC);
+}
+/* }}} */
+
+/* {{{ proto void Params::offsetUnset(int offset)
+	Params are read-only. */
+PHP_METHOD(Params, offsetUnset)
+{
+	php_ircclient_params_unset_dimension(getThis(), NULL TSRMLS_CC);
+}
+/* }}} */
+
+/* {{{ proto int Params::count() */
+PHP_METHOD(Params, count)
+{
+	if (SUCCESS == zend_parse_parameters_none()) {
+		php_ircclient_params_object_t *p = zend_object_store_get_object(getThis() TSRMLS_CC);
+
+		RETURN_LONG(p->count);
+	}
+}
+/* }}} */
+
+/* {{{ proto array Params::toArray() */
+PHP_METHOD(Params, toArray)
+{
+	if (SUCCESS == zend_parse_parameters_none()) {
+		php_ircclient_params_object_t *p = zend_object_store_get_object(getThis() TSRMLS_CC);
+
+		php_ircclient_params_array(p, return_value);
+	}
+}
+/* }}} */
+
+zend_function_entry php_ircclient_params_method_entry[] = {
+	PHP_ME(Params, offsetExists, ai_Params_offset, ZEND_ACC_PUBLIC)
+	PHP_ME(Params, offsetGet, ai_Params_offset, ZEND_ACC_PUBLIC)
+	PHP_ME(Params, offsetSet, ai_Params_offsetSet, ZEND_ACC_PUBLIC)
+	PHP_ME(Params, offsetUnset, ai_Params_offset, ZEND_ACC_PUBLIC)
+	PHP_ME(Params, count, NULL, ZEND_ACC_PUBLIC)
+	PHP_ME(Params, toArray, NULL, ZEND_ACC_PUBLIC)
+	{0}
+};
+
+void php_ircclient_tags_object_free(void *object TSRMLS_DC)
+{
+	php_ircclient_tags_object_t *o = (php_ircclient_tags_object_t *) object;
+
+	if (o->str) {
+		efree(o->str);
+	}
+	zend_object_std_dtor((zend_object *) o TSRMLS_CC);
+	efree(o);
+}
+
+zend_object_value php_ircclient_tags_object_create(zend_class_entry *ce TSRMLS_DC)
+{
+	php_ircclient_tags_object_t *obj;
+
+	obj = ecalloc(1, sizeof(*obj));
+#if PHP_VERSION_ID >= 50399
+	zend_object_std_init((zend_object *) obj, ce TSRMLS_CC);
+	object_properties_init((zend_object *) obj, ce);
+#else
+	obj->zo.ce = ce;
+	ALLOC_HASHTABLE(obj->zo.properties);
+	zend_hash_init(obj->zo.properties, zend_hash_num_elements(&ce->default_properties), NULL, ZVAL_PTR_DTOR, 0);
+	zend_hash_copy(obj->zo.properties, &ce->default_properties, (copy_ctor_func_t) zval_add_ref, NULL, sizeof(zval *));
+#endif
+
+	obj->ov.handle = zend_objects_store_put(obj, NULL, php_ircclient_tags_object_free, NULL TSRMLS_CC);
+	obj->ov.handlers = &php_ircclient_tags_object_handlers;
+
+	return obj->ov;
+}
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Tags_offset, 0, 0, 1)
+	ZEND_ARG_INFO(0, tag)
+ZEND_END_ARG_INFO()
+/* {{{ proto bool Tags::offsetExists(string tag) */
+PHP_METHOD(Tags, offsetExists)
+{
+	char *tag_str;
+	int tag_len;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &tag_str, &tag_len)) {
+		php_ircclient_tags_object_t *t = zend_object_store_get_object(getThis() TSRMLS_CC);
+		php_ircclient_chunk_t val;
+
+		RETURN_BOOL(SUCCESS == php_ircclient_tags_find(t->str, t->len, tag_str, tag_len, &val));
+	}
+}
+/* }}} */
+
+/* {{{ proto string Tags::offsetGet(string tag)
+	Returns the unescaped value, an empty string for a tag without value, or NULL. */
+PHP_METHOD(Tags, offsetGet)
+{
+	char *tag_str;
+	int tag_len;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s", &tag_str, &tag_len)) {
+		php_ircclient_tags_object_t *t = zend_object_store_get_object(getThis() TSRMLS_CC);
+		php_ircclient_chunk_t val;
+
+		if (SUCCESS == php_ircclient_tags_find(t->str, t->len, tag_str, tag_len, &val)) {
+			size_t len;
+			char *str = php_ircclient_tag_unescape(val.str, val.len, &len);
+
+			RETURN_STRINGL(str, len, 0);
+		}
+	}
+}
+/* }}} */
+
+ZEND_BEGIN_ARG_INFO_EX(ai_Tags_offsetSet, 0, 0, 2)
+	ZEND_ARG_INFO(0, tag)
+	ZEND_ARG_INFO(0, value)
+ZEND_END_ARG_INFO()
+/* {{{ proto void Tags::offsetSet(string tag, string value)
+	Tags are read-only. */
+PHP_METHOD(Tags, offsetSet)
+{
+	php_error_docref(NULL TSRMLS_CC, E_WARNING, "irc\\client\\Tags is read-only");
+}
+/* }}} */
+
+/* {{{ proto void Tags::offsetUnset(string tag)
+	Tags are read-only. */
+PHP_METHOD(Tags, offsetUnset)
+{
+	php_error_docref(NULL TSRMLS_CC, E_WARNING, "irc\\client\\Tags is read-only");
+}
+/* }}} */
+
+/* {{{ proto int Tags::count() */
+PHP_METHOD(Tags, count)
+{
+	if (SUCCESS == zend_parse_parameters_none()) {
+		php_ircclient_tags_object_t *t = zend_object_store_get_object(getThis() TSRMLS_CC);
+		const char *str = t->str, *end = t->str + t->len;
+		php_ircclient_chunk_t key, val;
+		long count = 0;
+
+		while (php_ircclient_tags_next(&str, end, &key, &val)) {
+			++count;
+		}
+		RETURN_LONG(count);
+	}
+}
+/* }}} */
+
+/* {{{ proto array Tags::toArray() */
+PHP_METHOD(Tags, toArray)
+{
+	if (SUCCESS == zend_parse_parameters_none()) {
+		php_ircclient_tags_object_t *t = zend_object_store_get_object(getThis() TSRMLS_CC);
+
+		php_ircclient_tags_array(return_value, t->str, t->len);
+	}
+}
+/* }}} */
+
+/* {{{ proto float Tags::getTime()
+	The server-time tag as Unix timestamp with fractions, or NULL. */
+PHP_METHOD(Tags, getTime)
+{
+	if (SUCCESS == zend_parse_parameters_none()) {
+		php_ircclient_tags_object_t *t = zend_object_store_get_object(getThis() TSRMLS_CC);
+		php_ircclient_chunk_t val;
+
+		if (SUCCESS == php_ircclient_tags_find(t->str, t->len, ZEND_STRL("time"), &val) && val.len < 64) {
+			/* YYYY-MM-DDThh:mm:ss.sssZ */
+			char buf[64], *dot;
+			struct tm tm;
+
+			memset(&tm, 0, sizeof(tm));
+			memcpy(buf, val.str, val.len);
+			buf[val.len] = '\0';
+
+			if (6 == sscanf(buf, "%4d-%2d-%2dT%2d:%2d:%2d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec)) {
+				double ts;
+
+				tm.tm_year -= 1900;
+				tm.tm_mon -= 1;
+				ts = timegm(&tm);
+				if ((dot = strchr(buf, '.'))) {
+					ts += zend_strtod(dot, NULL);
+				}
+				RETURN_DOUBLE(ts);
+			}
+		}
+	}
+}
+/* }}} */
+
+zend_function_entry php_ircclient_tags_method_entry[] = {
+	PHP_ME(Tags, offsetExists, ai_Tags_offset, ZEND_ACC_PUBLIC)
+	PHP_ME(Tags, offsetGet, ai_Tags_offset, ZEND_ACC_PUBLIC)
+	PHP_ME(Tags, offsetSet, ai_Tags_offsetSet, ZEND_ACC_PUBLIC)
+	PHP_ME(Tags, offsetUnset, ai_Tags_offset, ZEND_ACC_PUBLIC)
+	PHP_ME(Tags, count, NULL, ZEND_ACC_PUBLIC)
+	PHP_ME(Tags, toArray, NULL, ZEND_ACC_PUBLIC)
+	PHP_ME(Tags, getTime, NULL, ZEND_ACC_PUBLIC)
+	{0}
+};
+
+typedef struct php_ircclient_pool_object {
+	zend_object zo;
+	zend_object_value ov;
+	/* object handle => Session */
+	HashTable sessions;
+	/* see php_ircclient_pool_get_gc() */
+	zval **gc;
+	int gc_size;
+} php_ircclient_pool_object_t;
+
+zend_class_entry *php_ircclient_pool_class_entry;
+static zend_object_handlers php_ircclient_pool_object_handlers;
+
+void php_ircclient_pool_object_free(void *object TSRMLS_DC)
+{
+	php_ircclient_pool_object_t *o = (php_ircclient_pool_object_t *) object;
+
+	zend_hash_destroy(&o->sessions);
+	if (o->gc) {
+		efree(o->gc);
+	}
+	zend_object_std_dtor((zend_object *) o TSRMLS_CC);
+	efree(o);
+}
+
+/* a pooled session may reference its pool */
+static HashTable *php_ircclient_pool_get_gc(zval *object, zval ***table, int *n TSRMLS_DC)
+{
+	php_ircclient_pool_object_t *obj = zend_object_store_get_object(object TSRMLS_CC);
+	HashPosition pos;
+	zval **zsess;
+	int count = zend_hash_num_elements(&obj->sessions);
+
+	if (count > obj->gc_size) {
+		obj->gc = erealloc(obj->gc, count * sizeof(zval *));
+		obj->gc_size = count;
+	}
+
+	count = 0;
+	for (	zend_hash_internal_pointer_reset_ex(&obj->sessions, &pos);
+			SUCCESS == zend_hash_get_current_data_ex(&obj->sessions, (void *) &zsess, &pos);
+			zend_hash_move_forward_ex(&obj->sessions, &pos)
+	) {
+		obj->gc[count++] = *zsess;
+	}
+
+	*table = obj->gc;
+	*n = count;
+	return zend_std_get_properties(object TSRMLS_CC);
+}
+
+zend_object_value php_ircclient_pool_object_create(zend_class_entry *ce TSRMLS_DC)
+{
+	php_ircclient_pool_object_t *obj;
+
+	obj = ecalloc(1, sizeof(*obj));
+#if PHP_VERSION_ID >= 50399
+	zend_object_std_init((zend_object *) obj, ce TSRMLS_CC);
+	object_properties_init((zend_object *) obj, ce);
+#else
+	obj->zo.ce = ce;
+	ALLOC_HASHTABLE(obj->zo.properties);
+	zend_hash_init(obj->zo.properties, zend_hash_num_elements(&ce->default_properties), NULL, ZVAL_PTR_DTOR, 0);
+	zend_hash_copy(obj->zo.properties, &ce->default_properties, (copy_ctor_func_t) zval_add_ref, NULL, sizeof(zval *));
+#endif
+
+	zend_hash_init(&obj->sessions, 8, NULL, ZVAL_PTR_DTOR, 0);
+
+	obj->ov.handle = zend_objects_store_put(obj, NULL, php_ircclient_pool_object_free, NULL TSRMLS_CC);
+	obj->ov.handlers = &php_ircclient_pool_object_handlers;
+
+	return obj->ov;
+}
+
+ZEND_BEGIN_ARG_INFO_EX(ai_SessionPool_add, 0, 0, 1)
+	ZEND_ARG_OBJ_INFO(0, session, irc\\client\\Session, 0)
+ZEND_END_ARG_INFO()
+/* {{{ proto void SessionPool::add(Session session) */
+PHP_METHOD(SessionPool, add)
+{
+	zval *zsess;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "O", &zsess, php_ircclient_session_class_entry)) {
+		php_ircclient_pool_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+
+		Z_ADDREF_P(zsess);
+		zend_hash_index_update(&obj->sessions, Z_OBJ_HANDLE_P(zsess), &zsess, sizeof(zval *), NULL);
+	}
+}
+/* }}} */
+
+ZEND_BEGIN_ARG_INFO_EX(ai_SessionPool_remove, 0, 0, 1)
+	ZEND_ARG_OBJ_INFO(0, session, irc\\client\\Session, 0)
+ZEND_END_ARG_INFO()
+/* {{{ proto bool SessionPool::remove(Session session)
+	Returns TRUE when the session was part of the pool. */
+PHP_METHOD(SessionPool, remove)
+{
+	zval *zsess;
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "O", &zsess, php_ircclient_session_class_entry)) {
+		php_ircclient_pool_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+
+		RETURN_BOOL(SUCCESS == zend_hash_index_del(&obj->sessions, Z_OBJ_HANDLE_P(zsess)));
+	}
+}
+/* }}} */
+
+/* {{{ proto int SessionPool::count() */
+PHP_METHOD(SessionPool, count)
+{
+	if (SUCCESS == zend_parse_parameters_none()) {
+		php_ircclient_pool_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+
+		RETURN_LONG(zend_hash_num_elements(&obj->sessions));
+	}
+}
+/* }}} */
+
+ZEND_BEGIN_ARG_INFO_EX(ai_SessionPool_run, 0, 0, 0)
+	ZEND_ARG_INFO(0, read_fd_array_for_select)
+	ZEND_ARG_INFO(0, write_fd_array_for_select)
+	ZEND_ARG_INFO(0, timeout_seconds)
+ZEND_END_ARG_INFO()
+/* {{{ proto array SessionPool::run([array read_fds_for_select[, array write_fds_for_select[, double timeout = null]]])
+	Drives all connected sessions of the pool with a single select() call,
+	and connects sessions again as set up by Session::setReconnect().
+	Returns array(array of readable fds, array of writeable fds) or false on error. */
+PHP_METHOD(SessionPool, run)
+{
+	HashTable *ifds = NULL, *ofds = NULL;
+	double to = php_get_inf();
+
+	if (SUCCESS == zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "|H!H!d", &ifds, &ofds, &to)) {
+		php_ircclient_pool_object_t *obj = zend_object_store_get_object(getThis() TSRMLS_CC);
+		struct timeval t;
+		fd_set i, o;
+		int n = 0, m = 0, rc;
+		zval **zsess, **zsessions, *zr, *zw;
+		zend_bool *connected;
+
+		FD_ZERO(&i);
+		FD_ZERO(&o);
+
+		/* handlers might add or remove sessions while we process them */
+		zsessions = safe_emalloc(zend_hash_num_elements(&obj->sessions), sizeof(zval *), 0);
+		connected = safe_emalloc(zend_hash_num_elements(&obj->sessions), sizeof(zend_bool), 0);
+
+		for (	zend_hash_internal_pointer_reset(&obj->sessions);
+				SUCCESS == zend_hash_get_current_data(&obj->sessions, (void *) &zsess);
+				zend_hash_move_forward(&obj->sessions)
+		) {
+			php_ircclient_session_object_t *sess = zend_object_store_get_object(*zsess TSRMLS_CC);
+			zval *zthis = sess->zthis;
+
+			/* for the handlers of a reconnect */
+			sess->zthis = *zsess;
+			php_ircclient_session_revive(sess TSRMLS_CC);
+			sess->zthis = zthis;
+
+			connected[n] = irc_is_connected(sess->sess) && SUCCESS == php_ircclient_session_add_descriptors(sess, &i, &o, &m TSRMLS_CC);
+			if (connected[n]) {
+				to = php_ircclient_session_timeout(sess, to);
+			} else {
+				to = php_ircclient_reconnect_timeout(sess, to);
+			}
+			php_ircclient_watch_add_descriptors(sess, &i, &o, &m TSRMLS_CC);
+			Z_ADDREF_PP(zsess);
+			zsessions[n++] = *zsess;
+		}
+		if (ifds) {
+			php_ircclient_fds_add(ifds, &i, &m, PHP_STREAM_AS_FD_FOR_SELECT TSRMLS_CC);
+		}
+		if (ofds) {
+			php_ircclient_fds_add(ofds, &o, &m, PHP_STREAM_AS_FD_FOR_SELECT|PHP_STREAM_CAST_INTERNAL TSRMLS_CC);
+		}
+
+		PHP_SAFE_MAX_FD(m, m);
+
+		if (0 > (rc = select(m + 1, &i, &o, NULL, php_ircclient_timeval(to, &t)))) {
+			if (errno == EINTR) {
+				/* interrupt; let userland be able to handle signals etc. */
+				array_init(return_value);
+			} else {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING, "select() error: %s", strerror(errno));
+				RETVAL_FALSE;
+			}
+		}
+
+		if (rc >= 0) {
+			zr = php_ircclient_fds_ready(ifds, &i TSRMLS_CC);
+			zw = php_ircclient_fds_ready(ofds, &o TSRMLS_CC);
+		}
+		while (n--) {
+			if (rc >= 0) {
+				php_ircclient_session_object_t *sess = zend_object_store_get_object(zsessions[n] TSRMLS_CC);
+
+				/* a failing session does not stop the others, but may connect again */
+				if (connected[n] && SUCCESS != php_ircclient_session_process_descriptors(sess, zsessions[n], &i, &o TSRMLS_CC)) {
+					php_ircclient_session_lost(sess TSRMLS_CC);
+				}
+				php_ircclient_watch_ready(sess, zr, zw, &i, &o TSRMLS_CC);
+			}
+			zval_ptr_dtor(&zsessions[n]);
+		}
+		efree(zsessions);
+		efree(connected);
+
+		if (rc >= 0) {
+			array_init(return_value);
+			add_next_index_zval(return_value, zr);
+			add_next_index_zval(return_value, zw);
+		}
+	}
+}
+/* }}} */
+
+zend_function_entry php_ircclient_pool_method_entry[] = {
+	PHP_ME(SessionPool, add, ai_SessionPool_add, ZEND_ACC_PUBLIC)
+	PHP_ME(SessionPool, remove, ai_SessionPool_remove, ZEND_ACC_PUBLIC)
+	PHP_ME(SessionPool, count, NULL, ZEND_ACC_PUBLIC)
+	PHP_ME(SessionPool, run, ai_SessionPool_run, ZEND_ACC_PUBLIC)
 	{0}
 };
 
@@ -1247,6 +7220,44 @@ PHP_MINIT_FUNCTION(ircclient)
 	INIT_NS_CLASS_ENTRY(ce, "irc\\client", "Session", php_ircclient_session_method_entry);
 	ce.create_object = php_ircclient_session_object_create;
 	php_ircclient_session_class_entry = zend_register_internal_class_ex(&ce, NULL, NULL TSRMLS_CC);
+	memcpy(&php_ircclient_session_object_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+	php_ircclient_session_object_handlers.write_property = php_ircclient_session_write_property;
+	php_ircclient_session_object_handlers.unset_property = php_ircclient_session_unset_property;
+	php_ircclient_session_object_handlers.get_property_ptr_ptr = php_ircclient_session_get_property_ptr_ptr;
+	php_ircclient_session_object_handlers.get_gc = php_ircclient_session_get_gc;
+
+	memset(&ce, 0, sizeof(zend_class_entry));
+	INIT_NS_CLASS_ENTRY(ce, "irc\\client", "SessionPool", php_ircclient_pool_method_entry);
+	ce.create_object = php_ircclient_pool_object_create;
+	php_ircclient_pool_class_entry = zend_register_internal_class_ex(&ce, NULL, NULL TSRMLS_CC);
+	zend_class_implements(php_ircclient_pool_class_entry TSRMLS_CC, 1, spl_ce_Countable);
+	memcpy(&php_ircclient_pool_object_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+	php_ircclient_pool_object_handlers.clone_obj = NULL;
+	php_ircclient_pool_object_handlers.get_gc = php_ircclient_pool_get_gc;
+
+	memset(&ce, 0, sizeof(zend_class_entry));
+	INIT_NS_CLASS_ENTRY(ce, "irc\\client", "Params", php_ircclient_params_method_entry);
+	ce.create_object = php_ircclient_params_object_create;
+	php_ircclient_params_class_entry = zend_register_internal_class_ex(&ce, NULL, NULL TSRMLS_CC);
+	php_ircclient_params_class_entry->ce_flags |= ZEND_ACC_FINAL_CLASS;
+	zend_class_implements(php_ircclient_params_class_entry TSRMLS_CC, 2, zend_ce_arrayaccess, spl_ce_Countable);
+	memcpy(&php_ircclient_params_object_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+	php_ircclient_params_object_handlers.clone_obj = NULL;
+	php_ircclient_params_object_handlers.read_dimension = php_ircclient_params_read_dimension;
+	php_ircclient_params_object_handlers.write_dimension = php_ircclient_params_write_dimension;
+	php_ircclient_params_object_handlers.has_dimension = php_ircclient_params_has_dimension;
+	php_ircclient_params_object_handlers.unset_dimension = php_ircclient_params_unset_dimension;
+	php_ircclient_params_object_handlers.count_elements = php_ircclient_params_count_elements;
+	php_ircclient_params_object_handlers.get_debug_info = php_ircclient_params_get_debug_info;
+
+	memset(&ce, 0, sizeof(zend_class_entry));
+	INIT_NS_CLASS_ENTRY(ce, "irc\\client", "Tags", php_ircclient_tags_method_entry);
+	ce.create_object = php_ircclient_tags_object_create;
+	php_ircclient_tags_class_entry = zend_register_internal_class_ex(&ce, NULL, NULL TSRMLS_CC);
+	php_ircclient_tags_class_entry->ce_flags |= ZEND_ACC_FINAL_CLASS;
+	zend_class_implements(php_ircclient_tags_class_entry TSRMLS_CC, 2, zend_ce_arrayaccess, spl_ce_Countable);
+	memcpy(&php_ircclient_tags_object_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+	php_ircclient_tags_object_handlers.clone_obj = NULL;
 
 	zend_declare_property_null(php_ircclient_session_class_entry, ZEND_STRL("nick"), ZEND_ACC_PUBLIC TSRMLS_CC);
 	zend_declare_property_null(php_ircclient_session_class_entry, ZEND_STRL("user"), ZEND_ACC_PUBLIC TSRMLS_CC);
@@ -1274,6 +7285,53 @@ PHP_MINIT_FUNCTION(ircclient)
 	zend_declare_property_null(php_ircclient_session_class_entry, ZEND_STRL("onDccChatReq"), ZEND_ACC_PUBLIC TSRMLS_CC);
 	zend_declare_property_null(php_ircclient_session_class_entry, ZEND_STRL("onDccSendReq"), ZEND_ACC_PUBLIC TSRMLS_CC);
 	zend_declare_property_null(php_ircclient_session_class_entry, ZEND_STRL("onError"), ZEND_ACC_PUBLIC TSRMLS_CC);
+	zend_declare_property_null(php_ircclient_session_class_entry, ZEND_STRL("onNames"), ZEND_ACC_PUBLIC TSRMLS_CC);
+	zend_declare_property_null(php_ircclient_session_class_entry, ZEND_STRL("onWhois"), ZEND_ACC_PUBLIC TSRMLS_CC);
+	zend_declare_property_null(php_ircclient_session_class_entry, ZEND_STRL("onList"), ZEND_ACC_PUBLIC TSRMLS_CC);
+	zend_declare_property_null(php_ircclient_session_class_entry, ZEND_STRL("onBanList"), ZEND_ACC_PUBLIC TSRMLS_CC);
+	zend_declare_property_null(php_ircclient_session_class_entry, ZEND_STRL("onBatch"), ZEND_ACC_PUBLIC TSRMLS_CC);
+	zend_declare_property_null(php_ircclient_session_class_entry, ZEND_STRL("onSlowHandler"), ZEND_ACC_PUBLIC TSRMLS_CC);
+
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "OPTION_EPOLL", PHP_IRCCLIENT_OPTION_EPOLL, CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "OPTION_TRACK_STATE", PHP_IRCCLIENT_OPTION_TRACK_STATE, CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "OPTION_AGGREGATE", PHP_IRCCLIENT_OPTION_AGGREGATE, CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "OPTION_LAZY_PARAMS", PHP_IRCCLIENT_OPTION_LAZY_PARAMS, CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "OPTION_MESSAGE_TAGS", PHP_IRCCLIENT_OPTION_MESSAGE_TAGS, CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "OPTION_BATCH", PHP_IRCCLIENT_OPTION_BATCH, CONST_CS|CONST_PERSISTENT);
+
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_CONNECT", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_CONNECT), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_NICK", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_NICK), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_QUIT", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_QUIT), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_JOIN", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_JOIN), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_PART", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_PART), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_MODE", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_MODE), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_UMODE", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_UMODE), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_TOPIC", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_TOPIC), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_KICK", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_KICK), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_CHANNEL", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_CHANNEL), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_PRIVMSG", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_PRIVMSG), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_NOTICE", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_NOTICE), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_CHANNEL_NOTICE", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_CHANNEL_NOTICE), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_INVITE", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_INVITE), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_CTCP_REQ", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_CTCP_REQ), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_CTCP_REP", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_CTCP_REP), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_ACTION", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_ACTION), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_UNKNOWN", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_UNKNOWN), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_NUMERIC", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_NUMERIC), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_DCC_CHAT_REQ", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_DCC_CHAT_REQ), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_DCC_SEND_REQ", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_DCC_SEND_REQ), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_ERROR", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_ERROR), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_NAMES", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_NAMES), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_WHOIS", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_WHOIS), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_LIST", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_LIST), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_BANLIST", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_BANLIST), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_BATCH", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_BATCH), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "EVENT_SLOW_HANDLER", PHP_IRCCLIENT_EVENT_MASK(PHP_IRCCLIENT_EVENT_SLOW_HANDLER), CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "WATCH_READ", PHP_IRCCLIENT_WATCH_READ, CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "WATCH_WRITE", PHP_IRCCLIENT_WATCH_WRITE, CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "PRIORITY_HIGH", PHP_IRCCLIENT_PRIORITY_HIGH, CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "PRIORITY_NORMAL", PHP_IRCCLIENT_PRIORITY_NORMAL, CONST_CS|CONST_PERSISTENT);
+	REGISTER_NS_LONG_CONSTANT("irc\\client", "PRIORITY_LOW", PHP_IRCCLIENT_PRIORITY_LOW, CONST_CS|CONST_PERSISTENT);
 
 	REGISTER_NS_LONG_CONSTANT("irc\\client", "RPL_WELCOME", 001, CONST_CS|CONST_PERSISTENT);
 	REGISTER_NS_LONG_CONSTANT("irc\\client", "RPL_YOURHOST", 002, CONST_CS|CONST_PERSISTENT);
@@ -0,0 +1,146 @@
+--TEST--
+irc\client\OPTION_AGGREGATE
+--SKIPIF--
+<?php if (!extension_loaded("ircclient")) die("skip ircclient not loaded"); ?>
+--FILE--
+<?php
+require __DIR__ . "/server.inc";
+
+use irc\client\Session;
+use irc\client\bench\FakeServer;
+
+echo "Test\n";
+
+$s = new Session("tester", "tester", "tester");
+$srv = new FakeServer;
+
+$s->setOption(irc\client\OPTION_AGGREGATE);
+$s->onNumeric = function($origin, $event, array $args) {
+	if ($event > 5) {
+		printf("numeric %d %s\n", $event, end($args));
+	}
+};
+$s->onNames = function($channel, array $names) {
+	printf("names %s\n", $channel);
+	print_r($names);
+};
+$s->onWhois = function($nick, array $info) {
+	printf("whois %s\n", $nick);
+	print_r($info);
+};
+$s->onList = function(array $list) {
+	print_r($list);
+};
+$s->onBanList = function($channel, array $bans) {
+	printf("bans %s\n", $channel);
+	print_r($bans);
+};
+
+var_dump(connect($s, $srv));
+var_dump(exchange($s, $srv, array(
+	":bench.server 353 tester = #chan :@a +b",
+	":bench.server 353 tester = #chan :c @+d",
+	":bench.server 366 tester #chan :End of /NAMES list.",
+	/* not part of a WHOIS reply */
+	":bench.server 301 tester other :gone",
+	":bench.server 311 tester other user other.host * :Real Name",
+	":bench.server 319 tester other :@#a +#b",
+	":bench.server 319 tester other :#c",
+	":bench.server 301 tester other :away",
+	":bench.server 317 tester other 10 1000 :seconds idle, signon time",
+	":bench.server 330 tester other acct :is logged in as",
+	":bench.server 318 tester other :End of /WHOIS list.",
+	":bench.server 321 tester Channel :Users  Name",
+	":bench.server 322 tester #a 5 :topic a",
+	":bench.server 322 tester #b 1 :topic b",
+	":bench.server 323 tester :End of /LIST",
+	":bench.server 367 tester #chan *!*@bad.host op 1234",
+	":bench.server 367 tester #chan *!*@worse.host",
+	":bench.server 368 tester #chan :End of Channel Ban List",
+)));
+
+/* passed on as they are without a handler */
+$s->onNames = null;
+var_dump(exchange($s, $srv, array(
+	":bench.server 353 tester = #chan :@a",
+	":bench.server 366 tester #chan :End of /NAMES list.",
+)));
+
+$s->disconnect();
+?>
+Done
+--EXPECT--
+Test
+bool(true)
+names #chan
+Array
+(
+    [a] => @
+    [b] => +
+    [c] => 
+    [d] => @+
+)
+numeric 301 gone
+whois other
+Array
+(
+    [user] => user
+    [host] => other.host
+    [real] => Real Name
+    [channels] => Array
+        (
+            [0] => @#a
+            [1] => +#b
+            [2] => #c
+        )
+
+    [away] => away
+    [idle] => 10
+    [signon] => 1000
+    [extra] => Array
+        (
+            [330] => Array
+                (
+                    [0] => acct
+                    [1] => is logged in as
+                )
+
+        )
+
+)
+Array
+(
+    [#a] => Array
+        (
+            [users] => 5
+            [topic] => topic a
+        )
+
+    [#b] => Array
+        (
+            [users] => 1
+            [topic] => topic b
+        )
+
+)
+bans #chan
+Array
+(
+    [0] => Array
+        (
+            [mask] => *!*@bad.host
+            [by] => op
+            [time] => 1234
+        )
+
+    [1] => Array
+        (
+            [mask] => *!*@worse.host
+        )
+
+)
+bool(true)
+numeric 353 @a
+numeric 366 End of /NAMES list.
+bool(true)
+Done
@@ -0,0 +1,56 @@
+--TEST--
+CAP negotiation, message tags and batches with the plain Session::run()
+--SKIPIF--
+<?php
+if (!extension_loaded("ircclient")) die("skip ircclient not loaded");
+if (!defined("PHP_BINARY") || !function_exists("proc_open")) die("skip needs PHP_BINARY and proc_open()");
+?>
+--FILE--
+<?php
+use irc\client\Session;
+
+echo "Test\n";
+
+$proc = proc_open(escapeshellarg(PHP_BINARY) . " -n " . escapeshellarg(__DIR__ . "/cap_server.inc"), array(1 => array("pipe", "w")), $pipes);
+$port = (int) fgets($pipes[1]);
+
+$s = new Session("tester", "tester", "tester");
+$s->setOption(irc\client\OPTION_MESSAGE_TAGS);
+$s->setOption(irc\client\OPTION_BATCH);
+
+$s->onChannel = function($origin, array $args) use ($s) {
+	$tags = $s->getTags();
+	printf("channel %s %s msgid=%s time=%.3F\n", $args[0], $args[1], $tags["msgid"], $tags->getTime());
+	printf("caps %s\n", implode(" ", array_keys($s->getCaps())));
+};
+$s->onJoin = function($origin, array $args) {
+	printf("not batched: join %s\n", $origin);
+};
+$s->onBatch = function($type, array $params, array $messages) use ($s) {
+	printf("batch %s %s\n", $type, implode(" ", $params));
+	foreach ($messages as $m) {
+		printf("  %s %s %s batch=%s\n", $m["event"], $m["origin"], $m["params"][0], $m["tags"]["batch"]);
+	}
+	$s->disconnect();
+};
+
+var_dump($s->doConnect(false, "127.0.0.1", $port));
+var_dump($s->run());
+
+echo stream_get_contents($pipes[1]);
+proc_close($proc);
+?>
+Done
+--EXPECT--
+Test
+bool(true)
+channel #chan tagged msgid=a1 time=1704164645.678
+caps message-tags server-time batch
+batch netjoin irc.a irc.b
+  onJoin n1!u@n1.host #chan batch=b1
+  onJoin n2!u@n2.host #chan batch=b1
+bool(true)
+CAP LS 302
+CAP REQ :message-tags server-time batch
+CAP END
+Done
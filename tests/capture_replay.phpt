@@ -0,0 +1,97 @@
+--TEST--
+Session::capture() and replay()
+--SKIPIF--
+<?php if (!extension_loaded("ircclient")) die("skip ircclient not loaded"); ?>
+--FILE--
+<?php
+require __DIR__ . "/server.inc";
+
+use irc\client\Session;
+use irc\client\bench\FakeServer;
+
+echo "Test\n";
+
+function handlers(Session $s, $name) {
+	$s->onChannel = function($origin, array $args) use ($name) {
+		printf("%s: channel %s %s\n", $name, $args[0], $args[1]);
+	};
+	$s->onNotice = function($origin, array $args) use ($name) {
+		printf("%s: notice %s\n", $name, $args[1]);
+	};
+	$s->onNumeric = function($origin, $event, array $args) use ($name) {
+		if ($event == irc\client\RPL_MOTD) {
+			printf("%s: numeric %d %s\n", $name, $event, end($args));
+		}
+	};
+}
+
+$s = new Session("tester", "tester", "tester");
+$srv = new FakeServer;
+$fp = fopen("php://temp", "w+");
+
+handlers($s, "live");
+var_dump(connect($s, $srv));
+
+var_dump($s->capture($fp));
+var_dump(exchange($s, $srv, array(
+	":peer!p@peer.host PRIVMSG #chan :one",
+	":bench.server 372 tester :- motd",
+	":peer!p@peer.host NOTICE tester :two",
+)));
+var_dump($s->capture(null));
+/* not recorded */
+var_dump(exchange($s, $srv, array(
+	":peer!p@peer.host PRIVMSG #chan :skipped",
+)));
+/* appended */
+var_dump($s->capture($fp));
+var_dump(exchange($s, $srv, array(
+	":peer!p@peer.host PRIVMSG #other :three",
+)));
+var_dump($s->capture());
+$s->disconnect();
+
+$r = new Session("replay", "replay", "replay");
+handlers($r, "replay");
+rewind($fp);
+var_dump($r->replay($fp, 0));
+
+$bad = fopen("php://memory", "w+");
+fwrite($bad, "PRIVMSG #chan :no capture\r\n");
+rewind($bad);
+var_dump($r->replay($bad));
+
+/* a numeric with a NULL param */
+$null = fopen("php://memory", "w+");
+fwrite($null, "IRCCAP\0\1" . pack("NnCC", 0, 372, 1, 0) . pack("n", 3) . "372" . pack("nn", 0xffff, 0xffff));
+rewind($null);
+var_dump($r->replay($null));
+?>
+Done
+--EXPECTF--
+Test
+bool(true)
+bool(true)
+live: channel #chan one
+live: numeric 372 - motd
+live: notice two
+bool(true)
+bool(true)
+live: channel #chan skipped
+bool(true)
+bool(true)
+live: channel #other three
+bool(true)
+bool(true)
+replay: channel #chan one
+replay: numeric 372 - motd
+replay: notice two
+replay: channel #other three
+int(4)
+
+Warning: irc\client\Session::replay(): not a capture in %s on line %d
+bool(false)
+
+Warning: irc\client\Session::replay(): invalid or truncated capture after 0 records in %s on line %d
+bool(false)
+Done
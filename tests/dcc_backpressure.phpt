@@ -0,0 +1,87 @@
+--TEST--
+A full Session::dccReceive() buffer holds back only its own session in a SessionPool
+--SKIPIF--
+<?php if (!extension_loaded("ircclient")) die("skip ircclient not loaded"); ?>
+--FILE--
+<?php
+require __DIR__ . "/server.inc";
+
+use irc\client\Session;
+use irc\client\SessionPool;
+use irc\client\bench\FakeServer;
+
+echo "Test\n";
+
+$pool = new SessionPool;
+$other = new Session("other", "other", "other");
+$osrv = new FakeServer;
+$s = new Session("tester", "tester", "tester");
+$srv = new FakeServer;
+
+/* added first, so that its socket comes before the DCC in the shared fd_set */
+$pool->add($other);
+$pool->add($s);
+
+var_dump(connect($other, $osrv));
+var_dump(connect($s, $srv));
+
+/* a stream nobody reads from */
+list($slow, $unread) = stream_socket_pair(STREAM_PF_UNIX, STREAM_SOCK_STREAM, STREAM_IPPROTO_IP);
+stream_set_blocking($slow, 0);
+
+$listener = dcc_listen($port);
+$peer = null;
+$size = 64 << 20;
+$dccid = null;
+
+$s->onDccSendReq = function($nick, $addr, $filename, $size, $id) use ($s, $slow, &$dccid) {
+	$dccid = $id;
+	var_dump($s->dccReceive($id, $slow));
+};
+var_dump(exchange($pool, $srv, array(
+	":peer!p@peer.host PRIVMSG tester :\001DCC SEND big.bin 2130706433 $port $size\001",
+)));
+
+/* until neither the stream nor the DCC socket take any more */
+$chunk = str_repeat("x", 65536);
+$stalled = 0;
+var_dump(run_until($pool, $srv, function() use ($s, $listener, &$peer, $chunk, &$dccid, &$stalled) {
+	if (dcc_accepted($listener, $peer)) {
+		$progress = $s->dccProgress($dccid);
+		$stalled = fwrite($peer, $chunk) || !$progress["buffered"] ? 0 : $stalled + 1;
+		fread($peer, 8192);
+	}
+	return $stalled > 20;
+}, 10.0));
+
+$seen = false;
+$other->onPrivmsg = function($origin, array $args) use (&$seen) {
+	printf("other: %s\n", $args[1]);
+	$seen = true;
+};
+$osrv->send(":peer!p@peer.host PRIVMSG other :still there");
+var_dump(run_until($pool, $osrv, function() use (&$seen) {
+	return $seen;
+}, 2.0));
+
+$progress = $s->dccProgress($dccid);
+var_dump($progress["buffered"] > 0, $progress["received"] < $size);
+
+$s->dccDestroy($dccid);
+fclose($peer);
+$s->disconnect();
+$other->disconnect();
+?>
+Done
+--EXPECT--
+Test
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+other: still there
+bool(true)
+bool(true)
+bool(true)
+Done
@@ -0,0 +1,98 @@
+--TEST--
+DCC CHAT requests accepted by Session::dccAccept()
+--SKIPIF--
+<?php if (!extension_loaded("ircclient")) die("skip ircclient not loaded"); ?>
+--FILE--
+<?php
+require __DIR__ . "/server.inc";
+
+use irc\client\Session;
+use irc\client\bench\FakeServer;
+
+echo "Test\n";
+
+$s = new Session("tester", "tester", "tester");
+$srv = new FakeServer;
+$listener = dcc_listen($port);
+$peer = null;
+$events = array();
+
+var_dump(connect($s, $srv));
+var_dump($s->dccAccept(12345, function() {}));
+
+$s->onDccChatReq = function($nick, $addr, $id) use ($s, &$events) {
+	printf("chat request from %s at %s\n", $nick, $addr);
+	var_dump($s->dccReceive($id, fopen("php://memory", "w+")));
+	var_dump($s->dccAccept($id, function($id, $status, $data, $length) use ($s, &$events) {
+		if ($status) {
+			$events[] = "closed";
+		} elseif (!isset($data)) {
+			$events[] = "established";
+		} else {
+			$events[] = "line $data";
+			$s->dccMsg($id, strtoupper($data));
+		}
+	}));
+};
+var_dump(exchange($s, $srv, array(
+	":peer!p@peer.host PRIVMSG tester :\001DCC CHAT chat 2130706433 $port\001",
+)));
+var_dump(run_until($s, $srv, function() use ($listener, &$peer, &$events) {
+	return dcc_accepted($listener, $peer) && in_array("established", $events);
+}));
+
+$received = "";
+fwrite($peer, "hello\r\n");
+var_dump(run_until($s, $srv, function() use ($peer, &$received) {
+	$received .= fread($peer, 512);
+	return false !== strpos($received, "\n");
+}));
+echo trim($received), "\n";
+
+fclose($peer);
+var_dump(run_until($s, $srv, function() use (&$events) {
+	return in_array("closed", $events);
+}));
+echo implode("\n", $events), "\n";
+
+/* only so many are kept unanswered, the oldest is declined */
+$ids = array();
+$s->onDccChatReq = function($nick, $addr, $id) use (&$ids) {
+	$ids[] = $id;
+};
+var_dump(exchange($s, $srv, array_fill(0, 17,
+	":peer!p@peer.host PRIVMSG tester :\001DCC CHAT chat 2130706433 $port\001"
+)));
+var_dump(count($ids));
+var_dump($s->dccAccept($ids[0], function() {}));
+var_dump($s->dccDecline($ids[1]));
+
+$s->disconnect();
+?>
+Done
+--EXPECTF--
+Test
+bool(true)
+
+Warning: irc\client\Session::dccAccept(): %s in %s on line %d
+bool(false)
+chat request from peer at 127.0.0.1
+
+Warning: irc\client\Session::dccReceive(): DCC %d is a chat in %s on line %d
+bool(false)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+HELLO
+bool(true)
+established
+line hello
+closed
+bool(true)
+int(17)
+
+Warning: irc\client\Session::dccAccept(): %s in %s on line %d
+bool(false)
+bool(true)
+Done
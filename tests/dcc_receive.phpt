@@ -0,0 +1,70 @@
+--TEST--
+DCC SEND received into a stream by Session::dccReceive()
+--SKIPIF--
+<?php if (!extension_loaded("ircclient")) die("skip ircclient not loaded"); ?>
+--FILE--
+<?php
+require __DIR__ . "/server.inc";
+
+use irc\client\Session;
+use irc\client\bench\FakeServer;
+
+echo "Test\n";
+
+$s = new Session("tester", "tester", "tester");
+$srv = new FakeServer;
+$listener = dcc_listen($port);
+$peer = null;
+$data = str_repeat("0123456789abcdef", 4096);
+$size = strlen($data);
+$file = fopen("php://memory", "w+");
+$done = false;
+$dccid = null;
+
+$s->onDccSendReq = function($nick, $addr, $filename, $size, $id) use ($s, $file, &$done, &$dccid) {
+	printf("send request of %s (%d bytes) from %s\n", $filename, $size, $nick);
+	$dccid = $id;
+	var_dump($s->dccReceive($id, $file, function($id, $status, $data, $length) use (&$done) {
+		printf("received %d bytes with status %d\n", $length, $status);
+		var_dump($data);
+		$done = true;
+	}, 1));
+};
+
+var_dump(connect($s, $srv));
+var_dump(exchange($s, $srv, array(
+	":peer!p@peer.host PRIVMSG tester :\001DCC SEND data.bin 2130706433 $port $size\001",
+)));
+
+$sent = 0;
+var_dump(run_until($s, $srv, function() use ($listener, &$peer, $data, &$sent, &$done) {
+	if (dcc_accepted($listener, $peer)) {
+		if ($sent < strlen($data)) {
+			$sent += fwrite($peer, substr($data, $sent, 8192));
+		}
+		/* the acknowledgements */
+		fread($peer, 8192);
+	}
+	return $done;
+}));
+fclose($peer);
+
+var_dump($s->dccProgress($dccid));
+rewind($file);
+var_dump(stream_get_contents($file) === $data);
+
+$s->disconnect();
+?>
+Done
+--EXPECT--
+Test
+bool(true)
+send request of data.bin (65536 bytes) from peer
+bool(true)
+bool(true)
+received 65536 bytes with status 0
+NULL
+bool(true)
+bool(false)
+bool(true)
+Done
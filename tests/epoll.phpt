@@ -0,0 +1,63 @@
+--TEST--
+Session::run() with irc\client\OPTION_EPOLL
+--SKIPIF--
+<?php if (!extension_loaded("ircclient")) die("skip ircclient not loaded"); ?>
+<?php if (PHP_OS != "Linux") die("skip epoll is Linux only"); ?>
+--FILE--
+<?php
+require __DIR__ . "/server.inc";
+
+use irc\client\Session;
+use irc\client\bench\FakeServer;
+
+echo "Test\n";
+
+$s = new Session("tester", "tester", "tester");
+$srv = new FakeServer;
+
+$s->setOption(irc\client\OPTION_EPOLL);
+$s->onChannel = function($origin, array $args) {
+	printf("channel %s %s\n", $args[0], $args[1]);
+};
+
+var_dump(connect($s, $srv));
+var_dump(exchange($s, $srv, array(
+	":peer!p@peer.host PRIVMSG #chan :one",
+	":peer!p@peer.host PRIVMSG #chan :two",
+)));
+
+/* watched streams are reported along with those passed in */
+$pair = stream_socket_pair(STREAM_PF_UNIX, STREAM_SOCK_STREAM, 0);
+var_dump($s->watch($pair[1]));
+fwrite($pair[0], "x");
+$fds = $s->run(array(), array(), 1);
+var_dump(count($fds[0]), $fds[0][0] === $pair[1], count($fds[1]));
+
+var_dump($s->unwatch($pair[1]));
+$fds = $s->run(array(), array(), 0.1);
+var_dump(count($fds[0]), count($fds[1]));
+
+/* and the session still works after the set of fds changed */
+var_dump(exchange($s, $srv, array(
+	":peer!p@peer.host PRIVMSG #chan :three",
+)));
+
+$s->disconnect();
+?>
+Done
+--EXPECT--
+Test
+bool(true)
+channel #chan one
+channel #chan two
+bool(true)
+bool(true)
+int(1)
+bool(true)
+int(0)
+bool(true)
+int(0)
+int(0)
+channel #chan three
+bool(true)
+Done
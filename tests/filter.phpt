@@ -0,0 +1,79 @@
+--TEST--
+Session::addFilter() and removeFilter()
+--SKIPIF--
+<?php if (!extension_loaded("ircclient")) die("skip ircclient not loaded"); ?>
+--FILE--
+<?php
+require __DIR__ . "/server.inc";
+
+use irc\client\Session;
+use irc\client\bench\FakeServer;
+
+echo "Test\n";
+
+$s = new Session("tester", "tester", "tester");
+$srv = new FakeServer;
+
+$s->onChannel = function($origin, array $args) {
+	printf("channel %s %s\n", $args[0], $args[1]);
+};
+$s->onPrivmsg = function($origin, array $args) {
+	printf("privmsg %s\n", $args[1]);
+};
+$s->onNumeric = function($origin, $event, array $args) {
+	if ($event == irc\client\RPL_MOTD) {
+		printf("numeric %d %s\n", $event, end($args));
+	}
+};
+
+var_dump($s->addFilter(array("events" => irc\client\EVENT_DCC_CHAT_REQ)));
+var_dump($s->addFilter(array("channels" => "#keep")));
+
+$channels = $s->addFilter(array("channels" => array("#KEEP")));
+$motd = $s->addFilter(array("events" => irc\client\EVENT_NUMERIC, "prefix" => "keep"));
+
+var_dump(connect($s, $srv));
+var_dump(exchange($s, $srv, array(
+	":peer!p@peer.host PRIVMSG #keep :one",
+	":peer!p@peer.host PRIVMSG #drop :two",
+	":peer!p@peer.host PRIVMSG tester :three",
+	":bench.server 372 tester :keep this",
+	":bench.server 372 tester :drop this",
+)));
+
+var_dump($s->removeFilter($channels));
+var_dump($s->removeFilter($channels));
+var_dump(exchange($s, $srv, array(
+	":peer!p@peer.host PRIVMSG #drop :four",
+	":peer!p@peer.host PRIVMSG tester :five",
+	":bench.server 372 tester :drop again",
+)));
+
+$s->clearFilters();
+var_dump(exchange($s, $srv, array(
+	":bench.server 372 tester :drop no more",
+)));
+
+$s->disconnect();
+?>
+Done
+--EXPECTF--
+Test
+
+Warning: irc\client\Session::addFilter(): DCC requests cannot be filtered in %s on line %d
+bool(false)
+
+Warning: irc\client\Session::addFilter(): channels must be an array in %s on line %d
+bool(false)
+bool(true)
+channel #keep one
+numeric 372 keep this
+bool(true)
+bool(true)
+bool(false)
+channel #drop four
+privmsg five
+bool(true)
+numeric 372 drop no more
+bool(true)
+Done
@@ -0,0 +1,76 @@
+--TEST--
+Session::on() and off()
+--SKIPIF--
+<?php if (!extension_loaded("ircclient")) die("skip ircclient not loaded"); ?>
+--FILE--
+<?php
+require __DIR__ . "/server.inc";
+
+use irc\client\Session;
+use irc\client\bench\FakeServer;
+
+echo "Test\n";
+
+$s = new Session("tester", "tester", "tester");
+$srv = new FakeServer;
+
+$listener = function($name) {
+	return function($origin, array $args) use ($name) {
+		printf("%s %s\n", $name, $args[1]);
+	};
+};
+
+$s->onChannel = $listener("handler");
+$low = $s->on(irc\client\EVENT_CHANNEL, $listener("low"), irc\client\PRIORITY_LOW);
+$normal1 = $s->on(irc\client\EVENT_CHANNEL, $listener("normal 1"));
+$high = $s->on(irc\client\EVENT_CHANNEL, $listener("high"), irc\client\PRIORITY_HIGH);
+$normal2 = $s->on(irc\client\EVENT_CHANNEL, $listener("normal 2"), irc\client\PRIORITY_NORMAL);
+/* removes the low one while dispatching, which only counts for the next event */
+$s->on(irc\client\EVENT_CHANNEL, function() use ($s, &$low) {
+	if ($low) {
+		var_dump($s->off($low));
+		$low = null;
+	}
+}, irc\client\PRIORITY_HIGH);
+
+var_dump($s->on(1 << 30, $listener("nothing")));
+var_dump($s->on(irc\client\EVENT_CHANNEL|irc\client\EVENT_PRIVMSG, $listener("nothing")));
+
+var_dump(connect($s, $srv));
+var_dump(exchange($s, $srv, array(
+	":peer!p@peer.host PRIVMSG #chan :one",
+)));
+
+var_dump($s->off($normal1));
+var_dump($s->off($normal1));
+$s->onChannel = null;
+
+var_dump(exchange($s, $srv, array(
+	":peer!p@peer.host PRIVMSG #chan :two",
+)));
+
+$s->disconnect();
+?>
+Done
+--EXPECTF--
+Test
+
+Warning: irc\client\Session::on(): unknown event 1073741824 in %s on line %d
+bool(false)
+
+Warning: irc\client\Session::on(): unknown event %d in %s on line %d
+bool(false)
+bool(true)
+high one
+bool(true)
+handler one
+normal 1 one
+normal 2 one
+low one
+bool(true)
+bool(true)
+bool(false)
+high two
+normal 2 two
+bool(true)
+Done
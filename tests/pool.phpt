@@ -0,0 +1,91 @@
+--TEST--
+SessionPool::run() drives several sessions at once
+--SKIPIF--
+<?php if (!extension_loaded("ircclient")) die("skip ircclient not loaded"); ?>
+--FILE--
+<?php
+require __DIR__ . "/server.inc";
+
+use irc\client\Session;
+use irc\client\SessionPool;
+use irc\client\bench\FakeServer;
+
+echo "Test\n";
+
+/* each server only knows about its own client, so let them take turns */
+function run_all(SessionPool $pool, array $servers, $done) {
+	$until = microtime(true) + 5;
+
+	while (!$done()) {
+		foreach ($servers as $server) {
+			if (microtime(true) > $until || !$server->tick($pool, 0.02)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+$pool = new SessionPool;
+$sessions = $servers = $events = array();
+
+foreach (array("a", "b") as $name) {
+	$s = new Session($name, $name, $name);
+	$s->onConnect = function($origin, array $args) use (&$events) {
+		$events[] = "connected as $args[0]";
+	};
+	$s->onChannel = function($origin, array $args) use (&$events) {
+		$events[] = "channel $args[0] $args[1]";
+	};
+	$servers[$name] = new FakeServer;
+	var_dump($s->doConnect(false, "127.0.0.1", $servers[$name]->getPort()));
+	$pool->add($s);
+	$sessions[$name] = $s;
+}
+var_dump($pool->count());
+
+var_dump(run_all($pool, $servers, function() use (&$events) {
+	return count($events) == 2;
+}));
+sort($events);
+print_r($events);
+
+$events = array();
+$servers["a"]->send(":peer!p@peer.host PRIVMSG #a :one");
+$servers["b"]->send(":peer!p@peer.host PRIVMSG #b :two");
+var_dump(run_all($pool, $servers, function() use (&$events) {
+	return count($events) == 2;
+}));
+sort($events);
+print_r($events);
+
+var_dump($pool->remove($sessions["b"]));
+var_dump($pool->remove($sessions["b"]));
+var_dump($pool->count());
+
+foreach ($sessions as $s) {
+	$s->disconnect();
+}
+?>
+Done
+--EXPECT--
+Test
+bool(true)
+bool(true)
+int(2)
+bool(true)
+Array
+(
+    [0] => connected as a
+    [1] => connected as b
+)
+bool(true)
+Array
+(
+    [0] => channel #a one
+    [1] => channel #b two
+)
+bool(true)
+bool(false)
+int(1)
+Done
@@ -0,0 +1,55 @@
+--TEST--
+Session::setFloodControl() sends queued lines highest priority first, up to max lines
+--SKIPIF--
+<?php if (!extension_loaded("ircclient")) die("skip ircclient not loaded"); ?>
+--FILE--
+<?php
+require __DIR__ . "/server.inc";
+
+use irc\client\Session;
+use irc\client\bench\FakeServer;
+
+echo "Test\n";
+
+$s = new Session("tester", "tester", "tester");
+$srv = new FakeServer;
+
+var_dump(connect($s, $srv));
+
+$s->setFloodControl(100, 5, 3);
+var_dump($s->doMsg("#chan", "low"));
+var_dump($s->doJoin("#chan"));
+var_dump($s->doNick("other"));
+var_dump($s->doMsg("#chan", "refused"));
+var_dump($s->getQueueLength());
+
+$lines = array();
+$srv->onLine = function(FakeServer $server, $line) use (&$lines) {
+	$lines[] = $line;
+};
+var_dump(run_until($s, $srv, function() use (&$lines) {
+	return count($lines) >= 3;
+}));
+print_r($lines);
+var_dump($s->getQueueLength());
+?>
+Done
+--EXPECTF--
+Test
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+
+Warning: irc\client\Session::doMsg(): send queue full: 3 lines waiting in %s on line %d
+bool(false)
+int(3)
+bool(true)
+Array
+(
+    [0] => NICK other
+    [1] => JOIN #chan
+    [2] => PRIVMSG #chan :low
+)
+int(0)
+Done
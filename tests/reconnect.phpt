@@ -0,0 +1,56 @@
+--TEST--
+Session::run() connects again as set up by Session::setReconnect()
+--SKIPIF--
+<?php if (!extension_loaded("ircclient")) die("skip ircclient not loaded"); ?>
+--FILE--
+<?php
+require __DIR__ . "/server.inc";
+
+use irc\client\Session;
+use irc\client\bench\FakeServer;
+
+echo "Test\n";
+
+$s = new Session("tester", "tester", "tester");
+$srv = new FakeServer;
+
+$s->setReconnect(2, 0.1, 0.1, 0);
+$s->onConnect = function($origin, array $args) {
+	printf("connected as %s\n", $args[0]);
+};
+
+var_dump(connect($s, $srv));
+var_dump(exchange($s, $srv, array(
+	":tester!t@client.host JOIN #chan",
+)));
+
+$rejoined = false;
+$srv->close();
+$srv->onLine = function(FakeServer $server, $line) use (&$rejoined) {
+	if ($line === "JOIN #chan") {
+		$rejoined = true;
+	}
+};
+var_dump(run_until($s, $srv, function() use (&$rejoined) {
+	return $rejoined;
+}));
+
+/* not after disconnect() */
+$s->disconnect();
+$srv->close();
+var_dump(run_until($s, $srv, function() use ($srv) {
+	return !$srv->closed;
+}, 0.5));
+?>
+Done
+--EXPECTF--
+Test
+connected as tester
+bool(true)
+bool(true)
+
+Warning: irc\client\Session::run(): irc_process: %s in %s on line %d
+connected as tester
+bool(true)
+bool(false)
+Done
@@ -0,0 +1,70 @@
+--TEST--
+Session::getStats() and resetStats()
+--SKIPIF--
+<?php if (!extension_loaded("ircclient")) die("skip ircclient not loaded"); ?>
+--FILE--
+<?php
+require __DIR__ . "/server.inc";
+
+use irc\client\Session;
+use irc\client\bench\FakeServer;
+
+echo "Test\n";
+
+$s = new Session("tester", "tester", "tester");
+$srv = new FakeServer;
+
+$s->onChannel = function($origin, array $args) {
+};
+
+var_dump(connect($s, $srv));
+$s->resetStats();
+
+$lines = array(
+	":peer!p@peer.host PRIVMSG #chan :one",
+	":peer!p@peer.host PRIVMSG #chan :two",
+	":peer!p@peer.host PRIVMSG tester :three",
+);
+var_dump($s->doMsg("#chan", "hi"));
+var_dump(exchange($s, $srv, $lines));
+
+$st = $s->getStats();
+var_dump($st["elapsed"] > 0, $st["wait"] > 0, $st["wait"] <= $st["elapsed"]);
+var_dump($st["lines_in"], $st["bytes_in"] == array_sum(array_map("strlen", $lines)) + 2 * count($lines));
+var_dump($st["commands"], $st["bytes_out"]);
+print_r(array_keys($st["events"]));
+foreach ($st["events"] as $name => $ev) {
+	printf("%s count=%d calls=%d histogram=%d %s\n", $name, $ev["count"], $ev["calls"], array_sum($ev["histogram"]), implode(",", array_keys($ev["histogram"])));
+}
+
+$s->resetStats();
+$st = $s->getStats();
+var_dump($st["lines_in"], $st["commands"], $st["events"]);
+
+$s->disconnect();
+?>
+Done
+--EXPECT--
+Test
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+int(3)
+bool(true)
+int(1)
+int(19)
+Array
+(
+    [0] => onChannel
+    [1] => onPrivmsg
+)
+onChannel count=2 calls=2 histogram=2 10us,100us,1ms,10ms,100ms,1s,inf
+onPrivmsg count=1 calls=0 histogram=0 10us,100us,1ms,10ms,100ms,1s,inf
+int(0)
+int(0)
+array(0) {
+}
+Done
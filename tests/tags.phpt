@@ -0,0 +1,87 @@
+--TEST--
+Session::getTags() and irc\client\Tags
+--SKIPIF--
+<?php if (!extension_loaded("ircclient")) die("skip ircclient not loaded"); ?>
+--FILE--
+<?php
+require __DIR__ . "/server.inc";
+
+use irc\client\Session;
+use irc\client\Tags;
+use irc\client\bench\FakeServer;
+
+echo "Test\n";
+
+$s = new Session("tester", "tester", "tester");
+$srv = new FakeServer;
+$srv->caps = array("message-tags" => "", "server-time" => "");
+
+$s->setOption(irc\client\OPTION_MESSAGE_TAGS);
+$s->onChannel = function($origin, array $args) use ($s) {
+	$tags = $s->getTags();
+	printf("channel %s\n", $args[1]);
+	if (!$tags) {
+		var_dump($tags);
+		return;
+	}
+	var_dump($tags instanceof Tags, count($tags), $tags["+draft/label"], $tags["flag"], isset($tags["nope"]), $tags["nope"], $tags->getTime());
+	print_r($tags->toArray());
+	$tags["msgid"] = "other";
+};
+$s->onNumeric = function($origin, $event, array $args) use ($s) {
+	if ($event == irc\client\RPL_MOTD) {
+		printf("numeric %d %s %.3F\n", $event, end($args), $s->getTags()->getTime());
+	}
+};
+$s->onCtcpReq = function($origin, array $args) use ($s) {
+	$tags = $s->getTags();
+	printf("ctcp %s msgid=%s\n", $args[0], $tags["msgid"]);
+};
+$s->onDccChatReq = function() {
+	echo "not a DCC request\n";
+};
+
+var_dump(connect($s, $srv));
+print_r(array_keys($s->getCaps()));
+var_dump(exchange($s, $srv, array(
+	"@msgid=x1;+draft/label=a\\sb\\:c;flag :peer!p@peer.host PRIVMSG #chan :tagged",
+	":peer!p@peer.host PRIVMSG #chan :untagged",
+	"@time=2024-01-02T03:04:05.678Z :bench.server 372 tester :- motd",
+	"@msgid=x2 :peer!p@peer.host PRIVMSG tester :\001DCC CHAT chat 2130706433 1234\001",
+)));
+var_dump($s->getTags());
+
+$s->disconnect();
+?>
+Done
+--EXPECTF--
+Test
+bool(true)
+Array
+(
+    [0] => message-tags
+    [1] => server-time
+)
+channel tagged
+bool(true)
+int(3)
+string(5) "a b;c"
+string(0) ""
+bool(false)
+NULL
+NULL
+Array
+(
+    [msgid] => x1
+    [+draft/label] => a b;c
+    [flag] => 
+)
+
+Warning: irc\client\Tags::offsetSet(): irc\client\Tags is read-only in %s on line %d
+channel untagged
+NULL
+numeric 372 - motd 1704164645.678
+ctcp DCC CHAT chat 2130706433 1234 msgid=x2
+bool(true)
+NULL
+Done
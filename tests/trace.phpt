@@ -0,0 +1,63 @@
+--TEST--
+Session::setTrace() and dumpTrace()
+--SKIPIF--
+<?php if (!extension_loaded("ircclient")) die("skip ircclient not loaded"); ?>
+--FILE--
+<?php
+require __DIR__ . "/server.inc";
+
+use irc\client\Session;
+use irc\client\bench\FakeServer;
+
+echo "Test\n";
+
+$s = new Session("tester", "tester", "tester");
+$srv = new FakeServer;
+
+var_dump($s->dumpTrace());
+$s->setTrace(100000);
+$s->setTrace(3);
+
+var_dump(connect($s, $srv));
+var_dump(exchange($s, $srv, array(
+	":peer!p@peer.host PRIVMSG #chan :dropped from the ring",
+	":peer!p@peer.host PRIVMSG #chan :hello",
+	":bench.server 372 tester :- motd",
+	":peer!p@peer.host PRIVMSG tester :hi there",
+)));
+
+$last = 0;
+foreach ($s->dumpTrace() as $t) {
+	printf("%s %d %s %d %s %s\n", $t["event"], $t["code"], $t["origin"], $t["count"],
+		implode(",", $t["lengths"]), $t["time"] >= $last ? "ok" : "backwards");
+	$last = $t["time"];
+}
+
+$fp = fopen("php://memory", "w+");
+var_dump($s->dumpTrace($fp));
+rewind($fp);
+echo preg_replace("/^[0-9.]+ +/m", "", stream_get_contents($fp));
+
+$s->setTrace(0);
+var_dump($s->dumpTrace());
+$s->disconnect();
+?>
+Done
+--EXPECTF--
+Test
+array(0) {
+}
+
+Warning: irc\client\Session::setTrace(): keeping at most 65536 records in %s on line %d
+bool(true)
+bool(true)
+onChannel 0 peer!p@peer.host 2 5,5 ok
+onNumeric 372 bench.server 2 6,6 ok
+onPrivmsg 0 peer!p@peer.host 2 6,8 ok
+int(3)
+onChannel       000 peer!p@peer.host%w 2 5 5
+onNumeric       372 bench.server%w 2 6 6
+onPrivmsg       000 peer!p@peer.host%w 2 6 8
+array(0) {
+}
+Done
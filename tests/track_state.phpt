@@ -0,0 +1,86 @@
+--TEST--
+irc\client\OPTION_TRACK_STATE
+--SKIPIF--
+<?php if (!extension_loaded("ircclient")) die("skip ircclient not loaded"); ?>
+--FILE--
+<?php
+require __DIR__ . "/server.inc";
+
+use irc\client\Session;
+use irc\client\bench\FakeServer;
+
+echo "Test\n";
+
+$s = new Session("tester", "tester", "tester");
+$srv = new FakeServer;
+
+var_dump($s->getUsers("#chan"));
+
+$s->setOption(irc\client\OPTION_TRACK_STATE);
+var_dump(connect($s, $srv));
+var_dump($s->getChannels());
+
+var_dump(exchange($s, $srv, array(
+	":tester!t@client.host JOIN #Chan",
+	":bench.server 353 tester = #Chan :@tester +Voiced plain",
+	":bench.server 366 tester #Chan :End of /NAMES list.",
+)));
+print_r($s->getChannels());
+print_r($s->getUsers("#chan"));
+var_dump($s->isOn("#CHAN"), $s->isOn("#chan", "VOICED"), $s->isOn("#chan", "nobody"), $s->isOn("#other"));
+
+var_dump(exchange($s, $srv, array(
+	":op!o@op.host MODE #chan +o-v plain Voiced",
+	":Voiced!v@voiced.host NICK [Renamed]",
+	":plain!p@plain.host PART #chan",
+	":joiner!j@joiner.host JOIN #chan",
+)));
+print_r($s->getUsers("#chan"));
+/* CASEMAPPING=rfc1459 */
+var_dump($s->getModes("#chan", "{renamed}"), $s->getModes("#chan", "plain"));
+
+var_dump(exchange($s, $srv, array(
+	":op!o@op.host KICK #chan tester :bye",
+)));
+var_dump($s->getChannels(), $s->getUsers("#chan"));
+
+$s->disconnect();
+?>
+Done
+--EXPECTF--
+Test
+
+Notice: irc\client\Session::getUsers(): state tracking is not enabled in %s on line %d
+bool(false)
+bool(true)
+array(0) {
+}
+bool(true)
+Array
+(
+    [0] => #Chan
+)
+Array
+(
+    [tester] => o
+    [Voiced] => v
+    [plain] => 
+)
+bool(true)
+bool(true)
+bool(false)
+bool(false)
+bool(true)
+Array
+(
+    [tester] => o
+    [[Renamed]] => 
+    [joiner] => 
+)
+string(0) ""
+bool(false)
+bool(true)
+array(0) {
+}
+bool(false)
+Done
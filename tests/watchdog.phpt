@@ -0,0 +1,77 @@
+--TEST--
+Session::setWatchdog()
+--SKIPIF--
+<?php if (!extension_loaded("ircclient")) die("skip ircclient not loaded"); ?>
+--FILE--
+<?php
+require __DIR__ . "/server.inc";
+
+use irc\client\Session;
+use irc\client\bench\FakeServer;
+
+echo "Test\n";
+
+$s = new Session("tester", "tester", "tester");
+$srv = new FakeServer;
+
+$s->setWatchdog(0.05);
+$s->onChannel = function($origin, array $args) {
+	if ($args[1] === "slow") {
+		usleep(100000);
+	}
+};
+$s->onSlowHandler = function($handler, $took) {
+	printf("slow %s %s\n", $handler, $took >= 0.05 ? "ok" : "too early");
+};
+
+var_dump(connect($s, $srv));
+
+/* more than libircclient reads at once, so that the PING is still waiting in the socket */
+$lines = array(":peer!p@peer.host PRIVMSG #chan :slow");
+for ($i = 0; $i < 20; ++$i) {
+	$lines[] = ":peer!p@peer.host PRIVMSG #chan :" . str_repeat("x", 80);
+}
+$lines[] = "PING :early";
+$lines[] = "PING :done";
+
+$pongs = array();
+$done = false;
+$srv->onLine = function(FakeServer $server, $line) use (&$pongs, &$done) {
+	if (false !== strpos($line, "early")) {
+		$pongs[] = $line;
+	} elseif (false !== strpos($line, "done")) {
+		$done = true;
+	}
+};
+$srv->schedule($lines);
+var_dump(run_until($s, $srv, function() use (&$done) {
+	return $done;
+}));
+/* answered from within the slow handler first */
+var_dump($pongs[0]);
+
+/* a warning without onSlowHandler */
+$s->onSlowHandler = null;
+var_dump(exchange($s, $srv, array(
+	":peer!p@peer.host PRIVMSG #chan :slow",
+)));
+
+$s->setWatchdog(0);
+var_dump(exchange($s, $srv, array(
+	":peer!p@peer.host PRIVMSG #chan :slow",
+)));
+
+$s->disconnect();
+?>
+Done
+--EXPECTF--
+Test
+bool(true)
+slow onChannel ok
+bool(true)
+string(11) "PONG :early"
+
+Warning: irc\client\Session::run(): onChannel took %f seconds in %s on line %d
+bool(true)
+bool(true)
+Done